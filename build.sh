@@ -18,6 +18,10 @@ make PLATFORM=LTE2 FLASH_TYPE=intel16 clean
 make PLATFORM=LTE1C FLASH_TYPE=intel16 clean
 make PLATFORM=LTE2C FLASH_TYPE=intel16 clean
 make PLATFORM=LTE1 FLASH_TYPE=amd16 clean
+make PLATFORM=LTE1 FLASH_TYPE=intel32 clean
+make PLATFORM=LTE1 FLASH_TYPE=amd32 clean
+make PLATFORM=LTE1 FLASH_TYPE=auto clean
+make PLATFORM=LTE2 FLASH_TYPE=auto clean
 
 make PLATFORM=LTE1 FLASH_TYPE=intel16
 mv hitagi.ldr Hitagi_LTE1_Intel_16.ldr
@@ -38,3 +42,19 @@ make PLATFORM=LTE2C FLASH_TYPE=intel16 clean
 make PLATFORM=LTE1 FLASH_TYPE=amd16
 mv hitagi.ldr Hitagi_LTE1_AMD_16.ldr
 make PLATFORM=LTE1 FLASH_TYPE=amd16 clean
+
+make PLATFORM=LTE1 FLASH_TYPE=intel32
+mv hitagi.ldr Hitagi_LTE1_Intel_32.ldr
+make PLATFORM=LTE1 FLASH_TYPE=intel32 clean
+
+make PLATFORM=LTE1 FLASH_TYPE=amd32
+mv hitagi.ldr Hitagi_LTE1_AMD_32.ldr
+make PLATFORM=LTE1 FLASH_TYPE=amd32 clean
+
+make PLATFORM=LTE1 FLASH_TYPE=auto
+mv hitagi.ldr Hitagi_LTE1_Auto_16.ldr
+make PLATFORM=LTE1 FLASH_TYPE=auto clean
+
+make PLATFORM=LTE2 FLASH_TYPE=auto
+mv hitagi.ldr Hitagi_LTE2_Auto_16.ldr
+make PLATFORM=LTE2 FLASH_TYPE=auto clean
@@ -0,0 +1,139 @@
+/*
+ * About:
+ *   General flash functions dispatched to the flash chip driver picked at start.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ *
+ * Documentation:
+ *  JESD68.01 Common Flash Interface (CFI).
+ */
+
+#include "flash.h"
+
+#define FLASH_DRIVERS                  (sizeof(flash_drivers) / sizeof(flash_drivers[0]))
+
+/**
+ * Functions.
+ */
+
+#if defined(FLASH_OPS_RUNTIME)
+static u16 flash_cfi_command_set(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+#endif
+
+/**
+ * Drivers section.
+ */
+
+#if defined(FLASH_OPS_RUNTIME)
+/* The last driver is taken when none of them matches the chip, single driver builds send no CFI query at all. */
+static const FLASH_OPS_T *const flash_drivers[] = {
+	&flash_amd_ops,
+	&flash_intel_ops,
+};
+
+const FLASH_OPS_T *flash_ops;
+#endif
+
+/*
+ * RESULT_FAIL means the CFI query matched none of the drivers and the last one is taken, the loader goes on with it
+ * and RQDD reports it with CAP_FLASH_DEFAULT.
+ */
+
+int flash_init(void) {
+	int status = RESULT_OK;
+#if defined(FLASH_OPS_RUNTIME)
+	u16 i;
+	u16 command_set;
+#endif
+
+	erase_cmdlet = ERASE_NO;
+
+#if defined(FLASH_OPS_RUNTIME)
+	flash_ops = flash_drivers[FLASH_DRIVERS - 1];
+	status = RESULT_FAIL;
+
+	command_set = flash_cfi_command_set(FLASH_START_ADDRESS);
+
+	for (i = 0; i < FLASH_DRIVERS; ++i) {
+		if (flash_drivers[i]->cfi_command_set == command_set) {
+			flash_ops = flash_drivers[i];
+			status = RESULT_OK;
+			break;
+		}
+	}
+#endif
+
+	/* Leaves the CFI query mode too, only the chosen driver knows the right command for it. */
+	flash_ops->reset(FLASH_START_ADDRESS);
+
+	return status;
+}
+
+#if defined(FLASH_OPS_RUNTIME)
+/*
+ * Chips of the interleaved pair are the same part, the low half of the bus is taken.
+ * Chip stays in the query mode, flash_init() resets it with the chosen driver.
+ */
+
+static u16 flash_cfi_command_set(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
+	volatile FLASH_DATA_WIDTH *query = reg_addr_ctl + FLASH_CFI_QUERY_STRING;
+
+	FLASH_WRITE(reg_addr_ctl + FLASH_CFI_QUERY_ADDRESS, FLASH_CFI_COMMAND_QUERY);
+	nop(12);
+
+	if (
+		((u8) FLASH_READ(query + 0) != 'Q') ||
+		((u8) FLASH_READ(query + 1) != 'R') ||
+		((u8) FLASH_READ(query + 2) != 'Y')
+	) {
+		return 0;
+	}
+
+	return (u16) FLASH_READ(reg_addr_ctl + FLASH_CFI_PRIMARY_COMMAND_SET);
+}
+
+/**
+ * General flash functions, one indirect call per operation, per-word loops stay inside the drivers.
+ * Single driver builds get them as aliases of the driver functions, see the end of flash_intel16.c/flash_amd16.c.
+ */
+
+int flash_unlock(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
+	return flash_ops->unlock(reg_addr_ctl);
+}
+
+int flash_erase(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
+	return flash_ops->erase(reg_addr_ctl);
+}
+
+int flash_write_block(volatile FLASH_DATA_WIDTH *reg_addr_ctl, volatile FLASH_DATA_WIDTH *buffer, u32 size) {
+	return flash_ops->write_block(reg_addr_ctl, buffer, size);
+}
+
+int flash_write_buffer(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH *buffer, u32 size) {
+	return flash_ops->write_buffer(reg_addr_ctl, buffer, size);
+}
+
+int flash_geometry(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
+	return flash_ops->geometry(reg_addr_ctl);
+}
+
+u32 flash_get_part_id(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
+	return flash_ops->get_part_id(reg_addr_ctl);
+}
+
+int flash_get_otp_zone(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u8 *otp_out_buffer, u16 *size) {
+	return flash_ops->get_otp_zone(reg_addr_ctl, otp_out_buffer, size);
+}
+
+int flash_read_protection(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 offset, FLASH_DATA_WIDTH *buffer, u16 count) {
+	return flash_ops->read_protection(reg_addr_ctl, offset, buffer, count);
+}
+
+int flash_read_config(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 config) {
+	return flash_ops->read_config(reg_addr_ctl, config);
+}
+#endif
@@ -14,39 +14,140 @@
 
 #include "platform.h"
 
+/*
+ * Data bus of the flash: one x16 chip or, with FTR_FLASH_DATA_WIDTH_32BIT, two x16 chips side by side on a 32-bit bus.
+ * Every bus cycle of the interleaved pair goes to both chips, so commands are doubled and status is polled for both.
+ * Chip addresses, block sizes and flash span of the pair are FLASH_CHIPS times larger than of the single chip,
+ * FLASH_CHIPS is in platform.h for the journal bitmap.
+ */
+
+#if defined(FTR_FLASH_DATA_WIDTH_32BIT)
+	typedef u32 FLASH_DATA_WIDTH;
+#else
+	typedef u16 FLASH_DATA_WIDTH;
+#endif
+
+#define FLASH_ERASED_WORD              ((FLASH_DATA_WIDTH) ~0)
+
 /**
- * General flash functions.
+ * General flash functions, dispatched to the driver picked by flash_init(), see flash.c.
+ * Single driver builds have no dispatch, these are the functions of the driver itself.
  */
 
 extern int flash_init(void);
-extern int flash_unlock(volatile u16 *reg_addr_ctl);
-extern int flash_erase(volatile u16 *reg_addr_ctl);
-extern int flash_write_block(volatile u16 *reg_addr_ctl, volatile u16 *buffer, u32 size);
-extern int flash_write_buffer(volatile u16 *reg_addr_ctl, const u16 *buffer, u32 size);
-extern int flash_geometry(volatile u16 *reg_addr_ctl);
-extern u32 flash_get_part_id(volatile u16 *reg_addr_ctl);
-extern int flash_get_otp_zone(volatile u16 *reg_addr_ctl, u8 *otp_out_buffer, u16 *size);
+extern int flash_unlock(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+extern int flash_erase(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+extern int flash_write_block(volatile FLASH_DATA_WIDTH *reg_addr_ctl, volatile FLASH_DATA_WIDTH *buffer, u32 size);
+extern int flash_write_buffer(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH *buffer, u32 size);
+extern int flash_geometry(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+extern u32 COLD flash_get_part_id(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+extern int COLD flash_get_otp_zone(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u8 *otp_out_buffer, u16 *size);
+extern int COLD flash_read_protection(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 offset, FLASH_DATA_WIDTH *buffer, u16 count);
+extern int COLD flash_read_config(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 config);
 
 /**
  * Flash section.
  */
 
 #if defined(FTR_FLASH_DATA_WIDTH_32BIT)
-	#define FLASH_COMMAND(x) (((FLASH_DATA_WIDTH) (x) | ((FLASH_DATA_WIDTH) (x) << (sizeof(FLASH_DATA_WIDTH) << 2)))
+	#define FLASH_COMMAND(x) ((FLASH_DATA_WIDTH) (x) | ((FLASH_DATA_WIDTH) (x) << (sizeof(FLASH_DATA_WIDTH) << 2)))
 #else
 	#define FLASH_COMMAND(x) ((FLASH_DATA_WIDTH) (x))
 #endif
 
 #define BUFFER_SIZE_TO_WRITE(s)      FLASH_COMMAND((s) - 1)
 
-#if defined(FTR_FLASH_DATA_WIDTH_32BIT)
-	typedef u32 FLASH_DATA_WIDTH;
+#define FLASH_START_ADDRESS            ((volatile FLASH_DATA_WIDTH *) 0x10000000)
+
+/*
+ * Flash bus accessors, all command and status cycles of the drivers go through these.
+ * Host build routes them to the simulated flash chip, see host/flashsim.
+ */
+
+#if defined(FTR_HOST)
+	extern FLASH_DATA_WIDTH hal_flash_read(volatile FLASH_DATA_WIDTH *addr);
+	extern void hal_flash_write(volatile FLASH_DATA_WIDTH *addr, FLASH_DATA_WIDTH data);
+
+	#define FLASH_READ(a)              hal_flash_read((volatile FLASH_DATA_WIDTH *) (a))
+	#define FLASH_WRITE(a, d)          hal_flash_write((volatile FLASH_DATA_WIDTH *) (a), (FLASH_DATA_WIDTH) (d))
 #else
-	typedef u16 FLASH_DATA_WIDTH;
+	#define FLASH_READ(a)              (*(a))
+	#define FLASH_WRITE(a, d)          (*(a) = (d))
 #endif
 
-#define FLASH_START_ADDRESS            ((volatile FLASH_DATA_WIDTH *) 0x10000000)
-
 #define FLASH_MAX_OTP_SIZE             (1024)
 
+/*
+ * CFI query, JESD68.01 Common Flash Interface. Both chip families enter it by the same cycle at the word 0x55.
+ */
+
+#define FLASH_CFI_QUERY_ADDRESS        (0x55)
+#define FLASH_CFI_QUERY_STRING         (0x10)     /* "QRY" in the low byte of 3 words. */
+#define FLASH_CFI_PRIMARY_COMMAND_SET  (0x13)
+
+#define FLASH_CFI_COMMAND_QUERY        FLASH_COMMAND(0x98)
+
+#define FLASH_CFI_COMMAND_SET_INTEL    (0x0001)   /* Intel/Sharp extended command set. */
+#define FLASH_CFI_COMMAND_SET_AMD      (0x0002)   /* AMD/Fujitsu standard command set. */
+
+/*
+ * Erase regions and write buffer of the driver, the same ones flash_geometry() and flash_write_buffer() use.
+ */
+
+#define FLASH_MAX_REGIONS              (3)
+
+typedef struct {
+	u32 start;
+	u32 end;
+	u32 block_size;
+} FLASH_REGION_T;
+
+typedef struct {
+	u16 write_buffer_size;
+	u8 region_count;
+	FLASH_REGION_T regions[FLASH_MAX_REGIONS];
+} FLASH_INFO_T;
+
+/*
+ * Driver of the flash chip family. Single builds link one driver, FLASH_TYPE=auto links both of them and flash_init()
+ * picks the one whose primary command set matches the CFI query of the chip (0x0001 Intel, 0x0002 AMD).
+ */
+
+#if defined(FTR_FLASH_INTEL) && defined(FTR_FLASH_AMD)
+	#define FLASH_OPS_RUNTIME
+#endif
+
+typedef struct {
+	u16 cfi_command_set;
+	const FLASH_INFO_T *info;
+	u16 imei_pr_offset;            /* Words of the IMEI record in read_protection() space, 0 when the chip has none. */
+	void (*reset)(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+	int (*unlock)(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+	int (*erase)(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+	int (*write_block)(volatile FLASH_DATA_WIDTH *reg_addr_ctl, volatile FLASH_DATA_WIDTH *buffer, u32 size);
+	int (*write_buffer)(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH *buffer, u32 size);
+	int (*geometry)(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+	u32 (*get_part_id)(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+	int (*get_otp_zone)(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u8 *otp_out_buffer, u16 *size);
+	int (*read_protection)(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 offset, FLASH_DATA_WIDTH *buffer, u16 count);
+	int (*read_config)(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 config);
+} FLASH_OPS_T;
+
+#if defined(FTR_FLASH_INTEL)
+	extern const FLASH_OPS_T flash_intel_ops;
+#endif
+
+#if defined(FTR_FLASH_AMD)
+	extern const FLASH_OPS_T flash_amd_ops;
+#endif
+
+/* Table of the only driver is bound at link time, the pointer is set by flash_init() only with both of them. */
+#if defined(FLASH_OPS_RUNTIME)
+	extern const FLASH_OPS_T *flash_ops;
+#elif defined(FTR_FLASH_AMD)
+	#define flash_ops                  (&flash_amd_ops)
+#else
+	#define flash_ops                  (&flash_intel_ops)
+#endif
+
 #endif /* !FLASH_H */
@@ -1,6 +1,7 @@
 /*
  * About:
  *   AMD-like (AMD, Fujitsu, Spansion) flash chips with 16-bit width bus driver.
+ *   Two interleaved chips on 32-bit width bus with FTR_FLASH_DATA_WIDTH_32BIT, see flash.h.
  *
  * Author:
  *   EXL
@@ -20,9 +21,14 @@
 #include "flash.h"
 
 #define FLASH_AMD_START_PARAMETER_BLOCKS_1    ((volatile FLASH_DATA_WIDTH *) 0x10000000)
-#define FLASH_AMD_END_PARAMETER_BLOCKS_1      ((volatile FLASH_DATA_WIDTH *) 0x10020000)
-#define FLASH_AMD_START_PARAMETER_BLOCKS_2    ((volatile FLASH_DATA_WIDTH *) 0x11FE0000)
-#define FLASH_AMD_END_PARAMETER_BLOCKS_2      ((volatile FLASH_DATA_WIDTH *) 0x12000000)
+#define FLASH_AMD_END_PARAMETER_BLOCKS_1      ((volatile FLASH_DATA_WIDTH *) (0x10000000 + 0x0020000 * FLASH_CHIPS))
+#define FLASH_AMD_START_PARAMETER_BLOCKS_2    ((volatile FLASH_DATA_WIDTH *) (0x10000000 + 0x1FE0000 * FLASH_CHIPS))
+#define FLASH_AMD_END_PARAMETER_BLOCKS_2      ((volatile FLASH_DATA_WIDTH *) (0x10000000 + 0x2000000 * FLASH_CHIPS))
+
+#define FLASH_AMD_PARAMETER_BLOCK_SIZE        (0x8000 * FLASH_CHIPS)
+#define FLASH_AMD_MAIN_BLOCK_SIZE             (0x20000 * FLASH_CHIPS)
+
+#define FLASH_AMD_WRITE_BUFFER_WORDS          (16)
 
 #define FLASH_AMD_CMD_REGW_1               (0x00000555)
 #define FLASH_AMD_CMD_REGW_2               (0x000002AA)
@@ -41,49 +47,81 @@
 #define FLASH_AMD_COMMAND_UNLOCK_2         FLASH_COMMAND(0x55)
 #define FLASH_AMD_COMMAND_READ_OTP         FLASH_COMMAND(0x88)
 #define FLASH_AMD_COMMAND_PART_ID          FLASH_COMMAND(0x90)
+#define FLASH_AMD_COMMAND_SET_CONFIG       FLASH_COMMAND(0xD0)
 
-#define FLASH_AMD_PR_LOCK_REG0             (0x80)
+#define FLASH_AMD_SSR_WORDS                (128 / sizeof(u16))  /* Secured silicon sector of every chip. */
 
 /**
  * Functions.
  */
 
-static int flash_wait(volatile u16 *reg_addr_ctl, const u16 data);
-static void flash_reset(volatile u16 *reg_addr_ctl);
-static int flash_write_buffer_16w_32b(volatile u16 *reg_addr_ctl, const u16 *buffer, u32 size);
+static int flash_wait(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH data);
+static void flash_reset(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+static int flash_write_words(volatile FLASH_DATA_WIDTH *dst, volatile FLASH_DATA_WIDTH *src, u32 count);
+static int flash_write_buffer_16w_32b(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH *buffer, u32 size);
+static int flash_amd_unlock(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+static int flash_amd_erase(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+static int flash_amd_write_block(volatile FLASH_DATA_WIDTH *reg_addr_ctl, volatile FLASH_DATA_WIDTH *buffer, u32 size);
+static int flash_amd_write_buffer(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH *buffer, u32 size);
+static int flash_amd_geometry(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+static u32 COLD flash_amd_get_part_id(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+static int COLD flash_amd_get_otp_zone(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u8 *otp_out_buffer, u16 *size);
+static int COLD flash_amd_read_protection(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 offset, FLASH_DATA_WIDTH *buffer, u16 count);
+static int COLD flash_amd_read_config(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 config);
 
 /**
  * Flash section for the AMD based flash chips.
  */
 
-int flash_init(void) {
-	erase_cmdlet = ERASE_NO;
-
-	flash_reset(FLASH_START_ADDRESS);
-
-	return RESULT_OK;
-}
-
-static int flash_wait(volatile u16 *reg_addr_ctl, const u16 data) {
-	u16 word = *reg_addr_ctl;
+static const FLASH_INFO_T flash_amd_info = {
+	FLASH_AMD_WRITE_BUFFER_WORDS * sizeof(FLASH_DATA_WIDTH),
+	3,
+	{
+		{ (u32) FLASH_AMD_START_PARAMETER_BLOCKS_1, (u32) FLASH_AMD_END_PARAMETER_BLOCKS_1,   FLASH_AMD_PARAMETER_BLOCK_SIZE },
+		{ (u32) FLASH_AMD_END_PARAMETER_BLOCKS_1,   (u32) FLASH_AMD_START_PARAMETER_BLOCKS_2, FLASH_AMD_MAIN_BLOCK_SIZE      },
+		{ (u32) FLASH_AMD_START_PARAMETER_BLOCKS_2, (u32) FLASH_AMD_END_PARAMETER_BLOCKS_2,   FLASH_AMD_PARAMETER_BLOCK_SIZE },
+	}
+};
+
+const FLASH_OPS_T flash_amd_ops = {
+	FLASH_CFI_COMMAND_SET_AMD,
+	&flash_amd_info,
+	0,                                 /* IMEI layout of the secured silicon sector is unknown. */
+	flash_reset,
+	flash_amd_unlock,
+	flash_amd_erase,
+	flash_amd_write_block,
+	flash_amd_write_buffer,
+	flash_amd_geometry,
+	flash_amd_get_part_id,
+	flash_amd_get_otp_zone,
+	flash_amd_read_protection,
+	flash_amd_read_config
+};
+
+static int flash_wait(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH data) {
+	FLASH_DATA_WIDTH word = FLASH_READ(reg_addr_ctl);
 
 	while ((word & FLASH_AMD_DATA_DONE_STATUS) != (data & FLASH_AMD_DATA_DONE_STATUS)) {
+		PERF_ADD(flash_busy_polls, 1);
 		watchdog_service();
-		word = *reg_addr_ctl;
+		/* Move USB traffic while the flash is busy. */
+		usb_poll();
+		word = FLASH_READ(reg_addr_ctl);
 	}
 
-	word = *reg_addr_ctl;
+	word = FLASH_READ(reg_addr_ctl);
 	nop(12);
 
 	return (word != data) ? word : RESULT_OK;
 }
 
-static void flash_reset(volatile u16 *reg_addr_ctl) {
-	*reg_addr_ctl = FLASH_AMD_COMMAND_READ;
+static void flash_reset(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
+	FLASH_WRITE(reg_addr_ctl, FLASH_AMD_COMMAND_READ);
 	nop(12);
 }
 
-int flash_unlock(volatile u16 *reg_addr_ctl) {
+static int flash_amd_unlock(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
 	UNUSED(reg_addr_ctl);
 
 	nop(12);
@@ -91,57 +129,57 @@ int flash_unlock(volatile u16 *reg_addr_ctl) {
 	return RESULT_OK;
 }
 
-int flash_erase(volatile u16 *reg_addr_ctl) {
+static int flash_amd_erase(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
 	u32 status;
 
-	*(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_1) = FLASH_AMD_COMMAND_UNLOCK_1;
-	*(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_2) = FLASH_AMD_COMMAND_UNLOCK_2;
+	READ_MODE_ASYNC();
+
+	TRACE(TRACE_ERASE, TRACE_BEGIN, reg_addr_ctl, 0);
 
-	*(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_1) = FLASH_AMD_COMMAND_SETUP_ERASE;
+	FLASH_WRITE(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_UNLOCK_1);
+	FLASH_WRITE(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_2, FLASH_AMD_COMMAND_UNLOCK_2);
 
-	*(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_1) = FLASH_AMD_COMMAND_UNLOCK_1;
-	*(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_2) = FLASH_AMD_COMMAND_UNLOCK_2;
+	FLASH_WRITE(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_SETUP_ERASE);
+
+	FLASH_WRITE(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_UNLOCK_1);
+	FLASH_WRITE(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_2, FLASH_AMD_COMMAND_UNLOCK_2);
 
 #if 0
 	/* Is this will erase entire flash? */
-	*(FLASH_START_ADDRESS + 0x00000000) = FLASH_AMD_COMMAND_ERASE_CHIP;
+	FLASH_WRITE(FLASH_START_ADDRESS + 0x00000000, FLASH_AMD_COMMAND_ERASE_CHIP);
 #endif
 
-	*reg_addr_ctl = FLASH_AMD_COMMAND_ERASE_SECTOR;
+	FLASH_WRITE(reg_addr_ctl, FLASH_AMD_COMMAND_ERASE_SECTOR);
 
-	status = flash_wait(reg_addr_ctl, 0xFFFF);
+	status = flash_wait(reg_addr_ctl, FLASH_ERASED_WORD);
 
 	flash_reset(reg_addr_ctl);
 
+	TRACE(TRACE_ERASE, TRACE_END, reg_addr_ctl, status);
+
 	return status;
 }
 
-int flash_write_block(volatile u16 *reg_addr_ctl, volatile u16 *buffer, u32 size) {
+static int flash_write_words(volatile FLASH_DATA_WIDTH *dst, volatile FLASH_DATA_WIDTH *src, u32 count) {
 	u32 status;
-
-	volatile u16 *src = buffer;
-	volatile u16 *dst = reg_addr_ctl;
-	volatile u16 *end = dst + (size / 2);
-
-	status = RESULT_OK;
+	volatile FLASH_DATA_WIDTH *end = dst + count;
 
 	while (dst < end) {
-		u16 word = *src;
-		if (word != 0xFFFF) {
+		FLASH_DATA_WIDTH word = *src;
+		if (word != FLASH_ERASED_WORD) {
 			/* Write word seq. */
-			*(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_1) = FLASH_AMD_COMMAND_UNLOCK_1;
-			*(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_2) = FLASH_AMD_COMMAND_UNLOCK_2;
+			FLASH_WRITE(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_UNLOCK_1);
+			FLASH_WRITE(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_2, FLASH_AMD_COMMAND_UNLOCK_2);
 
-			*(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_1) = FLASH_AMD_COMMAND_SETUP_WRITE;
+			FLASH_WRITE(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_SETUP_WRITE);
 			nop(12);
 
-			*dst = word;
+			FLASH_WRITE(dst, word);
 
 			/* Wait Loops. */
 			watchdog_service();
 			status = flash_wait(dst, word);
 			if (status != RESULT_OK) {
-				flash_reset(reg_addr_ctl);
 				return status;
 			}
 		}
@@ -149,18 +187,32 @@ int flash_write_block(volatile u16 *reg_addr_ctl, volatile u16 *buffer, u32 size
 		src++;
 	}
 
+	return RESULT_OK;
+}
+
+static int flash_amd_write_block(volatile FLASH_DATA_WIDTH *reg_addr_ctl, volatile FLASH_DATA_WIDTH *buffer, u32 size) {
+	u32 status;
+
+	READ_MODE_ASYNC();
+
+	TRACE(TRACE_PROGRAM, TRACE_BEGIN, reg_addr_ctl, size);
+
+	status = flash_write_words(reg_addr_ctl, buffer, size / sizeof(FLASH_DATA_WIDTH));
+
 	flash_reset(reg_addr_ctl);
 
-	return RESULT_OK;
+	TRACE(TRACE_PROGRAM, TRACE_END, reg_addr_ctl, size);
+
+	return status;
 }
 
-static int flash_write_buffer_16w_32b(volatile u16 *reg_addr_ctl, const u16 *buffer, u32 size) {
-	u16 wcount;
-	u32 word_count = size / 2;
-	volatile u16 *current_offset = reg_addr_ctl;
-	volatile u16 *end_offset = reg_addr_ctl + word_count - 1;
-	volatile u16 *last_loaded_addr = reg_addr_ctl;
-	u16 write_data;
+static int flash_write_buffer_16w_32b(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH *buffer, u32 size) {
+	u32 word_count = size / sizeof(FLASH_DATA_WIDTH);
+	volatile FLASH_DATA_WIDTH *current_offset = reg_addr_ctl;
+	volatile FLASH_DATA_WIDTH *end_offset = reg_addr_ctl + word_count - 1;
+	volatile FLASH_DATA_WIDTH *last_loaded_addr = reg_addr_ctl;
+	FLASH_DATA_WIDTH write_data;
+	u32 status;
 
 	write_data = 0;
 
@@ -168,52 +220,77 @@ static int flash_write_buffer_16w_32b(volatile u16 *reg_addr_ctl, const u16 *buf
 		return RESULT_FAIL;
 	}
 
-	*(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_1) = FLASH_AMD_COMMAND_UNLOCK_1;
-	*(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_2) = FLASH_AMD_COMMAND_UNLOCK_2;
+	FLASH_WRITE(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_UNLOCK_1);
+	FLASH_WRITE(FLASH_START_ADDRESS + FLASH_AMD_CMD_REGW_2, FLASH_AMD_COMMAND_UNLOCK_2);
 
-	*current_offset = FLASH_AMD_COMMAND_SETUP_WRITE_BUF;
+	FLASH_WRITE(current_offset, FLASH_AMD_COMMAND_SETUP_WRITE_BUF);
 	nop(12);
 
-	wcount = (u16) word_count - 1;
-	wcount *= 1;
-
-	*reg_addr_ctl = wcount;
+	FLASH_WRITE(reg_addr_ctl, BUFFER_SIZE_TO_WRITE(word_count));
 
 	while (current_offset <= end_offset) {
 		last_loaded_addr = current_offset;
 
 		write_data = *buffer;
 
-		*current_offset++ = *buffer++;
+		FLASH_WRITE(current_offset, *buffer);
+		current_offset++;
+		buffer++;
 
 		watchdog_service();
 	}
 
-	*last_loaded_addr = FLASH_AMD_COMMAND_CONFIRM;
+	FLASH_WRITE(last_loaded_addr, FLASH_AMD_COMMAND_CONFIRM);
 	nop(32);
 
-	flash_wait(last_loaded_addr, write_data);
+	status = flash_wait(last_loaded_addr, write_data);
 
 	flash_reset(reg_addr_ctl);
 
-	return RESULT_OK;
+	return status;
 }
 
-int flash_write_buffer(volatile u16 *reg_addr_ctl, const u16 *buffer, u32 size) {
-	u16 i;
-	const u16 *src = buffer;
-	volatile u16 *dst = reg_addr_ctl;
+/*
+ * Buffer program must stay in one write-buffer page, so the range goes by whole aligned pages.
+ * Partial pages at the start and the end of the range are programmed word by word.
+ */
+
+static int flash_amd_write_buffer(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH *buffer, u32 size) {
+	u32 status;
+	u32 length;
+	u32 size_index;
+	const FLASH_DATA_WIDTH *src = buffer;
+	volatile FLASH_DATA_WIDTH *dst = reg_addr_ctl;
+
+	size_index = size / sizeof(FLASH_DATA_WIDTH);
+	status = RESULT_OK;
+
+	READ_MODE_ASYNC();
+
+	TRACE(TRACE_PROGRAM, TRACE_BEGIN, reg_addr_ctl, size);
+
+	while ((size_index > 0) && (status == RESULT_OK)) {
+		length = FLASH_AMD_WRITE_BUFFER_WORDS - ((dst - FLASH_START_ADDRESS) & (FLASH_AMD_WRITE_BUFFER_WORDS - 1));
+		length = (size_index < length) ? size_index : length;
+
+		if (length == FLASH_AMD_WRITE_BUFFER_WORDS) {
+			status = flash_write_buffer_16w_32b(dst, src, length * sizeof(FLASH_DATA_WIDTH));
+		} else {
+			status = flash_write_words(dst, (volatile FLASH_DATA_WIDTH *) src, length);
+			flash_reset(reg_addr_ctl);
+		}
 
-	for (i = 0; i < (size / 2) / 16; i++) {
-		flash_write_buffer_16w_32b(dst, src, 32);
-		src += 16;
-		dst += 16;
+		src += length;
+		dst += length;
+		size_index -= length;
 	}
 
-	return RESULT_OK;
+	TRACE(TRACE_PROGRAM, TRACE_END, reg_addr_ctl, size);
+
+	return status;
 }
 
-int flash_geometry(volatile u16 *reg_addr_ctl) {
+static int flash_amd_geometry(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
 	u32 block_size;
 	u32 addr = (u32) reg_addr_ctl;
 
@@ -221,9 +298,9 @@ int flash_geometry(volatile u16 *reg_addr_ctl) {
 		((addr >= (u32) FLASH_AMD_START_PARAMETER_BLOCKS_1) && (addr < (u32) FLASH_AMD_END_PARAMETER_BLOCKS_1)) ||
 		((addr >= (u32) FLASH_AMD_START_PARAMETER_BLOCKS_2) && (addr < (u32) FLASH_AMD_END_PARAMETER_BLOCKS_2))
 	) {
-		block_size = 0x8000;  /* 0x8000x8 parameter blocks in the start and end of flash. */
+		block_size = FLASH_AMD_PARAMETER_BLOCK_SIZE; /* 0x8000x8 parameter blocks in the start and end of flash. */
 	} else {
-		block_size = 0x20000; /* 0x20000x254+ main blocks. */
+		block_size = FLASH_AMD_MAIN_BLOCK_SIZE;      /* 0x20000x254+ main blocks. */
 	}
 
 	/*
@@ -233,21 +310,23 @@ int flash_geometry(volatile u16 *reg_addr_ctl) {
 	return (addr & (block_size - 1));
 }
 
-u32 flash_get_part_id(volatile u16 *reg_addr_ctl) {
+static u32 flash_amd_get_part_id(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
 	u32 flash_part_id;
 
 	flash_part_id = 0;
 
-	*(reg_addr_ctl + FLASH_AMD_CMD_REGW_1) = FLASH_AMD_COMMAND_UNLOCK_1;
-	*(reg_addr_ctl + FLASH_AMD_CMD_REGW_2) = FLASH_AMD_COMMAND_UNLOCK_2;
+	READ_MODE_ASYNC();
+
+	FLASH_WRITE(reg_addr_ctl + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_UNLOCK_1);
+	FLASH_WRITE(reg_addr_ctl + FLASH_AMD_CMD_REGW_2, FLASH_AMD_COMMAND_UNLOCK_2);
 	nop(12);
 
-	*(reg_addr_ctl + FLASH_AMD_CMD_REGW_1) = FLASH_AMD_COMMAND_PART_ID;
+	FLASH_WRITE(reg_addr_ctl + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_PART_ID);
 	nop(12);
 
-	flash_part_id  = (u32) (*(reg_addr_ctl + 0x0001) & 0x000000FF) << 16;
-	flash_part_id |= (u32) (*(reg_addr_ctl + 0x000E) & 0x000000FF) <<  8;
-	flash_part_id |= (u32) (*(reg_addr_ctl + 0x000F) & 0x000000FF) <<  0;
+	flash_part_id  = (u32) (FLASH_READ(reg_addr_ctl + 0x0001) & 0x000000FF) << 16;
+	flash_part_id |= (u32) (FLASH_READ(reg_addr_ctl + 0x000E) & 0x000000FF) <<  8;
+	flash_part_id |= (u32) (FLASH_READ(reg_addr_ctl + 0x000F) & 0x000000FF) <<  0;
 
 	flash_reset(reg_addr_ctl);
 
@@ -262,45 +341,92 @@ u32 flash_get_part_id(volatile u16 *reg_addr_ctl) {
  *   2^7 = 128 bytes, 1024 bits.
  */
 
-int flash_get_otp_zone(volatile u16 *reg_addr_ctl, u8 *otp_out_buffer, u16 *size) {
+static int flash_amd_get_otp_zone(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u8 *otp_out_buffer, u16 *size) {
 	u16 i;
-	u16 otp_regs[64];
+	FLASH_DATA_WIDTH otp_regs[FLASH_AMD_SSR_WORDS];
+
+	volatile u8 *otp_regs_ptr_u8 = (volatile u8 *) otp_regs;
 
-	volatile u16 *flash = reg_addr_ctl;
+	*size = sizeof(otp_regs);
 
-	*(reg_addr_ctl + FLASH_AMD_CMD_REGW_1) = FLASH_AMD_COMMAND_UNLOCK_1;
-	*(reg_addr_ctl + FLASH_AMD_CMD_REGW_2) = FLASH_AMD_COMMAND_UNLOCK_2;
-	nop(12);
+	flash_amd_read_protection(reg_addr_ctl, 0, otp_regs, FLASH_AMD_SSR_WORDS);
 
-	*(reg_addr_ctl + FLASH_AMD_CMD_REGW_1) = FLASH_AMD_COMMAND_READ_OTP;
-	nop(12);
+	for (i = 0; i < *size; ++i) {
+		otp_out_buffer[i] = otp_regs_ptr_u8[i];
+	}
 
-	*size = 128;
+	return RESULT_OK;
+}
 
-	flash += FLASH_AMD_PR_LOCK_REG0;
+static int flash_amd_read_protection(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 offset, FLASH_DATA_WIDTH *buffer, u16 count) {
+	u16 i;
 
-	for (i = 0; i < 8; ++i, ++flash) {
-		otp_regs[i] = *flash;
+	READ_MODE_ASYNC();
 
-		watchdog_service();
-	}
+	/* Secured silicon sector is entered once for all words. */
+	FLASH_WRITE(reg_addr_ctl + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_UNLOCK_1);
+	FLASH_WRITE(reg_addr_ctl + FLASH_AMD_CMD_REGW_2, FLASH_AMD_COMMAND_UNLOCK_2);
+	nop(12);
 
-	flash--;
+	FLASH_WRITE(reg_addr_ctl + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_READ_OTP);
+	nop(12);
 
-	*(reg_addr_ctl + FLASH_AMD_CMD_REGW_1) = FLASH_AMD_COMMAND_UNLOCK_1;
-	*(reg_addr_ctl + FLASH_AMD_CMD_REGW_2) = FLASH_AMD_COMMAND_UNLOCK_2;
+	for (i = 0; i < count; ++i) {
+		buffer[i] = FLASH_READ(reg_addr_ctl + offset + i);
+	}
+
+	FLASH_WRITE(reg_addr_ctl + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_UNLOCK_1);
+	FLASH_WRITE(reg_addr_ctl + FLASH_AMD_CMD_REGW_2, FLASH_AMD_COMMAND_UNLOCK_2);
 	nop(12);
 
-	*(reg_addr_ctl + FLASH_AMD_CMD_REGW_1) = FLASH_AMD_COMMAND_PART_ID;
+	FLASH_WRITE(reg_addr_ctl + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_PART_ID);
 	nop(12);
 
 	flash_reset(reg_addr_ctl);
 
-	volatile u8 *otp_regs_ptr_u8 = (volatile u8 *) otp_regs;
+	watchdog_service();
 
-	for (i = 0; i < 128; ++i) {
-		otp_out_buffer[i] = otp_regs_ptr_u8[i];
-	}
+	return RESULT_OK;
+}
+
+/*
+ * S71WS-Nx0 configuration register, burst mode of array reads, see READ_MODE command.
+ * Register keeps its value over the software reset, only the hardware reset restores the asynchronous default.
+ */
+
+static int flash_amd_read_config(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 config) {
+	FLASH_WRITE(reg_addr_ctl + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_UNLOCK_1);
+	FLASH_WRITE(reg_addr_ctl + FLASH_AMD_CMD_REGW_2, FLASH_AMD_COMMAND_UNLOCK_2);
+	nop(12);
+
+	FLASH_WRITE(reg_addr_ctl + FLASH_AMD_CMD_REGW_1, FLASH_AMD_COMMAND_SET_CONFIG);
+	nop(12);
+
+	FLASH_WRITE(reg_addr_ctl, FLASH_COMMAND(config));
+	nop(12);
+
+	flash_reset(reg_addr_ctl);
 
 	return RESULT_OK;
 }
+
+/*
+ * Single driver builds call the driver with no dispatch, the general flash functions are its own ones.
+ */
+
+#if !defined(FLASH_OPS_RUNTIME)
+int flash_unlock(volatile FLASH_DATA_WIDTH *reg_addr_ctl) __attribute__((alias("flash_amd_unlock")));
+int flash_erase(volatile FLASH_DATA_WIDTH *reg_addr_ctl) __attribute__((alias("flash_amd_erase")));
+int flash_write_block(volatile FLASH_DATA_WIDTH *reg_addr_ctl, volatile FLASH_DATA_WIDTH *buffer, u32 size)
+	__attribute__((alias("flash_amd_write_block")));
+int flash_write_buffer(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH *buffer, u32 size)
+	__attribute__((alias("flash_amd_write_buffer")));
+int flash_geometry(volatile FLASH_DATA_WIDTH *reg_addr_ctl) __attribute__((alias("flash_amd_geometry")));
+u32 flash_get_part_id(volatile FLASH_DATA_WIDTH *reg_addr_ctl) __attribute__((alias("flash_amd_get_part_id")));
+int flash_get_otp_zone(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u8 *otp_out_buffer, u16 *size)
+	__attribute__((alias("flash_amd_get_otp_zone")));
+int flash_read_protection(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 offset, FLASH_DATA_WIDTH *buffer, u16 count)
+	__attribute__((alias("flash_amd_read_protection")));
+int flash_read_config(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 config)
+	__attribute__((alias("flash_amd_read_config")));
+#endif
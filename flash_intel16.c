@@ -1,6 +1,7 @@
 /*
  * About:
  *   Intel-like (Intel, ST, Numonyx, etc.) flash chips with 16-bit width bus driver.
+ *   Two interleaved chips on 32-bit width bus with FTR_FLASH_DATA_WIDTH_32BIT, see flash.h.
  *
  * Author:
  *   EXL
@@ -19,14 +20,20 @@
 #include "flash.h"
 
 #define FLASH_INTEL_START_PARAMETER_BLOCKS   ((volatile FLASH_DATA_WIDTH *) 0x10000000)
-#define FLASH_INTEL_END_PARAMETER_BLOCKS     ((volatile FLASH_DATA_WIDTH *) 0x10020000)
+#define FLASH_INTEL_END_PARAMETER_BLOCKS     ((volatile FLASH_DATA_WIDTH *) (0x10000000 + 0x20000 * FLASH_CHIPS))
+
+#define FLASH_INTEL_PARAMETER_BLOCK_SIZE     (0x8000 * FLASH_CHIPS)
+#define FLASH_INTEL_MAIN_BLOCK_SIZE          (0x20000 * FLASH_CHIPS)
 
 #define FLASH_INTEL_STATUS_READY           FLASH_COMMAND(0x80)
+#define FLASH_INTEL_STATUS_ERRORS          FLASH_COMMAND(0x30)
 
 #define FLASH_INTEL_COMMAND_ERASE          FLASH_COMMAND(0x20)
 #define FLASH_INTEL_COMMAND_WRITE          FLASH_COMMAND(0x40)
 #define FLASH_INTEL_COMMAND_CLEAR          FLASH_COMMAND(0x50)
 #define FLASH_INTEL_COMMAND_LOCK           FLASH_COMMAND(0x60)
+#define FLASH_INTEL_COMMAND_CONFIG_SETUP   FLASH_COMMAND(0x60)
+#define FLASH_INTEL_COMMAND_SET_RCR        FLASH_COMMAND(0x03)
 #define FLASH_INTEL_COMMAND_PART_ID        FLASH_COMMAND(0x90)
 #define FLASH_INTEL_COMMAND_WRITE_PROTECT  FLASH_COMMAND(0xC0)
 #define FLASH_INTEL_COMMAND_CONFIRM        FLASH_COMMAND(0xD0)
@@ -39,78 +46,141 @@
 #define FLASH_INTEL_PR__64BIT_SIZE_16BIT   (( 64 >> 3) >> (sizeof(u16) >> 1))
 #define FLASH_INTEL_PR_128BIT_SIZE_16BIT   ((128 >> 3) >> (sizeof(u16) >> 1))
 
+/* User 64-bit register follows lock register 0 and the factory ID, Motorola keeps the IMEI record there. */
+#define FLASH_INTEL_PR_USER                (FLASH_INTEL_PR_LOCK_REG0 + 1 + FLASH_INTEL_PR__64BIT_SIZE_16BIT)
+
+#define FLASH_INTEL_END_MAIN_BLOCKS        ((volatile FLASH_DATA_WIDTH *) (0x10000000 + 0x2000000 * FLASH_CHIPS))
+
+#define FLASH_INTEL_WRITE_BUFFER_WORDS     (32)
+
 /**
  * Functions.
  */
 
-static void flash_wait(volatile u16 *reg_addr_ctl);
-static void flash_reset(volatile u16 *reg_addr_ctl);
+static int flash_wait(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+static void flash_reset(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+static int flash_intel_unlock(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+static int flash_intel_erase(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+static int flash_intel_write_block(volatile FLASH_DATA_WIDTH *reg_addr_ctl, volatile FLASH_DATA_WIDTH *buffer, u32 size);
+static int flash_intel_write_buffer(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH *buffer, u32 size);
+static int flash_intel_geometry(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+static u32 COLD flash_intel_get_part_id(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+static int COLD flash_intel_get_otp_zone(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u8 *otp_out_buffer, u16 *size);
+static int COLD flash_intel_read_protection(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 offset, FLASH_DATA_WIDTH *buffer, u16 count);
+static int COLD flash_intel_read_config(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 config);
 
 /**
  * Flash section for the Intel based flash chips.
  */
 
-int flash_init(void) {
-	erase_cmdlet = ERASE_NO;
-
-	flash_reset(FLASH_START_ADDRESS);
+static const FLASH_INFO_T flash_intel_info = {
+	FLASH_INTEL_WRITE_BUFFER_WORDS * sizeof(FLASH_DATA_WIDTH),
+	2,
+	{
+		{ (u32) FLASH_INTEL_START_PARAMETER_BLOCKS, (u32) FLASH_INTEL_END_PARAMETER_BLOCKS, FLASH_INTEL_PARAMETER_BLOCK_SIZE },
+		{ (u32) FLASH_INTEL_END_PARAMETER_BLOCKS,   (u32) FLASH_INTEL_END_MAIN_BLOCKS,      FLASH_INTEL_MAIN_BLOCK_SIZE      },
+	}
+};
+
+const FLASH_OPS_T flash_intel_ops = {
+	FLASH_CFI_COMMAND_SET_INTEL,
+	&flash_intel_info,
+	FLASH_INTEL_PR_USER,
+	flash_reset,
+	flash_intel_unlock,
+	flash_intel_erase,
+	flash_intel_write_block,
+	flash_intel_write_buffer,
+	flash_intel_geometry,
+	flash_intel_get_part_id,
+	flash_intel_get_otp_zone,
+	flash_intel_read_protection,
+	flash_intel_read_config
+};
+
+static int flash_wait(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
+	FLASH_DATA_WIDTH status;
+
+	while (((status = FLASH_READ(reg_addr_ctl)) & FLASH_INTEL_STATUS_READY) != FLASH_INTEL_STATUS_READY) {
+		PERF_ADD(flash_busy_polls, 1);
+
+		/* Move USB traffic while the flash is busy. */
+		usb_poll();
+	}
 
-	return RESULT_OK;
-}
+	/* SR.4/SR.5 stay set until cleared, on either chip of the pair. */
+	if ((status & FLASH_INTEL_STATUS_ERRORS) != 0) {
+		FLASH_WRITE(reg_addr_ctl, FLASH_INTEL_COMMAND_CLEAR);
+		nop(12);
 
-static void flash_wait(volatile u16 *reg_addr_ctl) {
-	while ((*reg_addr_ctl & FLASH_INTEL_STATUS_READY) != FLASH_INTEL_STATUS_READY) {
-		nop(8);
+		return RESULT_FAIL;
 	}
+
+	return RESULT_OK;
 }
 
-static void flash_reset(volatile u16 *reg_addr_ctl) {
-	*reg_addr_ctl = FLASH_INTEL_COMMAND_CLEAR;
+static void flash_reset(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
+	FLASH_WRITE(reg_addr_ctl, FLASH_INTEL_COMMAND_CLEAR);
 	nop(12);
 
-	*reg_addr_ctl = FLASH_INTEL_COMMAND_READ;
+	FLASH_WRITE(reg_addr_ctl, FLASH_INTEL_COMMAND_READ);
 	nop(12);
 }
 
-int flash_unlock(volatile u16 *reg_addr_ctl) {
-	*reg_addr_ctl = FLASH_INTEL_COMMAND_LOCK;
+static int flash_intel_unlock(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
+	READ_MODE_ASYNC();
+
+	FLASH_WRITE(reg_addr_ctl, FLASH_INTEL_COMMAND_LOCK);
 	nop(12);
 
-	*reg_addr_ctl = FLASH_INTEL_COMMAND_CONFIRM;
+	FLASH_WRITE(reg_addr_ctl, FLASH_INTEL_COMMAND_CONFIRM);
 	nop(12);
 
 	return RESULT_OK;
 }
 
-int flash_erase(volatile u16 *reg_addr_ctl) {
-	*reg_addr_ctl = FLASH_INTEL_COMMAND_ERASE;
+static int flash_intel_erase(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
+	int status;
+
+	READ_MODE_ASYNC();
+
+	TRACE(TRACE_ERASE, TRACE_BEGIN, reg_addr_ctl, 0);
+
+	FLASH_WRITE(reg_addr_ctl, FLASH_INTEL_COMMAND_ERASE);
 	nop(12);
 
-	*reg_addr_ctl = FLASH_INTEL_COMMAND_CONFIRM;
+	FLASH_WRITE(reg_addr_ctl, FLASH_INTEL_COMMAND_CONFIRM);
 	nop(12);
 
-	flash_wait(reg_addr_ctl);
+	status = flash_wait(reg_addr_ctl);
 
-	return RESULT_OK;
+	TRACE(TRACE_ERASE, TRACE_END, reg_addr_ctl, 0);
+
+	return status;
 }
 
-int flash_write_block(volatile u16 *reg_addr_ctl, volatile u16 *buffer, u32 size) {
-	volatile u16 *src = buffer;
-	volatile u16 *dst = reg_addr_ctl;
-	volatile u16 *end = dst + (size / 2);
+static int flash_intel_write_block(volatile FLASH_DATA_WIDTH *reg_addr_ctl, volatile FLASH_DATA_WIDTH *buffer, u32 size) {
+	volatile FLASH_DATA_WIDTH *src = buffer;
+	volatile FLASH_DATA_WIDTH *dst = reg_addr_ctl;
+	volatile FLASH_DATA_WIDTH *end = dst + (size / sizeof(FLASH_DATA_WIDTH));
+	int status = RESULT_OK;
 
-	while (dst < end) {
-		u16 word = *src;
-		if (word != 0xFFFF) {
+	READ_MODE_ASYNC();
+
+	TRACE(TRACE_PROGRAM, TRACE_BEGIN, reg_addr_ctl, size);
+
+	while ((dst < end) && (status == RESULT_OK)) {
+		FLASH_DATA_WIDTH word = *src;
+		if (word != FLASH_ERASED_WORD) {
 			/* Write word seq. */
-			*dst = FLASH_INTEL_COMMAND_WRITE;
+			FLASH_WRITE(dst, FLASH_INTEL_COMMAND_WRITE);
 			nop(12);
 
-			*dst = word;
+			FLASH_WRITE(dst, word);
 			nop(12);
 
 			/* Wait Loops. */
-			flash_wait(dst);
+			status = flash_wait(dst);
 			watchdog_service();
 		}
 		dst++;
@@ -119,61 +189,71 @@ int flash_write_block(volatile u16 *reg_addr_ctl, volatile u16 *buffer, u32 size
 
 	flash_reset(reg_addr_ctl);
 
-	return RESULT_OK;
+	TRACE(TRACE_PROGRAM, TRACE_END, reg_addr_ctl, size);
+
+	return status;
 }
 
-int flash_write_buffer(volatile u16 *reg_addr_ctl, const u16 *buffer, u32 size) {
+static int flash_intel_write_buffer(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH *buffer, u32 size) {
 	u16 i;
 	u32 length;
 	u32 size_index;
-	volatile u16 *src = (volatile u16 *) buffer;
-	volatile u16 *dst = reg_addr_ctl;
+	volatile FLASH_DATA_WIDTH *src = (volatile FLASH_DATA_WIDTH *) buffer;
+	volatile FLASH_DATA_WIDTH *dst = reg_addr_ctl;
+	int status = RESULT_OK;
+
+	size_index = size / sizeof(FLASH_DATA_WIDTH);
+
+	READ_MODE_ASYNC();
 
-	size_index = size / 2;
+	TRACE(TRACE_PROGRAM, TRACE_BEGIN, reg_addr_ctl, size);
 
 	do {
-		length = (size_index <= 32) ? size_index : 32;
+		length = (size_index <= FLASH_INTEL_WRITE_BUFFER_WORDS) ? size_index : FLASH_INTEL_WRITE_BUFFER_WORDS;
 
 		do
 		{
-			*dst = FLASH_INTEL_COMMAND_WRITE_BUFFER;
+			FLASH_WRITE(dst, FLASH_INTEL_COMMAND_WRITE_BUFFER);
 
-			if ((*dst & 0x30) != 0) {
-				*dst = FLASH_INTEL_COMMAND_CLEAR;
+			if ((FLASH_READ(dst) & FLASH_INTEL_STATUS_ERRORS) != 0) {
+				FLASH_WRITE(dst, FLASH_INTEL_COMMAND_CLEAR);
 			}
-		} while ((*dst & FLASH_INTEL_STATUS_READY) != FLASH_INTEL_STATUS_READY);
+		} while ((FLASH_READ(dst) & FLASH_INTEL_STATUS_READY) != FLASH_INTEL_STATUS_READY);
 
-		*dst = BUFFER_SIZE_TO_WRITE(length);
+		FLASH_WRITE(dst, BUFFER_SIZE_TO_WRITE(length));
 
 		for (i = 0; i < length; ++i) {
-			*dst = *src;
+			FLASH_WRITE(dst, *src);
 
 			dst++;
 			src++;
 		}
 
-		*reg_addr_ctl = FLASH_INTEL_COMMAND_CONFIRM;
+		FLASH_WRITE(reg_addr_ctl, FLASH_INTEL_COMMAND_CONFIRM);
 
-		while ((*reg_addr_ctl & 0xBC) == 0);
+		/* Both chips of the interleaved pair must be ready, not just one of them. */
+		status = flash_wait(reg_addr_ctl);
 
 		watchdog_service();
 
 		size_index -= length;
-	} while (size_index > 0);
+	} while ((size_index > 0) && (status == RESULT_OK));
 
 	flash_reset(reg_addr_ctl);
 
-	return RESULT_OK;
+	TRACE(TRACE_PROGRAM, TRACE_END, reg_addr_ctl, size);
+
+	return status;
 }
 
-int flash_geometry(volatile u16 *reg_addr_ctl) {
+static int flash_intel_geometry(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
 	u32 block_size;
 	u32 addr = (u32) reg_addr_ctl;
 
 	if ((addr >= ((u32) FLASH_INTEL_START_PARAMETER_BLOCKS)) && (addr < ((u32) FLASH_INTEL_END_PARAMETER_BLOCKS))) {
-		block_size = 0x8000;  /* 0x8000x4 parameter blocks. */
+		block_size = FLASH_INTEL_PARAMETER_BLOCK_SIZE; /* 0x8000x4 parameter blocks. */
 	} else {
-		block_size = 0x20000; /* 0x20000x255+ main blocks. */
+		block_size = FLASH_INTEL_MAIN_BLOCK_SIZE;      /* 0x20000x255+ main blocks. */
 	}
 
 	/*
@@ -183,18 +263,21 @@ int flash_geometry(volatile u16 *reg_addr_ctl) {
 	return (addr & (block_size - 1));
 }
 
-u32 flash_get_part_id(volatile u16 *reg_addr_ctl) {
+static u32 flash_intel_get_part_id(volatile FLASH_DATA_WIDTH *reg_addr_ctl) {
 	u32 flash_part_id;
 
 	flash_part_id = 0;
 
-	volatile u16 *vendor_code = reg_addr_ctl;
-	volatile u16 *device_code = reg_addr_ctl + 1;
+	volatile FLASH_DATA_WIDTH *vendor_code = reg_addr_ctl;
+	volatile FLASH_DATA_WIDTH *device_code = reg_addr_ctl + 1;
+
+	READ_MODE_ASYNC();
 
-	*vendor_code = FLASH_INTEL_COMMAND_PART_ID;
+	FLASH_WRITE(vendor_code, FLASH_INTEL_COMMAND_PART_ID);
 	nop(12);
 
-	flash_part_id = (*vendor_code << 16) | *device_code;
+	/* Chips of the interleaved pair are the same part, the low half of the bus is taken. */
+	flash_part_id = ((u32) (u16) FLASH_READ(vendor_code) << 16) | (u16) FLASH_READ(device_code);
 
 	flash_reset(reg_addr_ctl);
 
@@ -210,67 +293,86 @@ u32 flash_get_part_id(volatile u16 *reg_addr_ctl) {
  *   2048 (256 bytes): additional user-programmable OTP bits.
  */
 
-int flash_get_otp_zone(volatile u16 *reg_addr_ctl, u8 *otp_out_buffer, u16 *size) {
+static int flash_intel_get_otp_zone(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u8 *otp_out_buffer, u16 *size) {
 	u16 i;
-	u16 factory_reg[4];
-	u16 user_reg[4];
-	u16 user_add_reg[128];
+	FLASH_DATA_WIDTH regs[FLASH_INTEL_PR__64BIT_SIZE_16BIT * 2 + FLASH_INTEL_PR_128BIT_SIZE_16BIT * 16];
 
-	volatile u16 *flash = reg_addr_ctl;
-	volatile u16 *factory_reg_ptr = &factory_reg[0];
-	volatile u16 *user_reg_ptr = &user_reg[0];
-	volatile u16 *user_add_reg_ptr = &user_add_reg[0];
+	volatile u8 *regs_ptr_u8 = (volatile u8 *) regs;
 
-	*size = 8 + 8 + 256;
+	*size = sizeof(regs); /* 8 + 8 + 256 bytes of every chip. */
 
-	flash += FLASH_INTEL_PR_LOCK_REG0;
-	flash++;
+	/* Factory and user 64-bit registers follow lock register 0, additional 128-bit registers follow lock register 1. */
+	flash_intel_read_protection(reg_addr_ctl, FLASH_INTEL_PR_LOCK_REG0 + 1, &regs[0], FLASH_INTEL_PR__64BIT_SIZE_16BIT * 2);
+	flash_intel_read_protection(
+		reg_addr_ctl,
+		FLASH_INTEL_PR_LOCK_REG1 + 1,
+		&regs[FLASH_INTEL_PR__64BIT_SIZE_16BIT * 2],
+		FLASH_INTEL_PR_128BIT_SIZE_16BIT * 16
+	);
 
-	for (i = 0; i < FLASH_INTEL_PR__64BIT_SIZE_16BIT; ++i, ++flash) {
-		*flash = FLASH_INTEL_COMMAND_PART_ID;
-		nop(12);
+	for (i = 0; i < *size; ++i) {
+		otp_out_buffer[i] = regs_ptr_u8[i];
+	}
 
-		*(factory_reg_ptr + i) = *flash;
-		*(user_reg_ptr + i)    = *(flash + FLASH_INTEL_PR__64BIT_SIZE_16BIT);
+	return RESULT_OK;
+}
 
-		watchdog_service();
+static int flash_intel_read_protection(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 offset, FLASH_DATA_WIDTH *buffer, u16 count) {
+	u16 i;
 
-		flash_reset(flash);
-	}
+	READ_MODE_ASYNC();
 
-	flash = reg_addr_ctl;
-	flash += FLASH_INTEL_PR_LOCK_REG1;
-	flash++;
-	flash += (FLASH_INTEL_PR_128BIT_SIZE_16BIT * (1 - 1));
+	/* Read identifier mode is entered once for all words and left with one reset. */
+	FLASH_WRITE(reg_addr_ctl, FLASH_INTEL_COMMAND_PART_ID);
+	nop(12);
 
-	for (i = 0; i < FLASH_INTEL_PR_128BIT_SIZE_16BIT * 16; ++i, ++flash) {
-		*flash = FLASH_INTEL_COMMAND_PART_ID;
-		nop(12);
+	for (i = 0; i < count; ++i) {
+		buffer[i] = FLASH_READ(reg_addr_ctl + offset + i);
+	}
 
-		*(user_add_reg_ptr + i) = *flash;
+	flash_reset(reg_addr_ctl);
 
-		watchdog_service();
+	watchdog_service();
 
-		flash_reset(flash);
-	}
+	return RESULT_OK;
+}
 
-	flash_reset(flash--);
+/*
+ * StrataFlash L30 read configuration register, page or burst mode of array reads, see READ_MODE command.
+ * Value goes on the address bus with both cycles, 0xBFCF is the asynchronous power-up default.
+ */
 
-	volatile u8 *factory_reg_ptr_u8 = (volatile u8 *) factory_reg_ptr;
-	volatile u8 *user_reg_ptr_u8 = (volatile u8 *) user_reg_ptr;
-	volatile u8 *user_add_reg_ptr_u8 = (volatile u8 *) user_add_reg_ptr;
+static int flash_intel_read_config(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 config) {
+	volatile FLASH_DATA_WIDTH *config_addr = reg_addr_ctl + config;
 
-	for (i = 0; i < 8; ++i) {
-		otp_out_buffer[i] = factory_reg_ptr_u8[i];
-	}
+	FLASH_WRITE(config_addr, FLASH_INTEL_COMMAND_CONFIG_SETUP);
+	nop(12);
 
-	for (i = 0; i < 8; ++i) {
-		otp_out_buffer[8+i] = user_reg_ptr_u8[i];
-	}
+	FLASH_WRITE(config_addr, FLASH_INTEL_COMMAND_SET_RCR);
+	nop(12);
 
-	for (i = 0; i < 256; ++i) {
-		otp_out_buffer[16+i] = user_add_reg_ptr_u8[i];
-	}
+	flash_reset(reg_addr_ctl);
 
 	return RESULT_OK;
 }
+
+/*
+ * Single driver builds call the driver with no dispatch, the general flash functions are its own ones.
+ */
+
+#if !defined(FLASH_OPS_RUNTIME)
+int flash_unlock(volatile FLASH_DATA_WIDTH *reg_addr_ctl) __attribute__((alias("flash_intel_unlock")));
+int flash_erase(volatile FLASH_DATA_WIDTH *reg_addr_ctl) __attribute__((alias("flash_intel_erase")));
+int flash_write_block(volatile FLASH_DATA_WIDTH *reg_addr_ctl, volatile FLASH_DATA_WIDTH *buffer, u32 size)
+	__attribute__((alias("flash_intel_write_block")));
+int flash_write_buffer(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH *buffer, u32 size)
+	__attribute__((alias("flash_intel_write_buffer")));
+int flash_geometry(volatile FLASH_DATA_WIDTH *reg_addr_ctl) __attribute__((alias("flash_intel_geometry")));
+u32 flash_get_part_id(volatile FLASH_DATA_WIDTH *reg_addr_ctl) __attribute__((alias("flash_intel_get_part_id")));
+int flash_get_otp_zone(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u8 *otp_out_buffer, u16 *size)
+	__attribute__((alias("flash_intel_get_otp_zone")));
+int flash_read_protection(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 offset, FLASH_DATA_WIDTH *buffer, u16 count)
+	__attribute__((alias("flash_intel_read_protection")));
+int flash_read_config(volatile FLASH_DATA_WIDTH *reg_addr_ctl, u16 config)
+	__attribute__((alias("flash_intel_read_config")));
+#endif
@@ -0,0 +1,67 @@
+/*
+ * About:
+ *   Hardware abstraction layer for USB endpoints, timer, memory bursts, watchdog, RTC and startup code.
+ *   Neptune implementation lives in hal_neptune.c, simulated peripherals for the host build live in host/hal_host.c.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include "platform.h"
+
+/**
+ * USB section.
+ */
+
+/* Read EP1 packet (if any) to the RX ring starting from head index and return the new head index. */
+extern u16 hal_usb_rx(u8 *ring, u16 head);
+
+/* Send packet on EP2, RESULT_FAIL if endpoint is still busy. */
+extern int hal_usb_tx(const u8 *src, u8 len);
+
+extern int hal_usb_init(void);
+
+/**
+ * Timer section.
+ */
+
+/* Free-running hardware timer clocked from the 32 kHz reference, used for the performance counters. */
+#define HAL_TIMER_HZ                   (32768)
+
+extern int hal_timer_init(void);
+extern u32 hal_timer_ticks(void);
+
+/**
+ * Memory section.
+ */
+
+/* Read size bytes (multiple of 32) from word aligned src with LDM bursts of 8 words, used by the BENCH command. */
+extern void hal_read_burst(const u32 *src, u32 size);
+
+/* Write size bytes (multiple of 32) of pattern to word aligned dst with STM bursts of 8 words, used by the FILL command. */
+extern void hal_fill_burst(u32 *dst, u32 pattern, u32 size);
+
+/* Write value to the chip-select control register of the external bus and return its old value, used by READ_MODE. */
+extern u32 hal_chip_select(u32 reg, u32 value);
+
+/**
+ * Watchdog section.
+ */
+
+extern int COLD watchdog_reboot(void);
+extern int COLD watchdog_shutdown(void);
+extern int watchdog_init(void);
+
+/**
+ * Main entry.
+ */
+
+extern void hitagi_start(void);
+
+#endif /* !HAL_H */
@@ -0,0 +1,248 @@
+/*
+ * About:
+ *   Hardware abstraction layer for Motorola/Freescale Neptune LTE-like SoCs.
+ *
+ * Author:
+ *   EXL, Motorola Inc.
+ *
+ * License:
+ *   MIT
+ */
+
+#include "platform.h"
+#include "regs_neptune.h"
+#include "hal.h"
+
+/**
+ * Functions.
+ */
+
+static void usb_copy_block(const u8 *src, u16 *dst, u8 len);
+
+void __attribute__((naked, section(".startup"))) _start(void);
+
+/**
+ * NOP function.
+ */
+
+void nop(u32 nop_count) {
+	u32 i;
+	for (i = 0; i < nop_count; ++i) {
+		asm volatile ("nop");
+	}
+}
+
+/**
+ * USB section.
+ */
+
+static void usb_copy_block(const u8 *src, u16 *dst, u8 len) {
+	u8 i;
+	u8 half_len;
+	u16 data;
+
+	half_len = len / 2;
+
+	for (i = 0; i < half_len; ++i) {
+		data = (u16) (*src++ << 8);
+		*dst++ = (data | *src++);
+	}
+
+	if ((len % 2) != 0) {
+		data = (u16) (*src << 8);
+		*dst = data;
+	}
+}
+
+int hal_usb_tx(const u8 *src, u8 len) {
+	/*
+	 * (1 << 6):  EP2_int
+	 * (1 << 10): XFREN
+	 * (1 << 13): IEOFC
+	 */
+	if ((USB_INT & (1 << 6)) || !(USB_E2_CR & (1 << 10))) {
+		usb_copy_block(src, USB_E2_TX_HW_BUFFER, len);
+
+		USB_E2_CR = (USB_E2_CR & ~0x3F) | (len & 0x3F);
+		USB_E2_CR |= (1 << 13);
+		USB_E2_CR |= (1 << 10);
+
+		return RESULT_OK;
+	}
+
+	return RESULT_FAIL;
+}
+
+u16 hal_usb_rx(u8 *ring, u16 head) {
+	u8 i;
+	u8 rx_bytes;
+
+	/*
+	 * (1 << 5):  EP1_int
+	 * (1 << 6):  ERRF
+	 * (1 << 13): IEOFC
+	 * (1 << 11): FSTALL
+	 */
+	if (USB_INT & (1 << 5)) {
+		if (!(USB_E1_CR & (1 << 6))) {
+			u8 *p_src = (u8 *) USB_E1_RX_HW_BUFFER;
+
+			rx_bytes = USB_E1_CR & 0x3F;
+
+			for (i = 0; i < rx_bytes; ++i) {
+				ring[head++ & (USB_RX_RING_SIZE - 1)] = *p_src++;
+			}
+
+			USB_E1_CR |= (1 << 13);
+		} else {
+			USB_E1_CR |= (1 << 11);
+		}
+	}
+
+	return head;
+}
+
+int hal_usb_init(void) {
+	/*
+	 * USB_MEMMAP_EP1_EP2_16BYTES = 0x0000
+	 * USB_MEMMAP_EP1_EP2_32BYTES = 0x0001
+	 */
+	USB_CPU_CR = 0x0001;
+
+	return RESULT_OK;
+}
+
+/**
+ * Timer section.
+ */
+
+int hal_timer_init(void) {
+	GPT_TCTL = 0;
+	GPT_TPRER = 0;
+	GPT_TCTL = GPT_TCTL_FRR | GPT_TCTL_CLK_32K | GPT_TCTL_TEN;
+
+	return RESULT_OK;
+}
+
+u32 hal_timer_ticks(void) {
+	return GPT_TCN;
+}
+
+/**
+ * Memory section.
+ */
+
+void hal_read_burst(const u32 *src, u32 size) {
+	const u32 *end = src + (size / sizeof(u32));
+
+	/* R9-R11 may be taken by the PIC base and frame pointer, so the burst avoids them. */
+	asm volatile (
+		"1:\n"
+		"ldmia %[src]!, {r2-r8, r12}\n"
+		"cmp %[src], %[end]\n"
+		"blo 1b\n"
+		: [src] "+r" (src)
+		: [end] "r" (end)
+		: "r2", "r3", "r4", "r5", "r6", "r7", "r8", "r12", "cc", "memory"
+	);
+}
+
+void hal_fill_burst(u32 *dst, u32 pattern, u32 size) {
+	u32 *end = dst + (size / sizeof(u32));
+
+	/* Same registers as the read burst, pattern is spread over all of them once before the loop. */
+	asm volatile (
+		"mov r2, %[pattern]\n"
+		"mov r3, %[pattern]\n"
+		"mov r4, %[pattern]\n"
+		"mov r5, %[pattern]\n"
+		"mov r6, %[pattern]\n"
+		"mov r7, %[pattern]\n"
+		"mov r8, %[pattern]\n"
+		"mov r12, %[pattern]\n"
+		"1:\n"
+		"stmia %[dst]!, {r2-r8, r12}\n"
+		"cmp %[dst], %[end]\n"
+		"blo 1b\n"
+		: [dst] "+r" (dst)
+		: [end] "r" (end), [pattern] "r" (pattern)
+		: "r2", "r3", "r4", "r5", "r6", "r7", "r8", "r12", "cc", "memory"
+	);
+}
+
+u32 hal_chip_select(u32 reg, u32 value) {
+	u32 old = *(volatile u32 *) reg;
+
+	*(volatile u32 *) reg = value;
+
+	return old;
+}
+
+/**
+ * Watchdog section.
+ */
+
+int watchdog_reboot(void) {
+	/*
+	 * PU_MAIN_SOFTWARE_RESET_PU = 0x0A
+	 */
+	if (RTC_PCRAM0 < 0x0A) {
+		RTC_PCRAM0 = 0x0A;
+	}
+
+	/*
+	 * NOT_SW_RESET = 0x0010
+	 * WATCHDOG_WCR &= ~(NOT_SW_RESET)
+	 */
+	WATCHDOG_WCR &= ~(0x0010);
+
+	/* Forever! */
+	while("MotoFan.Ru is cool!");
+
+	return RESULT_OK;
+}
+
+int watchdog_shutdown(void) {
+	/*
+	 * WD_NOT_ASSERTED = 0x0020
+	 * WATCHDOG_WCR &= ~(WD_NOT_ASSERTED)
+	 */
+	WATCHDOG_WCR &= ~(0x0020);
+
+	/* Forever! */
+	while("MotoFan.Ru is cool!");
+
+	return RESULT_OK;
+}
+
+int watchdog_service(void) {
+	WATCHDOG_WSR = 0x5555;
+	WATCHDOG_WSR = 0xAAAA;
+
+	return RESULT_OK;
+}
+
+int watchdog_init(void) {
+	/*
+	 * (THIRTYTWO_SEC_TIMEOUT | WD_OUTPUT_EN | WD_NOT_ASSERTED | NOT_SW_RESET | WD_ENABLE | WD_DEBUG)
+	 *
+	 * hex((63 << 9) | 0x0040 | 0x0020 | 0x0010 | 0x0004 | 0x0002)
+	 * '0x7e76'
+	 */
+	WATCHDOG_WCR = 0x7E76;
+
+	watchdog_service();
+
+	return RESULT_OK;
+}
+
+/**
+ * Startup section.
+ */
+
+void __attribute__((naked, section(".startup"))) _start(void) {
+	asm volatile (
+		"bl hitagi_start\n"
+		"b .\n"
+	);
+}
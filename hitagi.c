@@ -10,16 +10,30 @@
  *
  * Commands:
  *   ADDR        |.ADDR.10000000XX.       |  # Set address for BIN command, XX is checksum.
+ *   ADDR_LIST   |.ADDR_LIST.A,S,A,S.     |  # Set list of (address, size) segments for following BIN data stream.
  *   BIN         |.BIN.DATAXX.            |  # Upload binary to address (IRAM, RAM, Flash for flashing), XX is checksum.
  *   ERASE       |.ERASE.                 |  # Activate read and write mode. See below for more details.
  *   READ        |.READ.10000000,0200.    |  # Read data from address on size.
+ *   READ_LIST   |.READ_LIST.A,S,A,S.     |  # Read list of (address, size) ranges in one answer.
+ *   FILL        |.FILL.A,S,FFFFFFFF.     |  # Fill (address, size) range with 16-bit or 32-bit pattern, no BIN upload.
+ *   COPY        |.COPY.S,D,L.            |  # Copy L bytes from source to destination address on device, no USB data.
  *   RQHW        |.RQHW.                  |  # Request hardware info data, bootloader version.
+ *   REGISTER    |.REGISTER.RQRC,12000000.|  # Add command handled by module uploaded to RAM, zero address removes it.
+ *   CALL        |.CALL.12000000,00000000.|  # Run module kernel at address with argument, answer is its result.
  *   RQRC        |.RQRC.10000000,10000600.|  # Calculate checksum of addresses range.
+ *   FIND        |.FIND.A,S,NN,PP,MM.     |  # Find first NN addresses of byte pattern with optional mask in range.
  *   RQVN        |.RQVN.                  |  # Request version info.
  *   RQSW        |.RQSW.                  |  # Request S/W version.
  *   RQSN        |.RQSN.                  |  # Request serial number of SoC.
  *   RQFI        |.RQFI.                  |  # Request part ID from flash memory chip.
  *   READ_OTP    |.READ_OTP.              |  # Read OTP registers data.
+ *   READ_IMEI   |.READ_IMEI.             |  # Read IMEI decrypted from OTP with SoC UID, raw record and UID.
+ *   RQPC        |.RQPC.RESET.            |  # Request performance counters, RESET argument clears them after answer.
+ *   RQTR        |.RQTR.RESET.            |  # Request trace ring buffer address and head, FTR_TRACE builds only.
+ *   BENCH       |.BENCH.10100000,0400.   |  # Measure read, erase and program speed on scratch flash block.
+ *   RQDD        |.RQDD.                  |  # Request binary device descriptor, replaces RQHW/RQVN/RQSN/RQFI requests.
+ *   RQJN        |.RQJN.RESET.            |  # Request flashing progress journal, RESET argument clears it after answer.
+ *   READ_MODE   |.READ_MODE.F,A,R,V.     |  # Set page or burst flash reads, no arguments go back to async reads.
  *   RESTART     |.RESTART.               |  # Restart or power down device.
  *   POWER_DOWN  |.POWER_DOWN.            |  # Power off device.
  *
@@ -42,6 +56,80 @@
  *
  *   2. It is better if the flashed chunk size is a multiple of `0x8000` (parameter blocks) or `0x20000` (main blocks)
  *      for Intel-like and AMD-like flash chips.
+ *
+ *   3. The `ADDR_LIST` command takes up to 32 `AAAAAAAA,SSSSSSSS` pairs of hex address and size separated by commas.
+ *      The following `BIN` packets are treated as one data stream spread over these segments in order.
+ *      A `BIN` packet larger than the bytes left in the segments is answered with `ERR` and not stored.
+ *
+ *   4. The `READ_LIST` command takes up to 16 `AAAAAAAA,SSSS` pairs of hex address and size separated by commas.
+ *      Answer contains 16-bit size, data and 8-bit checksum for every range back to back, same as in `READ` answer.
+ *
+ *   5. The `RQPC` answer is comma-separated hex: timer frequency in Hz, then counters in `HITAGI_PERF_T` order
+ *      (RX bytes, TX bytes, RX empty polls, TX full ring spins, flash busy polls, erase count and ticks,
+ *      program count, bytes and ticks), then `NAME,COUNT,TICKS` triples of every command handled since reset.
+ *
+ *   6. The `RQTR` answer is `AAAAAAAA,HHHHHHHH,RRRR,SSSS,FFFFFFFF` in hex: trace ring address, head (number of
+ *      records written since reset), ring capacity in records, record size and timer frequency in Hz.
+ *      Plain `RQTR` stops recording, so the ring is fetched with `READ` unchanged, `RQTR.RESET` clears the ring and
+ *      starts recording again. Dump is converted to a timeline by host/trace.py.
+ *
+ *   7. The `BENCH` command takes `AAAAAAAA,SSSS` scratch flash block address and program size, a multiple of 0x20
+ *      up to 0x1000, and needs any `ERASE` mode. The block is erased, programmed at its start in word mode and
+ *      right after that in buffer mode, then erased again. The answer is comma-separated hex: timer frequency in Hz,
+ *      bytes per read test, read ticks of IRAM, RAM and the scratch block with byte, halfword and LDM accesses each,
+ *      then erase, word program, buffer program and erase of the programmed block ticks (BENCH_RESULT_* indexes).
+ *      The block is dropped from the journal, a failed erase or program is answered with `ERR`.
+ *
+ *   8. The `RQDD` answer is framed as `READ` one: 16-bit size, descriptor and 8-bit checksum. Descriptor is big-endian:
+ *
+ *      0x00  u16     descriptor version (1) and size
+ *      0x04  u16     bootloader version and SoC revision
+ *      0x08  u16[8]  SoC UID, most significant word first
+ *      0x18  u32     flash part ID and capability bitmap (CAP_* in platform.h)
+ *      0x20  u16     USB packet size, RX data buffer, RX ring and TX ring sizes, max BIN packet size
+ *      0x2A  u8      max ADDR_LIST segments and READ_LIST ranges
+ *      0x2C  u16     flash write buffer size in bytes
+ *      0x2E  u8      flash bus width in bytes and erase region count
+ *      0x30  u32[3]  start, end and block size of every erase region
+ *
+ *   9. The `RQJN` answer is `LLLLLLLL,CCCCCCCC,GGGGGGGG,BB..BB` in hex: last completed flash block (FFFFFFFF if none),
+ *      count of completed blocks, bitmap granule size and bitmap of granules from 0x10000000, MSB first. Granule is
+ *      0x8000 bytes, 0x10000 with the interleaved 32-bit flash bus.
+ *      A block is complete when `BIN` data programmed in `ERASE` mode reaches its end, erase clears it again.
+ *      An interrupted session is resumed with `ADDR` on the first block which is not complete.
+ *
+ *  10. Modules are position-independent blobs built from modules/ and uploaded to RAM with `ADDR` and `BIN`.
+ *      `REGISTER` takes `NAME,AAAAAAAA` and adds up to 8 commands handled by the entry at that address, the ACK
+ *      answer is the number of registered commands. `CALL` takes `AAAAAAAA,XXXXXXXX` and answers with the 32-bit
+ *      result of the kernel in hex. Both are present in compact builds too, see module.h for the interface.
+ *      Entry must be in a RAM window, odd (Thumb) entries are refused by the loader built without interworking.
+ *      Whether the code there was uploaded is not tracked, the host which may flash the phone is trusted with it.
+ *
+ *  11. The `FILL` command takes `AAAAAAAA,SSSSSSSS,PPPP` or `AAAAAAAA,SSSSSSSS,PPPPPPPP` hex address, size and pattern.
+ *      Address and size are even, pattern bytes are stored in the given order from the address on. With `ERASE`
+ *      mode off the range is RAM and is filled by STM bursts, otherwise it is erased and programmed as `BIN` data.
+ *      The 0xFF pattern only erases blocks, a part of the range in a block starting before it must be blank already.
+ *      The `ADDR` pointer of following `BIN` packets is not moved.
+ *
+ *  12. The `COPY` command takes `SSSSSSSS,DDDDDDDD,LLLLLLLL` hex source, destination and size, all even. With `ERASE`
+ *      mode off the destination is RAM, overlapping ranges are allowed. Otherwise the data is erased and programmed
+ *      as `BIN` data, a flash source is staged in IRAM and must not lie in the blocks erased for the destination.
+ *
+ *  13. The `FIND` command takes `AAAAAAAA,SSSSSSSS,NN,PP..PP` or `AAAAAAAA,SSSSSSSS,NN,PP..PP,MM..MM` hex range,
+ *      max number of matches (up to 16) and pattern of up to 64 bytes with optional mask of the same size, text byte
+ *      matches when `(text & mask) == (pattern & mask)`. The answer is `NN,AAAAAAAA,...` hex count and addresses.
+ *
+ *  14. The `READ_IMEI` answer is `DDDDDDDDDDDDDDD,RRRRRRRRRRRRRRRR,UUUU..UUUU`: 15 IMEI digits with the computed Luhn
+ *      check digit, raw user OTP record (4 words at imei_pr_offset of the driver) and 8 UID words as in `RQSN` answer.
+ *      AMD-like chips have no known record, `ERR` is answered and `CAP_IMEI` is not set for them.
+ *
+ *  15. The `READ_MODE` command takes `FFFF,AAAA` or `FFFF,AAAA,RRRRRRRR,VVVVVVVV` hex words of the flash read
+ *      configuration register for the fast (page or burst) and asynchronous modes, optional chip-select control
+ *      register of the flash (one of WEIM_CSCR registers, `ERR` otherwise) and its value for the fast mode. Intel-like
+ *      chips get the RCR with 0x60/0x03 cycles, AMD-like chips get the configuration register with the 0xD0 sequence.
+ *      Flash drivers go back to asynchronous mode before every command sequence, `READ`, `READ_LIST`, `RQRC`, `FIND`,
+ *      `COPY` and `BENCH` reads switch to the fast mode again. `READ_MODE` without arguments, `RESTART` and
+ *      `POWER_DOWN` leave the fast mode.
  */
 
 #include "platform.h"
@@ -51,6 +139,8 @@
 #endif
 
 #include "flash.h"
+#include "hal.h"
+#include "module.h"
 
 /**
  * Functions.
@@ -61,42 +151,82 @@ static void util_u16_to_hexasc(u16 val, u8 *str);
 static void util_u32_to_hexasc(u32 val, u8 *str);
 static u32 util_hexasc_to_u32(const u8 *str, u8 size);
 static void util_string_copy(u8 *dst, const u8 *src);
+static u16 util_string_length(const u8 *str);
 static int util_string_equal(const u8 *str1_ptr, const u8 *str2_ptr);
+static u16 util_data_length(const u8 *data);
+static int util_data_equal(const u8 *data, const u8 *str);
 static int util_map_cmd(const HITAGI_CMD_TABLE_T *table_ptr, u8 table_size, const u8 *cmd);
-
-static void usb_copy_block(const u8 *src, u16 *dst, u8 len);
-static int usb_tx(const u8 *src, u8 len);
+static int util_ram_window(u32 addr, u32 size);
+static int util_module_entry(u32 addr);
+static int util_map_module(const u8 *cmd);
+static u8 *util_put_be(u8 *dst, u32 val, u8 size);
+
+void usb_poll(void);
+static void usb_flush(void);
+static u8 *usb_tx_acquire(void);
+static void usb_tx_commit(u8 len);
 static u8 usb_rx(u8 *dst);
-static int usb_init(void);
+static u16 usb_rx_csum(u8 *dst, u16 max, u8 *csum);
 
-static int watchdog_reboot(void);
-static int watchdog_shutdown(void);
-int watchdog_service(void);
-static int watchdog_init(void);
+#if defined(FTR_TRACE)
+void trace_event(u16 event, u16 phase, u32 arg0, u32 arg1);
+static u32 trace_name(const u8 *str, u8 offset);
+#endif
 
 static void hitagi_command_ADDR(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
 static void hitagi_command_BIN(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void hitagi_command_BIN_direct(const u8 *source_ptr, const u8 *buffer_next_byte);
+static int hitagi_bin_store(const u8 *source_ptr, u32 size);
+static void hitagi_bin_erase(void);
+static u32 hitagi_bin_chunk(u32 size);
+static u32 hitagi_bin_remaining(void);
+static void hitagi_bin_advance(u32 size);
+static void hitagi_command_ADDR_LIST(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
 static void hitagi_command_ERASE(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void hitagi_command_FILL(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void hitagi_command_COPY(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
 static void hitagi_command_READ(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
-static void hitagi_command_RQHW(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void hitagi_command_READ_LIST(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void hitagi_read_range(u32 start_addr, u16 size, u8 *header, HITAGI_TX_SEGMENT_T *tx_segments);
+static void COLD hitagi_command_RQHW(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
 static void hitagi_command_RQRC(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
-static void hitagi_command_RQVN(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
-static void hitagi_command_RQSW(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
-static void hitagi_command_RQSN(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
-static void hitagi_command_RQFI(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
-static void hitagi_command_READ_OTP(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
-static void hitagi_command_RESTART(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
-static void hitagi_command_POWER_DOWN(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void hitagi_command_FIND(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static int hitagi_find_match(const u8 *text, const u8 *pattern, const u8 *mask, u8 size);
+static void COLD hitagi_command_RQVN(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void COLD hitagi_command_RQSW(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void COLD hitagi_command_RQSN(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void COLD hitagi_command_RQFI(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void COLD hitagi_command_READ_OTP(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void COLD hitagi_command_READ_IMEI(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void COLD hitagi_command_RQPC(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void COLD hitagi_command_BENCH(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static u32 hitagi_bench_read(const u32 *src, u8 width);
+static void COLD hitagi_command_RQDD(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void COLD hitagi_command_RQJN(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void COLD hitagi_journal_init(void);
+static u32 hitagi_journal_block(u32 addr, u32 *block_start);
+static void hitagi_journal_erase(u32 addr);
+static void hitagi_journal_program(u32 end_addr);
+#if !defined(FTR_COMPACT)
+static void COLD hitagi_command_READ_MODE(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+void read_mode_switch(u8 fast);
+#endif
+#if defined(FTR_TRACE)
+static void COLD hitagi_command_RQTR(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+#endif
+static void COLD hitagi_command_REGISTER(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void COLD hitagi_command_CALL(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void COLD hitagi_command_RESTART(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
+static void COLD hitagi_command_POWER_DOWN(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte);
 static void hitagi_commands(const u8 *cmd, const u8 *data, const u8 *next);
 static void hitagi_send_packet(const u8 *cmd, const u8 *data);
-static void hitagi_send_bin_packet(const u8 *cmd, const u8 *data, u16 bin_size);
-static void hitagi_send_packet_aux(const u8 *cmd, const u8 *data, u16 bin_size);
+static u8 hitagi_send_stream(const u8 *src, u16 size, u8 fill);
+static void hitagi_send_segments(const u8 *cmd, const HITAGI_TX_SEGMENT_T *tx_segments, u8 count);
 static void hitagi_send_ack(const u8 *data);
 static void hitagi_send_error(u8 error_code);
 static void hitagi_read_packets(void);
 
 void hitagi_start(void);
-void __attribute__((naked, section(".startup"))) _start(void);
 
 /**
  * Constants and command table.
@@ -107,23 +237,48 @@ static const u8 err_str[]  = "ERR";
 static const u8 bin_str[]  = "BIN";
 static const u8 com_str[]  = ","  ;
 static const u8 scm_str[]  = ":"  ;
+static const u8 ctl_str[]  = { STX, RS, ETX };
+static const u8 rst_str[]  = "RESET";
 
 static const HITAGI_CMD_TABLE_T cmd_tbl[] = {
 	{ (const u8 *) "ADDR",       (const u8 *) NULL,         hitagi_command_ADDR        },
+	{ (const u8 *) "ADDR_LIST",  (const u8 *) NULL,         hitagi_command_ADDR_LIST   },
 	{ (const u8 *) "BIN",        (const u8 *) NULL,         hitagi_command_BIN         },
 	{ (const u8 *) "ERASE",      (const u8 *) NULL,         hitagi_command_ERASE       },
 	{ (const u8 *) "READ",       (const u8 *) "READ",       hitagi_command_READ        },
 	{ (const u8 *) "RQHW",       (const u8 *) "RSHW",       hitagi_command_RQHW        },
+	{ (const u8 *) "REGISTER",   (const u8 *) NULL,         hitagi_command_REGISTER    },
+	{ (const u8 *) "CALL",       (const u8 *) "CALL",       hitagi_command_CALL        },
 #if !defined(FTR_COMPACT)
+	{ (const u8 *) "READ_LIST",  (const u8 *) "READ_LIST",  hitagi_command_READ_LIST   },
+	{ (const u8 *) "FILL",       (const u8 *) NULL,         hitagi_command_FILL        },
+	{ (const u8 *) "COPY",       (const u8 *) NULL,         hitagi_command_COPY        },
 	{ (const u8 *) "RQRC",       (const u8 *) "RSRC",       hitagi_command_RQRC        },
+	{ (const u8 *) "FIND",       (const u8 *) "FIND",       hitagi_command_FIND        },
 	{ (const u8 *) "RQVN",       (const u8 *) "RSVN",       hitagi_command_RQVN        },
 	{ (const u8 *) "RQSW",       (const u8 *) "RSSW",       hitagi_command_RQSW        },
 	{ (const u8 *) "RQSN",       (const u8 *) "RSSN",       hitagi_command_RQSN        },
 	{ (const u8 *) "RQFI",       (const u8 *) "RSFI",       hitagi_command_RQFI        },
 	{ (const u8 *) "READ_OTP",   (const u8 *) "READ_OTP",   hitagi_command_READ_OTP    },
+	{ (const u8 *) "READ_IMEI",  (const u8 *) "READ_IMEI",  hitagi_command_READ_IMEI   },
+	{ (const u8 *) "RQPC",       (const u8 *) "RSPC",       hitagi_command_RQPC        },
+	{ (const u8 *) "BENCH",      (const u8 *) "BENCH",      hitagi_command_BENCH       },
+	{ (const u8 *) "RQDD",       (const u8 *) "RSDD",       hitagi_command_RQDD        },
+	{ (const u8 *) "RQJN",       (const u8 *) "RSJN",       hitagi_command_RQJN        },
+	{ (const u8 *) "READ_MODE",  (const u8 *) NULL,         hitagi_command_READ_MODE   },
 	{ (const u8 *) "RESTART",    (const u8 *) NULL,         hitagi_command_RESTART     },
 	{ (const u8 *) "POWER_DOWN", (const u8 *) NULL,         hitagi_command_POWER_DOWN  },
 #endif
+#if defined(FTR_TRACE)
+	{ (const u8 *) "RQTR",       (const u8 *) "RSTR",       hitagi_command_RQTR        },
+#endif
+};
+
+/*
+ * RAM windows where BIN payload may be placed directly from the USB RX ring.
+ */
+static const HITAGI_MEM_WINDOW_T ram_windows[] = {
+	{ NEPTUNE_RAM_START, NEPTUNE_RAM_END },
 };
 
 /**
@@ -133,28 +288,75 @@ static const HITAGI_CMD_TABLE_T cmd_tbl[] = {
 static u16 *received_address_ptr;
 static u16  received_packet_size;
 
+/* Scatter-list upload table set by ADDR_LIST, BIN data stream is spread over these segments. */
+static u8 segment_count;
+static u8 segment_index;
+
 static u8 rx_command[MAX_COMMAND_STR_SIZE];
 
-#if !defined(FTR_COMPACT)
-static u8 rx_data[USB_MAX_RX_DATA_SIZE];
-static u8 tx_data[USB_MAX_TX_DATA_SIZE];
-#else
-static u8 *rx_data = (u8 *) 0x03FD0000 + 0x10000;
-static u8 *tx_data = (u8 *) 0x03FD0000 + 0x10000 + USB_MAX_RX_DATA_SIZE;
-#endif
+/*
+ * Large buffers go to the arena placed by the linker script right after the image, so they take no room in
+ * the binary of compact builds either. Arena is not cleared on start, nothing there relies on zero contents.
+ * Answers are built one at a time, so all handlers share one response buffer instead of stack arrays.
+ */
+static u8 rx_data[USB_MAX_RX_DATA_SIZE] ARENA;
+static u8 usb_rx_ring[USB_RX_RING_SIZE] ARENA;
+static u8 usb_tx_ring[USB_TX_RING_PACKETS][USB_MAX_PACKET_SIZE] ARENA;
+static HITAGI_MEM_WINDOW_T segments[MAX_SEGMENTS] ARENA;
+static u8 response_buffer[MAX_READ_RESPONSE_SIZE] ARENA;
+static u8 otp_buffer[FLASH_MAX_OTP_SIZE] ARENA;
+static HITAGI_MODULE_T modules[MAX_MODULES] ARENA;
 
-HITAGI_CMDLET_ERASE_T erase_cmdlet;
+/* Commands added by REGISTER, looked up after the built-in ones. */
+static u8 module_count;
 
-/**
- * NOP function.
+/*
+ * Ring indexes are free-running, the masks are applied on access.
+ * They are volatile because usb_poll() is the bottom half of the USB engine and may be called from the IRQ context.
  */
+static volatile u16 usb_rx_ring_head;
+static volatile u16 usb_rx_ring_tail;
+static volatile u8  usb_tx_ring_head;
+static volatile u8  usb_tx_ring_tail;
+static u8 usb_tx_ring_len[USB_TX_RING_PACKETS];
 
-void nop(u32 nop_count) {
-	u32 i;
-	for (i = 0; i < nop_count; ++i) {
-		asm volatile ("nop");
-	}
-}
+HITAGI_CMDLET_ERASE_T erase_cmdlet;
+
+/* Loader services for modules, see module.h. */
+static const HITAGI_MODULE_API_T module_api = {
+	MODULE_API_VERSION,
+	response_buffer,
+	&erase_cmdlet,
+	hitagi_send_packet,
+	hitagi_send_segments,
+	hitagi_send_ack,
+	hitagi_send_error,
+	watchdog_service,
+	hal_timer_ticks,
+	flash_unlock,
+	flash_erase,
+	flash_write_block,
+	flash_write_buffer,
+	flash_geometry
+};
+
+HITAGI_PERF_T perf;
+static HITAGI_PERF_CMD_T perf_commands[sizeof(cmd_tbl) / sizeof(cmd_tbl[0])];
+
+static HITAGI_JOURNAL_T journal;
+
+/* Result of flash_init(), RESULT_FAIL if the CFI query of the chip matched none of the linked drivers. */
+static int flash_status;
+
+#if !defined(FTR_COMPACT)
+static HITAGI_READ_MODE_T read_mode;
+#endif
+
+#if defined(FTR_TRACE)
+static HITAGI_TRACE_RECORD_T trace_ring[TRACE_RING_RECORDS] ARENA;
+static u32 trace_head;
+static u8 trace_paused;
+#endif
 
 /**
  * Util functions.
@@ -219,6 +421,16 @@ static void util_string_copy(u8 *dst, const u8 *src) {
 	} while (*src++);
 }
 
+static u16 util_string_length(const u8 *str) {
+	const u8 *end = str;
+
+	while (*end) {
+		end++;
+	}
+
+	return (u16) (end - str);
+}
+
 static int util_string_equal(const u8 *str1_ptr, const u8 *str2_ptr) {
 	int match = 0;
 
@@ -234,6 +446,28 @@ static int util_string_equal(const u8 *str1_ptr, const u8 *str2_ptr) {
 	return match;
 }
 
+/*
+ * Command data is left in rx_data together with its ETX, so it ends either with ETX or NUL.
+ */
+static u16 util_data_length(const u8 *data) {
+	const u8 *end = data;
+
+	while ((*end != NUL) && (*end != ETX)) {
+		end++;
+	}
+
+	return (u16) (end - data);
+}
+
+static int util_data_equal(const u8 *data, const u8 *str) {
+	while (*str && (*data == *str)) {
+		data++;
+		str++;
+	}
+
+	return (*str == NUL) && ((*data == NUL) || (*data == ETX));
+}
+
 static int util_map_cmd(const HITAGI_CMD_TABLE_T *table_ptr, u8 table_size, const u8 *cmd) {
 	u8 i;
 	for (i = 0; i < table_size; ++i) {
@@ -244,146 +478,210 @@ static int util_map_cmd(const HITAGI_CMD_TABLE_T *table_ptr, u8 table_size, cons
 	return -1;
 }
 
+static int util_ram_window(u32 addr, u32 size) {
+	u8 i;
+	for (i = 0; i < sizeof(ram_windows) / sizeof(ram_windows[0]); ++i) {
+		if ((addr >= ram_windows[i].start) && (addr < ram_windows[i].end) && (size <= ram_windows[i].end - addr)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Only the interworking build of the loader is allowed to switch to Thumb with a module call. */
+static int util_module_entry(u32 addr) {
+#if !defined(FTR_THUMB_COLD)
+	if (addr & 1) {
+		return 0;
+	}
+#endif
+	return util_ram_window(addr & ~1, 1);
+}
+
+static int util_map_module(const u8 *cmd) {
+	u8 i;
+	for (i = 0; i < module_count; ++i) {
+		if (util_string_equal(modules[i].cmd, cmd)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static u8 *util_put_be(u8 *dst, u32 val, u8 size) {
+	while (size--) {
+		*dst++ = (val >> (size * 8)) & 0xFF;
+	}
+
+	return dst;
+}
+
 /**
  * USB section.
  */
 
-static void usb_copy_block(const u8 *src, u16 *dst, u8 len) {
-	u8 i;
-	u8 half_len;
-	u16 data;
-
-	half_len = len / 2;
+/*
+ * Bottom half of the USB engine: moves EP1 packets into the RX ring and feeds EP2 from the TX ring.
+ * It is called from every busy-wait loop (USB, flash status polling) so link traffic keeps flowing while
+ * the CPU waits for flash, and it is safe to hook on the EP1/EP2 interrupt vector as well.
+ */
+void usb_poll(void) {
+	u8 slot;
+	u16 head;
+
+	/* Accept the EP1 packet only if it fits, otherwise keep it in the endpoint so host gets NAKs. */
+	if ((USB_RX_RING_SIZE - (u16) (usb_rx_ring_head - usb_rx_ring_tail)) >= USB_MAX_PACKET_SIZE) {
+		head = hal_usb_rx(usb_rx_ring, usb_rx_ring_head);
+		PERF_ADD(rx_bytes, (u16) (head - usb_rx_ring_head));
+		usb_rx_ring_head = head;
+	}
 
-	for (i = 0; i < half_len; ++i) {
-		data = (u16) (*src++ << 8);
-		*dst++ = (data | *src++);
+	if (usb_tx_ring_head != usb_tx_ring_tail) {
+		slot = usb_tx_ring_tail & (USB_TX_RING_PACKETS - 1);
+		if (hal_usb_tx(usb_tx_ring[slot], usb_tx_ring_len[slot]) == RESULT_OK) {
+			PERF_ADD(tx_bytes, usb_tx_ring_len[slot]);
+			usb_tx_ring_tail++;
+		}
 	}
+}
+
+static void usb_flush(void) {
+	TRACE(TRACE_TX_STALL, TRACE_BEGIN, usb_tx_ring_head, usb_tx_ring_tail);
 
-	if ((len % 2) != 0) {
-		data = (u16) (*src << 8);
-		*dst = data;
+	while (usb_tx_ring_head != usb_tx_ring_tail) {
+		PERF_ADD(tx_full_spins, 1);
+		usb_poll();
 	}
+
+	TRACE(TRACE_TX_STALL, TRACE_END, usb_tx_ring_head, usb_tx_ring_tail);
 }
 
-static int usb_tx(const u8 *src, u8 len) {
-	/*
-	 * (1 << 6):  EP2_int
-	 * (1 << 10): XFREN
-	 * (1 << 13): IEOFC
-	 */
-	if ((USB_INT & (1 << 6)) || !(USB_E2_CR & (1 << 10))) {
-		usb_copy_block(src, USB_E2_TX_HW_BUFFER, len);
+/*
+ * The TX ring slot is handed out to the caller so packets are assembled in place without staging buffers.
+ * The returned slot stays the same until usb_tx_commit() is called.
+ */
+static u8 *usb_tx_acquire(void) {
+	if ((u8) (usb_tx_ring_head - usb_tx_ring_tail) >= USB_TX_RING_PACKETS) {
+		TRACE(TRACE_TX_STALL, TRACE_BEGIN, usb_tx_ring_head, usb_tx_ring_tail);
 
-		USB_E2_CR = (USB_E2_CR & ~0x3F) | (len & 0x3F);
-		USB_E2_CR |= (1 << 13);
-		USB_E2_CR |= (1 << 10);
+		while ((u8) (usb_tx_ring_head - usb_tx_ring_tail) >= USB_TX_RING_PACKETS) {
+			PERF_ADD(tx_full_spins, 1);
+			usb_poll();
+		}
 
-		return RESULT_OK;
+		TRACE(TRACE_TX_STALL, TRACE_END, usb_tx_ring_head, usb_tx_ring_tail);
 	}
 
-	return RESULT_FAIL;
+	return usb_tx_ring[usb_tx_ring_head & (USB_TX_RING_PACKETS - 1)];
+}
+
+static void usb_tx_commit(u8 len) {
+	usb_tx_ring_len[usb_tx_ring_head & (USB_TX_RING_PACKETS - 1)] = len;
+	usb_tx_ring_head++;
+
+	/* Kick EP2 at once if it is idle. */
+	usb_poll();
 }
 
 static u8 usb_rx(u8 *dst) {
-	u8 i;
 	u8 rx_bytes;
+	u16 tail;
 
-	rx_bytes = 0;
+	usb_poll();
 
-	/*
-	 * (1 << 5):  EP1_int
-	 * (1 << 6):  ERRF
-	 * (1 << 13): IEOFC
-	 * (1 << 11): FSTALL
-	 */
-	if (USB_INT & (1 << 5)) {
-		if (!(USB_E1_CR & (1 << 6))) {
-			u8 *p_dst = dst;
-			u8 *p_src = (u8 *) USB_E1_RX_HW_BUFFER;
+	tail = usb_rx_ring_tail;
+	rx_bytes = 0;
 
-			rx_bytes = USB_E1_CR & 0x3F;
+	while ((tail != usb_rx_ring_head) && (rx_bytes < USB_MAX_PACKET_SIZE)) {
+		*dst++ = usb_rx_ring[tail++ & (USB_RX_RING_SIZE - 1)];
+		rx_bytes++;
+	}
 
-			for (i = 0; i < rx_bytes; ++i) {
-				*p_dst++ = *p_src++;
-			}
+	usb_rx_ring_tail = tail;
 
-			USB_E1_CR |= (1 << 13);
-		} else {
-			USB_E1_CR |= (1 << 11);
-		}
+	if (rx_bytes == 0) {
+		PERF_ADD(rx_empty_polls, 1);
 	}
 
 	return rx_bytes;
 }
 
-static int usb_init(void) {
-	/*
-	 * USB_MEMMAP_EP1_EP2_16BYTES = 0x0000
-	 * USB_MEMMAP_EP1_EP2_32BYTES = 0x0001
-	 */
-	USB_CPU_CR = 0x0001;
+/*
+ * Take up to max bytes from the RX ring to dst and add them to the checksum on the fly.
+ * Unlike usb_rx() it never reads beyond max, so the following command stays in the ring.
+ */
+static u16 usb_rx_csum(u8 *dst, u16 max, u8 *csum) {
+	u8 sum;
+	u8 byte_data;
+	u16 rx_bytes;
+	u16 tail;
 
-	return RESULT_OK;
-}
+	usb_poll();
 
-/**
- * Watchdog section.
- */
+	tail = usb_rx_ring_tail;
+	sum = *csum;
+	rx_bytes = 0;
 
-static int watchdog_reboot(void) {
-	/*
-	 * PU_MAIN_SOFTWARE_RESET_PU = 0x0A
-	 */
-	if (RTC_PCRAM0 < 0x0A) {
-		RTC_PCRAM0 = 0x0A;
+	while ((tail != usb_rx_ring_head) && (rx_bytes < max)) {
+		byte_data = usb_rx_ring[tail++ & (USB_RX_RING_SIZE - 1)];
+		sum += byte_data;
+		*dst++ = byte_data;
+		rx_bytes++;
 	}
 
-	/*
-	 * NOT_SW_RESET = 0x0010
-	 * WATCHDOG_WCR &= ~(NOT_SW_RESET)
-	 */
-	WATCHDOG_WCR &= ~(0x0010);
-
-	/* Forever! */
-	while("MotoFan.Ru is cool!");
+	usb_rx_ring_tail = tail;
+	*csum = sum;
 
-	return RESULT_OK;
+	return rx_bytes;
 }
 
-static int watchdog_shutdown(void) {
-	/*
-	 * WD_NOT_ASSERTED = 0x0020
-	 * WATCHDOG_WCR &= ~(WD_NOT_ASSERTED)
-	 */
-	WATCHDOG_WCR &= ~(0x0020);
+#if defined(FTR_TRACE)
+/**
+ * Trace section.
+ */
 
-	/* Forever! */
-	while("MotoFan.Ru is cool!");
+/*
+ * Fixed-size records go to the ring in place, the oldest ones are overwritten. Head is free-running,
+ * so the host knows both the position and how many records were lost.
+ */
+void trace_event(u16 event, u16 phase, u32 arg0, u32 arg1) {
+	HITAGI_TRACE_RECORD_T *record;
 
-	return RESULT_OK;
-}
+	if (trace_paused) {
+		return;
+	}
 
-int watchdog_service(void) {
-	WATCHDOG_WSR = 0x5555;
-	WATCHDOG_WSR = 0xAAAA;
+	record = &trace_ring[trace_head & (TRACE_RING_RECORDS - 1)];
+	record->ticks = hal_timer_ticks();
+	record->event = event;
+	record->phase = phase;
+	record->arg0 = arg0;
+	record->arg1 = arg1;
 
-	return RESULT_OK;
+	trace_head++;
 }
 
-static int watchdog_init(void) {
-	/*
-	 * (THIRTYTWO_SEC_TIMEOUT | WD_OUTPUT_EN | WD_NOT_ASSERTED | NOT_SW_RESET | WD_ENABLE | WD_DEBUG)
-	 *
-	 * hex((63 << 9) | 0x0040 | 0x0020 | 0x0010 | 0x0004 | 0x0002)
-	 * '0x7e76'
-	 */
-	WATCHDOG_WCR = 0x7E76;
+/* Four characters of command name from offset packed into a word, first one goes to the MSB. */
+static u32 trace_name(const u8 *str, u8 offset) {
+	u8 i;
+	u32 word;
 
-	watchdog_service();
+	word = 0;
+	for (i = 0; i < offset; ++i) {
+		if (*str) {
+			str++;
+		}
+	}
+	for (i = 0; i < 4; ++i) {
+		word <<= 8;
+		if (*str) {
+			word |= *str++;
+		}
+	}
 
-	return RESULT_OK;
+	return word;
 }
+#endif
 
 /**
  * Hitagi section.
@@ -402,6 +700,56 @@ static void hitagi_command_ADDR(const u8 *answer_str, const u8 *data_ptr, const
 	received_address_ptr = (u16 *) addr;
 	util_string_copy(&response[0], data_ptr);
 
+	/* Plain ADDR cancels scatter-list upload. */
+	segment_count = 0;
+
+	hitagi_send_ack(response);
+}
+
+static void hitagi_command_ADDR_LIST(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 i;
+	u16 length;
+	u32 addr;
+	u32 size;
+	u8 response[MAX_RESP_DATA_SIZE];
+
+	UNUSED(answer_str);
+	UNUSED(buffer_next_byte);
+
+	segment_count = 0;
+
+	/* "AAAAAAAA,SSSSSSSS" pairs separated by commas. */
+	if (data_ptr == NULL) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	length = util_data_length(data_ptr) + 1;
+	if (((length % SEGMENT_ENTRY_SIZE) != 0) || ((length / SEGMENT_ENTRY_SIZE) > MAX_SEGMENTS)) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	for (i = 0; i < length / SEGMENT_ENTRY_SIZE; ++i, data_ptr += SEGMENT_ENTRY_SIZE) {
+		addr = util_hexasc_to_u32(&data_ptr[0], CMD_32_SIZE);
+		size = util_hexasc_to_u32(&data_ptr[CMD_32_SIZE + 1], CMD_32_SIZE);
+
+		/* Segments are whole flash bus words, so the BIN data split over them stays aligned on 32-bit bus too. */
+		if ((size == 0) || (size % sizeof(FLASH_DATA_WIDTH)) || (addr % sizeof(FLASH_DATA_WIDTH))) {
+			hitagi_send_error(ERR_DATA_INVALID);
+			return;
+		}
+
+		segments[i].start = addr;
+		segments[i].end = addr + size;
+	}
+
+	segment_count = i;
+	segment_index = 0;
+	received_address_ptr = (u16 *) segments[0].start;
+
+	util_u16_to_hexasc(segment_count, response);
+
 	hitagi_send_ack(response);
 }
 
@@ -412,6 +760,7 @@ static void hitagi_command_BIN(const u8 *answer_str, const u8 *data_ptr, const u
 	u8 nr_shift_right;
 	u8 bytes_received;
 	u32 bytes_received_total;
+	u32 chunk_size;
 
 	UNUSED(answer_str);
 
@@ -426,6 +775,16 @@ static void hitagi_command_BIN(const u8 *answer_str, const u8 *data_ptr, const u
 	/* Advance to first data byte. */
 	source_ptr += MAX_DATA_FIELD_SIZE;
 
+	/* Upload to RAM goes straight to the destination address, without rx_data staging. */
+	if (
+		(erase_cmdlet == ERASE_NO) &&
+		(hitagi_bin_chunk(received_packet_size) == received_packet_size) &&
+		util_ram_window((u32) received_address_ptr, received_packet_size)
+	) {
+		hitagi_command_BIN_direct(source_ptr, buffer_next_byte);
+		return;
+	}
+
 	rx_ptr = (u8 *) buffer_next_byte;
 	bytes_received_total = buffer_next_byte - source_ptr;
 
@@ -435,6 +794,22 @@ static void hitagi_command_BIN(const u8 *answer_str, const u8 *data_ptr, const u
 		rx_ptr += bytes_received;
 	}
 
+	TRACE(TRACE_BIN_DATA, TRACE_INSTANT, received_address_ptr, received_packet_size);
+
+	/* Whole packet must fit in the scatter-list segments left, nothing of it is stored otherwise. */
+	if ((segment_count != 0) && (received_packet_size > hitagi_bin_remaining())) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+#if defined(FTR_FLASH_DATA_WIDTH_32BIT)
+	/* Interleaved chips are programmed by whole bus words only, see hitagi_bin_store(). */
+	if ((erase_cmdlet != ERASE_NO) && (((u32) received_address_ptr | received_packet_size) % sizeof(FLASH_DATA_WIDTH))) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+#endif
+
 	/* ACK the BIN command so the host can build up a new command/data packet. While we decrypt and copy it. */
 	hitagi_send_ack(NULL);
 
@@ -456,263 +831,1458 @@ static void hitagi_command_BIN(const u8 *answer_str, const u8 *data_ptr, const u
 		buffer_next_byte += nr_shift_right;
 	}
 
+	/* Spread data over the scatter-list segments, whole packet goes at once in the plain ADDR mode. */
+	bytes_received_total = received_packet_size;
+	while (bytes_received_total > 0) {
+		chunk_size = hitagi_bin_chunk(bytes_received_total);
+		if (chunk_size == 0) {
+			/* Segment table is over, cannot happen after the check above. */
+			return;
+		}
+
+		if (hitagi_bin_store(source_ptr, chunk_size) != RESULT_OK) {
+			return;
+		}
+
+		/*
+		 * Update the address pointer to track where we are.
+		 * This eliminates the need for each BIN packet to be
+		 * preceded by and ADDR packet for large section of contiguius memory.
+		 */
+		hitagi_bin_advance(chunk_size);
+
+		source_ptr += chunk_size;
+		bytes_received_total -= chunk_size;
+	}
+}
+
+static int hitagi_bin_store(const u8 *source_ptr, u32 size) {
+	u32 i;
+	u32 ticks;
+	int status;
+	u8 *data_ptr;
+
 	if (erase_cmdlet == ERASE_NO) {
 		/* Copy to RAM. */
-		data_aligned_ptr = (u8 *) received_address_ptr;
-		for (i = 0; i < received_packet_size; ++i) {
-			*data_aligned_ptr++ = *source_ptr++;
+		data_ptr = (u8 *) received_address_ptr;
+		for (i = 0; i < size; ++i) {
+			*data_ptr++ = *source_ptr++;
 		}
 	} else {
-		flash_unlock((volatile u16 *) received_address_ptr);
-
-		if (flash_geometry((volatile u16 *) received_address_ptr) == RESULT_OK) {
-			flash_erase((volatile u16 *) received_address_ptr);
+#if defined(FTR_FLASH_DATA_WIDTH_32BIT)
+		/* Interleaved chips are programmed by whole bus words only. */
+		if (((u32) received_address_ptr | (u32) source_ptr | size) % sizeof(FLASH_DATA_WIDTH)) {
+			return RESULT_FAIL;
 		}
+#endif
+
+		hitagi_bin_erase();
 
 		if (erase_cmdlet != ERASE_ONLY) {
+			ticks = PERF_TICKS();
 			if (erase_cmdlet == ERASE_WRITE_BLOCK) {
-				flash_write_block(
-					(volatile u16 *) received_address_ptr,
-					(volatile u16 *) source_ptr,
-					received_packet_size
+				status = flash_write_block(
+					(volatile FLASH_DATA_WIDTH *) received_address_ptr,
+					(volatile FLASH_DATA_WIDTH *) source_ptr,
+					size
 				);
 			} else if (erase_cmdlet == ERASE_WRITE_BUFFER) {
-				flash_write_buffer(
-					(volatile u16 *) received_address_ptr,
-					(const u16 *) source_ptr,
-					received_packet_size
+				status = flash_write_buffer(
+					(volatile FLASH_DATA_WIDTH *) received_address_ptr,
+					(const FLASH_DATA_WIDTH *) source_ptr,
+					size
 				);
 			} else {
 				/* Unknown write flash method. */
-				return;
+				return RESULT_FAIL;
+			}
+			PERF_ADD(program_ticks, PERF_TICKS() - ticks);
+			PERF_ADD(program_bytes, size);
+			PERF_ADD(program_count, 1);
+
+			/* Failed program is not a complete block, COPY and FILL answer ERR instead of ACK. */
+			if (status != RESULT_OK) {
+				return RESULT_FAIL;
+			}
+#if !defined(FTR_COMPACT)
+			hitagi_journal_program((u32) received_address_ptr + size);
+#endif
+		}
+	}
+
+	return RESULT_OK;
+}
+
+/*
+ * Unlock the flash block at the current address and erase it when the address is the block start.
+ */
+static void hitagi_bin_erase(void) {
+	u32 ticks;
+
+	flash_unlock((volatile FLASH_DATA_WIDTH *) received_address_ptr);
+
+	if (flash_geometry((volatile FLASH_DATA_WIDTH *) received_address_ptr) == RESULT_OK) {
+		ticks = PERF_TICKS();
+		flash_erase((volatile FLASH_DATA_WIDTH *) received_address_ptr);
+		PERF_ADD(erase_ticks, PERF_TICKS() - ticks);
+		PERF_ADD(erase_count, 1);
+#if !defined(FTR_COMPACT)
+		hitagi_journal_erase((u32) received_address_ptr);
+#endif
+	}
+}
+
+/*
+ * Number of bytes from size which belong to the current scatter-list segment.
+ */
+static u32 hitagi_bin_chunk(u32 size) {
+	u32 left;
+
+	if (segment_count == 0) {
+		return size;
+	}
+
+	if (segment_index >= segment_count) {
+		return 0;
+	}
+
+	left = segments[segment_index].end - (u32) received_address_ptr;
+
+	return (size < left) ? size : left;
+}
+
+/*
+ * Number of bytes left in the scatter-list segments from the current address on.
+ */
+static u32 hitagi_bin_remaining(void) {
+	u8 i;
+	u32 left;
+
+	if (segment_index >= segment_count) {
+		return 0;
+	}
+
+	left = segments[segment_index].end - (u32) received_address_ptr;
+	for (i = segment_index + 1; i < segment_count; ++i) {
+		left += segments[i].end - segments[i].start;
+	}
+
+	return left;
+}
+
+static void hitagi_bin_advance(u32 size) {
+	received_address_ptr += (size / 2);
+
+	/* Jump to the start of next segment when current one is filled. */
+	if ((segment_count != 0) && ((u32) received_address_ptr == segments[segment_index].end)) {
+		segment_index++;
+		if (segment_index < segment_count) {
+			received_address_ptr = (u16 *) segments[segment_index].start;
+		}
+	}
+}
+
+/*
+ * Zero-copy BIN for RAM targets: payload goes from the USB RX ring to the destination address and the checksum
+ * is verified on the fly, so ACK is sent only for the correct data.
+ */
+static void hitagi_command_BIN_direct(const u8 *source_ptr, const u8 *buffer_next_byte) {
+	u8 csum;
+	u8 tail[2];
+	u8 tail_csum;
+	u16 i;
+	u16 size;
+	u16 received;
+	u16 tail_received;
+	u8 *dst_ptr;
+
+	dst_ptr = (u8 *) received_address_ptr;
+
+	/* Checksum covers the data size field and the data, same as in READ answer. */
+	csum  = (received_packet_size >> 8) & 0xFF;
+	csum += (received_packet_size >> 0) & 0xFF;
+
+	/* Data already read by the parser together with the command header. */
+	received = buffer_next_byte - source_ptr;
+	size = (received < received_packet_size) ? received : received_packet_size;
+	for (i = 0; i < size; ++i) {
+		csum += source_ptr[i];
+		*dst_ptr++ = source_ptr[i];
+	}
+
+	/* The rest of data is placed by the USB engine right to the destination address. */
+	size = received_packet_size - size;
+	while (size > 0) {
+		received = usb_rx_csum(dst_ptr, size, &csum);
+		dst_ptr += received;
+		size -= received;
+		watchdog_service();
+	}
+
+	/* Checksum and ETX bytes, some of them could be read by the parser as well. */
+	tail_csum = 0;
+	tail_received = 0;
+	for (i = received_packet_size; (i < buffer_next_byte - source_ptr) && (tail_received < 2); ++i) {
+		tail[tail_received++] = source_ptr[i];
+	}
+	while (tail_received < 2) {
+		tail_received += usb_rx_csum(&tail[tail_received], 2 - tail_received, &tail_csum);
+		watchdog_service();
+	}
+
+	TRACE(TRACE_BIN_DATA, TRACE_INSTANT, received_address_ptr, received_packet_size);
+
+	if (tail[0] != csum) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	hitagi_send_ack(NULL);
+
+	hitagi_bin_advance(received_packet_size);
+}
+
+/*
+ * Constant pattern is repeated from the address on without BIN upload. RAM gets STM bursts, flash goes through
+ * the erase and program logic of BIN, which is skipped for the erased 0xFF pattern.
+ */
+static void hitagi_command_FILL(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u16 i;
+	u16 length;
+	u32 addr;
+	u32 size;
+	u32 chunk;
+	u32 start;
+	u32 block_start;
+	u32 *buffer;
+	u16 *saved_address_ptr;
+	union {
+		u32 word;
+		u16 half[2];
+		u8 byte[4];
+	} fill;
+
+	UNUSED(answer_str);
+	UNUSED(buffer_next_byte);
+
+	length = (data_ptr != NULL) ? util_data_length(data_ptr) : 0;
+	if ((length != FILL_ENTRY_SIZE_16) && (length != FILL_ENTRY_SIZE_32)) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	addr = util_hexasc_to_u32(&data_ptr[0], CMD_32_SIZE);
+	size = util_hexasc_to_u32(&data_ptr[CMD_32_SIZE + 1], CMD_32_SIZE);
+	fill.word = util_hexasc_to_u32(&data_ptr[2 * (CMD_32_SIZE + 1)], length - 2 * (CMD_32_SIZE + 1));
+
+	if ((size == 0) || (addr % 2) || (size % 2)) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	/* Pattern bytes go to memory in the given order, the word is the content of any aligned word of the range. */
+	if (length == FILL_ENTRY_SIZE_16) {
+		fill.word |= fill.word << 16;
+	}
+	util_put_be(fill.byte, fill.word, sizeof(u32));
+	if (addr % sizeof(u32)) {
+		i = fill.half[0];
+		fill.half[0] = fill.half[1];
+		fill.half[1] = i;
+	}
+
+	if (erase_cmdlet == ERASE_NO) {
+		if (addr % sizeof(u32)) {
+			*(u16 *) addr = fill.half[1];
+			addr += 2;
+			size -= 2;
+		}
+
+		while (size >= FILL_BURST_SIZE) {
+			chunk = (size < FILL_RAM_CHUNK_SIZE) ? size : FILL_RAM_CHUNK_SIZE;
+			chunk &= ~(FILL_BURST_SIZE - 1);
+			hal_fill_burst((u32 *) addr, fill.word, chunk);
+			addr += chunk;
+			size -= chunk;
+			watchdog_service();
+		}
+
+		for (; size >= sizeof(u32); size -= sizeof(u32), addr += sizeof(u32)) {
+			*(u32 *) addr = fill.word;
+		}
+		if (size != 0) {
+			*(u16 *) addr = fill.half[0];
+		}
+	} else {
+		/* Word aligned source, chunks starting in the middle of a word take it from the second halfword. */
+		buffer = (u32 *) (((u32) response_buffer + sizeof(u32) - 1) & ~(sizeof(u32) - 1));
+		for (i = 0; i < (FILL_FLASH_CHUNK_SIZE / sizeof(u32)) + 1; ++i) {
+			buffer[i] = fill.word;
+		}
+
+		start = addr;
+		saved_address_ptr = received_address_ptr;
+		while (size > 0) {
+			chunk = FILL_FLASH_CHUNK_SIZE - (addr & (FILL_FLASH_CHUNK_SIZE - 1));
+			chunk = (size < chunk) ? size : chunk;
+			received_address_ptr = (u16 *) addr;
+
+			if (fill.word == FILL_ERASED_PATTERN) {
+				/* Erased flash reads as 0xFF, so blocks starting in the range are erased and nothing is programmed. */
+				hitagi_bin_erase();
+
+				if (erase_cmdlet != ERASE_ONLY) {
+					/* Part of a block starting before the range is not erased, it must be blank already. */
+					i = 0;
+					while ((i < chunk / 2) && (((volatile u16 *) addr)[i] == 0xFFFF)) {
+						++i;
+					}
+					if (i < chunk / 2) {
+						received_address_ptr = saved_address_ptr;
+						hitagi_send_error(ERR_DATA_INVALID);
+						return;
+					}
+					/* Only blocks erased by this FILL are complete, the others were merely checked. */
+					if ((hitagi_journal_block(addr, &block_start) != 0) && (block_start >= start)) {
+						hitagi_journal_program(addr + chunk);
+					}
+				}
+			} else if (hitagi_bin_store((const u8 *) buffer + (addr % sizeof(u32)), chunk) != RESULT_OK) {
+				received_address_ptr = saved_address_ptr;
+				hitagi_send_error(ERR_DATA_INVALID);
+				return;
+			}
+
+			addr += chunk;
+			size -= chunk;
+			watchdog_service();
+		}
+
+		/* FILL does not move the ADDR pointer of following BIN packets. */
+		received_address_ptr = saved_address_ptr;
+	}
+
+	hitagi_send_ack(NULL);
+}
+
+/*
+ * Data already on the device goes to the destination without the READ and BIN round trip over USB.
+ */
+static void hitagi_command_COPY(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u32 i;
+	u32 src;
+	u32 dst;
+	u32 size;
+	u32 chunk;
+	u32 lower;
+	u32 upper;
+	u32 block_size;
+	u32 block_start;
+	u16 *buffer;
+	u16 *dst_ptr;
+	const u16 *src_ptr;
+	u16 *saved_address_ptr;
+
+	UNUSED(answer_str);
+	UNUSED(buffer_next_byte);
+
+	if ((data_ptr == NULL) || (util_data_length(data_ptr) != COPY_ENTRY_SIZE)) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	src = util_hexasc_to_u32(&data_ptr[0], CMD_32_SIZE);
+	dst = util_hexasc_to_u32(&data_ptr[CMD_32_SIZE + 1], CMD_32_SIZE);
+	size = util_hexasc_to_u32(&data_ptr[2 * (CMD_32_SIZE + 1)], CMD_32_SIZE);
+
+	if ((size == 0) || (src % 2) || (dst % 2) || (size % 2)) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	if (erase_cmdlet == ERASE_NO) {
+		READ_MODE_FAST();
+
+		/* Overlapping ranges are copied backwards when the destination is above the source. */
+		if ((dst > src) && (dst < src + size)) {
+			src_ptr = (const u16 *) (src + size);
+			dst_ptr = (u16 *) (dst + size);
+			for (i = 0; i < size / 2; ++i) {
+				*--dst_ptr = *--src_ptr;
+				if ((i % COPY_CHUNK_SIZE) == 0) {
+					watchdog_service();
+				}
+			}
+		} else {
+			src_ptr = (const u16 *) src;
+			dst_ptr = (u16 *) dst;
+			for (i = 0; i < size / 2; ++i) {
+				*dst_ptr++ = *src_ptr++;
+				if ((i % COPY_CHUNK_SIZE) == 0) {
+					watchdog_service();
+				}
+			}
+		}
+	} else {
+		/* Source must stay out of the blocks erased for the destination, the data would be gone before copy. */
+		lower = dst;
+		upper = dst + size;
+		if (hitagi_journal_block(lower, &block_start) != 0) {
+			lower = block_start;
+		}
+		block_size = hitagi_journal_block(upper - 1, &block_start);
+		if (block_size != 0) {
+			upper = block_start + block_size;
+		}
+		if ((src < upper) && (src + size > lower)) {
+			hitagi_send_error(ERR_DATA_INVALID);
+			return;
+		}
+
+		buffer = (u16 *) (((u32) response_buffer + sizeof(u32) - 1) & ~(sizeof(u32) - 1));
+
+		saved_address_ptr = received_address_ptr;
+		while (size > 0) {
+			chunk = COPY_CHUNK_SIZE - (dst & (COPY_CHUNK_SIZE - 1));
+			chunk = (size < chunk) ? size : chunk;
+
+			/* Flash cannot be read while it programs, so anything but external RAM is staged in IRAM. */
+			src_ptr = (const u16 *) src;
+			if (!util_ram_window(src, chunk)) {
+				for (i = 0; i < chunk / 2; ++i) {
+					buffer[i] = src_ptr[i];
+				}
+				src_ptr = buffer;
+			}
+
+			received_address_ptr = (u16 *) dst;
+			if (hitagi_bin_store((const u8 *) src_ptr, chunk) != RESULT_OK) {
+				received_address_ptr = saved_address_ptr;
+				hitagi_send_error(ERR_DATA_INVALID);
+				return;
+			}
+
+			src += chunk;
+			dst += chunk;
+			size -= chunk;
+			watchdog_service();
+		}
+
+		/* COPY does not move the ADDR pointer of following BIN packets. */
+		received_address_ptr = saved_address_ptr;
+	}
+
+	hitagi_send_ack(NULL);
+}
+
+static void hitagi_command_ERASE(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 *response = response_buffer;
+
+	UNUSED(answer_str);
+	UNUSED(data_ptr);
+	UNUSED(buffer_next_byte);
+
+	erase_cmdlet += 1;
+
+	/* Comment out for compatibility with Motorola Flash Protocol. */
+	util_u16_to_hexasc(erase_cmdlet, response);
+
+	hitagi_send_ack(response);
+}
+
+static void hitagi_command_READ(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u16 size;
+	u32 start_addr;
+	u8 header[READ_RANGE_HEADER_SIZE];
+	HITAGI_TX_SEGMENT_T tx_segments[READ_RANGE_SEGMENTS];
+
+	UNUSED(buffer_next_byte);
+
+	start_addr = util_hexasc_to_u32(&data_ptr[0], CMD_32_SIZE);
+	size = util_hexasc_to_u32(&data_ptr[CMD_32_SIZE + 1], CMD_16_SIZE);
+
+	if ((size) < 0x10) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	hitagi_read_range(start_addr, size, header, tx_segments);
+
+	hitagi_send_segments(answer_str, tx_segments, READ_RANGE_SEGMENTS);
+}
+
+static void hitagi_command_READ_LIST(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 i;
+	u8 count;
+	u16 size;
+	u16 length;
+	u32 start_addr;
+	u8 headers[MAX_READ_RANGES][READ_RANGE_HEADER_SIZE];
+	HITAGI_TX_SEGMENT_T tx_segments[MAX_READ_RANGES * READ_RANGE_SEGMENTS];
+
+	UNUSED(buffer_next_byte);
+
+	/* "AAAAAAAA,SSSS" pairs separated by commas. */
+	if (data_ptr == NULL) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	length = util_data_length(data_ptr) + 1;
+	count = length / READ_RANGE_ENTRY_SIZE;
+	if (((length % READ_RANGE_ENTRY_SIZE) != 0) || (count > MAX_READ_RANGES)) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	for (i = 0; i < count; ++i, data_ptr += READ_RANGE_ENTRY_SIZE) {
+		start_addr = util_hexasc_to_u32(&data_ptr[0], CMD_32_SIZE);
+		size = util_hexasc_to_u32(&data_ptr[CMD_32_SIZE + 1], CMD_16_SIZE);
+
+		if (size == 0) {
+			hitagi_send_error(ERR_DATA_INVALID);
+			return;
+		}
+
+		hitagi_read_range(start_addr, size, headers[i], &tx_segments[i * READ_RANGE_SEGMENTS]);
+	}
+
+	/* All ranges go back to back in the one answer, each one as size, data and checksum. */
+	hitagi_send_segments(answer_str, tx_segments, count * READ_RANGE_SEGMENTS);
+}
+
+/*
+ * Prepare READ answer segments for the range: 16-bit size header, data right from memory and 8-bit checksum.
+ * Data is not copied, header array keeps size and checksum bytes.
+ */
+static void hitagi_read_range(u32 start_addr, u16 size, u8 *header, HITAGI_TX_SEGMENT_T *tx_segments) {
+	u8 csum;
+	u8 *data_start_ptr;
+	u8 *data_end_ptr;
+
+	data_start_ptr = (u8 *) start_addr;
+	data_end_ptr = data_start_ptr + size;
+
+	READ_MODE_FAST();
+
+	header[0] = (size >> 8) & 0xFF;
+	header[1] = (size >> 0) & 0xFF;
+	csum = header[0] + header[1];
+
+	while (data_start_ptr < data_end_ptr) {
+		csum += *(data_start_ptr++);
+
+		watchdog_service();
+	}
+
+	header[2] = csum;
+
+	tx_segments[0].ptr = &header[0];
+	tx_segments[0].size = 2;
+	tx_segments[1].ptr = (const u8 *) start_addr;
+	tx_segments[1].size = size;
+	tx_segments[2].ptr = &header[2];
+	tx_segments[2].size = 1;
+}
+
+static void hitagi_command_RQHW(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 i;
+	u8 *response_ptr;
+	u16 bootloader_version;
+	u8 *response = response_buffer;
+
+	UNUSED(data_ptr);
+	UNUSED(buffer_next_byte);
+
+	for (i = 0; i < 8 * 2; ++i) {
+		response[i] = 0x30;
+	}
+
+	response_ptr = &response[12];
+	/* 0x0E offset (0x0E / 2) bootloader version on 0x1000000E. */
+	bootloader_version = *((volatile u16 *) FLASH_START_ADDRESS + 0x07);
+
+	util_u16_to_hexasc(bootloader_version, response_ptr);
+
+	hitagi_send_packet(answer_str, response);
+}
+
+/*
+ * Horspool search, text is copied to IRAM by word loads window by window and scanned there.
+ */
+static void hitagi_command_FIND(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 i;
+	u8 size;
+	u8 count;
+	u8 max_count;
+	u16 j;
+	u16 length;
+	u32 pos;
+	u32 end;
+	u32 base;
+	u32 limit;
+	u32 *window;
+	const u32 *src;
+	const u8 *text;
+	const u8 *mask_ptr;
+	u8 *response_ptr;
+	u8 skip[256];
+	u8 pattern[FIND_MAX_PATTERN_SIZE];
+	u8 mask[FIND_MAX_PATTERN_SIZE];
+	u32 matches[FIND_MAX_MATCHES];
+
+	UNUSED(buffer_next_byte);
+
+	length = (data_ptr != NULL) ? util_data_length(data_ptr) : 0;
+	if (length <= FIND_HEADER_SIZE) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	/* Pattern alone has an even number of digits, pattern and mask have a comma between them. */
+	length -= FIND_HEADER_SIZE;
+	mask_ptr = NULL;
+	if (length % 2) {
+		size = (length - 1) / 4;
+		mask_ptr = &data_ptr[FIND_HEADER_SIZE + size * 2 + 1];
+		if ((length != (size * 4 + 1)) || (mask_ptr[-1] != ',')) {
+			size = 0;
+		}
+	} else {
+		size = ((length / 2) > FIND_MAX_PATTERN_SIZE) ? 0 : (length / 2);
+	}
+
+	pos = util_hexasc_to_u32(&data_ptr[0], CMD_32_SIZE);
+	end = pos + util_hexasc_to_u32(&data_ptr[CMD_32_SIZE + 1], CMD_32_SIZE);
+	max_count = util_hexasc_to_u32(&data_ptr[2 * (CMD_32_SIZE + 1)], CMD_8_SIZE);
+
+	if (
+		(size == 0) || (size > FIND_MAX_PATTERN_SIZE) || (end < pos) || ((end - pos) < size) ||
+		(max_count == 0) || (max_count > FIND_MAX_MATCHES)
+	) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	for (i = 0; i < size; ++i) {
+		mask[i] = (mask_ptr != NULL) ? util_hexasc_to_u32(&mask_ptr[i * 2], CMD_8_SIZE) : 0xFF;
+		pattern[i] = util_hexasc_to_u32(&data_ptr[FIND_HEADER_SIZE + i * 2], CMD_8_SIZE) & mask[i];
+	}
+
+	/* Shift for a text byte under the last pattern byte is the distance to the nearest pattern byte matching it. */
+	for (j = 0; j < sizeof(skip); ++j) {
+		skip[j] = size;
+	}
+	for (i = 0; i < size - 1; ++i) {
+		if (mask[i] == 0xFF) {
+			skip[pattern[i]] = size - 1 - i;
+		} else {
+			for (j = 0; j < sizeof(skip); ++j) {
+				if ((j & mask[i]) == pattern[i]) {
+					skip[j] = size - 1 - i;
+				}
+			}
+		}
+	}
+
+	READ_MODE_FAST();
+
+	count = 0;
+	window = (u32 *) (((u32) response_buffer + sizeof(u32) - 1) & ~(sizeof(u32) - 1));
+	while (((end - pos) >= size) && (count < max_count)) {
+		/* Next window starts at the first position not checked yet, so a match on the edge is not lost. */
+		base = pos & ~(sizeof(u32) - 1);
+		limit = ((end - base) < FIND_WINDOW_SIZE) ? end : (base + FIND_WINDOW_SIZE);
+
+		src = (const u32 *) base;
+		for (j = 0; j < (limit - base + sizeof(u32) - 1) / sizeof(u32); ++j) {
+			window[j] = src[j];
+		}
+
+		while (((limit - pos) >= size) && (count < max_count)) {
+			text = (const u8 *) window + (pos - base);
+			if (hitagi_find_match(text, pattern, mask, size) == RESULT_OK) {
+				matches[count++] = pos;
+			}
+			pos += skip[text[size - 1]];
+		}
+
+		watchdog_service();
+	}
+
+	response_ptr = response_buffer;
+	util_u8_to_hexasc(count, response_ptr);
+	response_ptr += CMD_8_SIZE;
+	for (i = 0; i < count; ++i) {
+		*response_ptr++ = ',';
+		util_u32_to_hexasc(matches[i], response_ptr);
+		response_ptr += CMD_32_SIZE;
+	}
+
+	hitagi_send_packet(answer_str, response_buffer);
+}
+
+static int hitagi_find_match(const u8 *text, const u8 *pattern, const u8 *mask, u8 size) {
+	while (size--) {
+		if ((text[size] & mask[size]) != pattern[size]) {
+			return RESULT_FAIL;
+		}
+	}
+
+	return RESULT_OK;
+}
+
+static void hitagi_command_RQVN(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 i;
+	u8 *response_ptr;
+	u16 bootloader_version;
+	u8 *response = response_buffer;
+
+	UNUSED(data_ptr);
+	UNUSED(buffer_next_byte);
+
+	for (i = 0; i < ((8 * 2) * 2) + 1; ++i) {
+		response[i] = 0x30;
+	}
+
+	/* 0x0E offset (0x0E / 2) bootloader version on 0x1000000E. */
+	bootloader_version = *((volatile u16 *) FLASH_START_ADDRESS + 0x07);
+
+	response_ptr = &response[12];
+	util_u16_to_hexasc(bootloader_version, response_ptr);
+	response[16] = *com_str;
+
+	/* Repeat bootloader version again. */
+	response_ptr = &response[29];
+	util_u16_to_hexasc(bootloader_version, response_ptr);
+
+	hitagi_send_packet(answer_str, response);
+}
+
+static void hitagi_command_RQRC(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u16 csum;
+	u8 *data_start_ptr;
+	u8 *data_end_ptr;
+	u8 *response_ptr;
+	u8 response[MAX_RESP_DATA_SIZE];
+	u32 start_addr;
+	u32 end_addr;
+
+	UNUSED(buffer_next_byte);
+
+	csum = 0;
+	response_ptr = &response[0];
+
+	start_addr = util_hexasc_to_u32(&data_ptr[0], CMD_32_SIZE);
+	end_addr = util_hexasc_to_u32(&data_ptr[CMD_32_SIZE + 1], CMD_32_SIZE);
+
+	data_start_ptr = (u8 *) start_addr;
+	data_end_ptr = (u8 *) end_addr;
+
+	if ((end_addr - start_addr) < 1) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	READ_MODE_FAST();
+
+	while (data_start_ptr <= data_end_ptr) {
+		csum += *data_start_ptr;
+		data_start_ptr++;
+		watchdog_service();
+	}
+
+	util_u16_to_hexasc(csum, response_ptr);
+
+	hitagi_send_packet(answer_str, response);
+}
+
+static void hitagi_command_RQSW(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 *response_ptr;
+	u8 *response = response_buffer;
+
+	UNUSED(data_ptr);
+	UNUSED(buffer_next_byte);
+
+	response_ptr = &response[0];
+	util_string_copy(response_ptr, (const u8 *) "Hitagi SW v1.0");
+	response_ptr = &response[14];
+	util_string_copy(response_ptr, scm_str); /* ":" is separator there. */
+	response_ptr = &response[15];
+	util_string_copy(response_ptr, (const u8 *) "Hitagi FLEX v1.0");
+
+	hitagi_send_packet(answer_str, response);
+}
+
+static void hitagi_command_RQSN(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 *response_ptr;
+	u8 *response = response_buffer;
+
+	volatile u16 *i;
+	volatile u16 *start = NEPTUNE_UID_REG_ADDR;
+	volatile u16 *end = (NEPTUNE_REV_REG_ADDR - 1);
+
+	response_ptr = &response[0];
+
+	UNUSED(data_ptr);
+	UNUSED(buffer_next_byte);
+
+	for (i = end; i >= start; --i) {
+		util_u16_to_hexasc(*i, response_ptr);
+		response_ptr += 4;
+	}
+
+	hitagi_send_packet(answer_str, response);
+}
+
+static void hitagi_command_RQFI(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u32 flash_part_id;
+	u8 *response = response_buffer;
+
+	UNUSED(data_ptr);
+	UNUSED(buffer_next_byte);
+
+	flash_part_id = flash_get_part_id(FLASH_START_ADDRESS);
+	util_u32_to_hexasc(flash_part_id, response);
+
+	hitagi_send_packet(answer_str, response);
+}
+
+static void hitagi_command_READ_OTP(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u16 i;
+	u16 size;
+	u8 *response_ptr;
+	u8 *response = response_buffer;
+
+	UNUSED(data_ptr);
+	UNUSED(buffer_next_byte);
+
+	response_ptr = &response[0];
+
+	flash_get_otp_zone(FLASH_START_ADDRESS, otp_buffer, &size);
+
+	for (i = 0; i < size; ++i) {
+		util_u8_to_hexasc(otp_buffer[i], response_ptr);
+		response_ptr += 2;
+	}
+
+	hitagi_send_packet(answer_str, response);
+}
+
+/*
+ * IMEI stored in OTP as BCD digits (low nibble first) XORed with the SoC UID, the check digit is not stored.
+ */
+static void hitagi_command_READ_IMEI(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 i;
+	u8 digit;
+	u8 luhn;
+	u16 word;
+	u8 *response_ptr;
+	FLASH_DATA_WIDTH otp[IMEI_PR_WORDS];
+	volatile u16 *uid;
+	u8 *response = response_buffer;
+
+	UNUSED(data_ptr);
+	UNUSED(buffer_next_byte);
+
+	/* Chip without a known IMEI record answers as for a missing command, CAP_IMEI is not set for it either. */
+	if (flash_ops->imei_pr_offset == 0) {
+		hitagi_send_error(ERR_UNKNOWN_COMMAND);
+		return;
+	}
+
+	/* Interleaved chips give the record of the chip on the low half of the bus. */
+	flash_read_protection(FLASH_START_ADDRESS, flash_ops->imei_pr_offset, otp, IMEI_PR_WORDS);
+
+	/* Digits go from the high byte of every decrypted word, UID words are taken from the last one. */
+	luhn = 0;
+	response_ptr = &response[0];
+	for (i = 0; i < IMEI_DIGITS - 1; ++i) {
+		word = (u16) otp[i / 4] ^ *(NEPTUNE_UID_REG_ADDR + 7 - (i / 4));
+		digit = (word >> (((i % 4) ^ 2) * 4)) & 0x0F;
+		*response_ptr++ = (digit > 9) ? (digit + '7') : (digit + '0');
+
+		/* Luhn check digit doubles every second digit from the right one. */
+		if (i % 2) {
+			digit *= 2;
+			digit = (digit > 9) ? (digit - 9) : digit;
+		}
+		luhn += digit;
+	}
+	*response_ptr++ = ((10 - (luhn % 10)) % 10) + '0';
+
+	/* Raw record and UID in the RQSN order follow for the host side checks. */
+	*response_ptr++ = ',';
+	for (i = 0; i < IMEI_PR_WORDS; ++i) {
+		util_u16_to_hexasc((u16) otp[i], response_ptr);
+		response_ptr += CMD_16_SIZE;
+	}
+	*response_ptr++ = ',';
+	for (uid = NEPTUNE_REV_REG_ADDR - 1; uid >= NEPTUNE_UID_REG_ADDR; --uid) {
+		util_u16_to_hexasc(*uid, response_ptr);
+		response_ptr += CMD_16_SIZE;
+	}
+
+	hitagi_send_packet(answer_str, response);
+}
+
+static void hitagi_command_RQPC(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 i;
+	u32 *counter;
+	u8 *response_ptr;
+	u8 *response = response_buffer;
+
+	UNUSED(buffer_next_byte);
+
+	response_ptr = &response[0];
+	util_u32_to_hexasc(HAL_TIMER_HZ, response_ptr);
+	response_ptr += CMD_32_SIZE;
+
+	counter = (u32 *) &perf;
+	for (i = 0; i < sizeof(perf) / sizeof(u32); ++i) {
+		*response_ptr++ = *com_str;
+		util_u32_to_hexasc(counter[i], response_ptr);
+		response_ptr += CMD_32_SIZE;
+	}
+
+	for (i = 0; i < sizeof(cmd_tbl) / sizeof(cmd_tbl[0]); ++i) {
+		if (perf_commands[i].count == 0) {
+			continue;
+		}
+
+		*response_ptr++ = *com_str;
+		util_string_copy(response_ptr, cmd_tbl[i].cmd);
+		response_ptr += util_string_length(cmd_tbl[i].cmd);
+		*response_ptr++ = *com_str;
+		util_u32_to_hexasc(perf_commands[i].count, response_ptr);
+		response_ptr += CMD_32_SIZE;
+		*response_ptr++ = *com_str;
+		util_u32_to_hexasc(perf_commands[i].ticks, response_ptr);
+		response_ptr += CMD_32_SIZE;
+	}
+
+	/* Counters are cleared after the snapshot, so every RQPC,RESET answer covers the time since the previous one. */
+	if ((data_ptr != NULL) && util_data_equal(data_ptr, rst_str)) {
+		for (i = 0; i < sizeof(perf) / sizeof(u32); ++i) {
+			counter[i] = 0;
+		}
+		for (i = 0; i < sizeof(cmd_tbl) / sizeof(cmd_tbl[0]); ++i) {
+			perf_commands[i].count = 0;
+			perf_commands[i].ticks = 0;
+		}
+	}
+
+	hitagi_send_packet(answer_str, response);
+}
+
+static void hitagi_command_BENCH(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 i;
+	u16 j;
+	u16 size;
+	u32 addr;
+	u32 start;
+	int status;
+	u16 *pattern;
+	u8 *response_ptr;
+	volatile FLASH_DATA_WIDTH *flash;
+	const u32 *regions[BENCH_READ_REGIONS];
+	u32 results[BENCH_RESULTS];
+	u8 *response = response_buffer;
+
+	UNUSED(buffer_next_byte);
+
+	if ((data_ptr == NULL) || (util_data_length(data_ptr) != BENCH_ENTRY_SIZE) || (erase_cmdlet == ERASE_NO)) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	addr = util_hexasc_to_u32(&data_ptr[0], CMD_32_SIZE);
+	size = util_hexasc_to_u32(&data_ptr[CMD_32_SIZE + 1], CMD_16_SIZE);
+	flash = (volatile FLASH_DATA_WIDTH *) addr;
+
+	if (
+		(size == 0) || (size > BENCH_PROGRAM_MAX_SIZE) || (size % BENCH_PROGRAM_ALIGN) ||
+		(flash_geometry(flash) != RESULT_OK)
+	) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	results[BENCH_RESULT_TIMER_HZ] = HAL_TIMER_HZ;
+	results[BENCH_RESULT_READ_BYTES] = BENCH_READ_SIZE * BENCH_READ_PASSES;
+
+	/* IRAM is the RX buffer of the loader itself, RAM is the start of external RAM, flash is the scratch block. */
+	regions[0] = (const u32 *) ((u32) rx_data & ~(BENCH_PROGRAM_ALIGN - 1));
+	regions[1] = (const u32 *) NEPTUNE_RAM_START;
+	regions[2] = (const u32 *) addr;
+
+	/* Flash is read in the mode set by READ_MODE, erase and program below go asynchronous anyway. */
+	READ_MODE_FAST();
+
+	for (i = 0; i < BENCH_READ_REGIONS * BENCH_READ_WIDTHS; ++i) {
+		results[BENCH_RESULT_READ + i] = hitagi_bench_read(regions[i / BENCH_READ_WIDTHS], i % BENCH_READ_WIDTHS);
+	}
+
+	/* Pattern has no 0xFFFF words, so the word mode programs all of them. Command data is already parsed. */
+	pattern = (u16 *) (((u32) rx_data + sizeof(u32) - 1) & ~(sizeof(u32) - 1));
+	for (j = 0; j < size / 2; ++j) {
+		pattern[j] = j ^ 0xA55A;
+	}
+
+	flash_unlock(flash);
+
+	/* Block content is lost whatever happens below, a resuming host must not take it as flashed. */
+	hitagi_journal_erase(addr);
+
+	start = hal_timer_ticks();
+	status = flash_erase(flash);
+	results[BENCH_RESULT_ERASE] = hal_timer_ticks() - start;
+
+	if (status == RESULT_OK) {
+		start = hal_timer_ticks();
+		status = flash_write_block(flash, (volatile FLASH_DATA_WIDTH *) pattern, size);
+		results[BENCH_RESULT_WRITE_WORD] = hal_timer_ticks() - start;
+	}
+
+	if (status == RESULT_OK) {
+		start = hal_timer_ticks();
+		status = flash_write_buffer(flash + (size / sizeof(FLASH_DATA_WIDTH)), (const FLASH_DATA_WIDTH *) pattern, size);
+		results[BENCH_RESULT_WRITE_BUFFER] = hal_timer_ticks() - start;
+	}
+
+	/* Scratch block is left erased after a failed program too, erase of the programmed block is usually longer. */
+	start = hal_timer_ticks();
+	if (flash_erase(flash) != RESULT_OK) {
+		status = RESULT_FAIL;
+	}
+	results[BENCH_RESULT_ERASE_PROGRAMMED] = hal_timer_ticks() - start;
+
+	/* Time of a failed erase or program means nothing. */
+	if (status != RESULT_OK) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	response_ptr = &response[0];
+	for (i = 0; i < sizeof(results) / sizeof(results[0]); ++i) {
+		if (i != 0) {
+			*response_ptr++ = *com_str;
+		}
+		util_u32_to_hexasc(results[i], response_ptr);
+		response_ptr += CMD_32_SIZE;
+	}
+
+	hitagi_send_packet(answer_str, response);
+}
+
+/*
+ * Ticks of BENCH_READ_PASSES reads of BENCH_READ_SIZE bytes from src, width is 0 for bytes, 1 for halfwords, 2 for LDM.
+ */
+static u32 hitagi_bench_read(const u32 *src, u8 width) {
+	u32 i;
+	u32 pass;
+	u32 start;
+	const volatile u8 *src_u8 = (const volatile u8 *) src;
+	const volatile u16 *src_u16 = (const volatile u16 *) src;
+
+	start = hal_timer_ticks();
+
+	for (pass = 0; pass < BENCH_READ_PASSES; ++pass) {
+		if (width == 0) {
+			for (i = 0; i < BENCH_READ_SIZE; ++i) {
+				(void) src_u8[i];
+			}
+		} else if (width == 1) {
+			for (i = 0; i < BENCH_READ_SIZE / sizeof(u16); ++i) {
+				(void) src_u16[i];
 			}
+		} else {
+			hal_read_burst(src, BENCH_READ_SIZE);
 		}
+
+		watchdog_service();
 	}
 
-	/*
-	 * Update the address pointer to track where we are.
-	 * This eliminates the need for each BIN packet to be
-	 * preceded by and ADDR packet for large section of contiguius memory.
-	 */
-	received_address_ptr += (received_packet_size / 2);
+	return hal_timer_ticks() - start;
 }
 
-static void hitagi_command_ERASE(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
-	u8 response[MAX_READ_RESPONSE_SIZE];
+static void hitagi_command_RQDD(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 i;
+	u8 *ptr;
+	u16 size;
+	u32 capabilities;
+	volatile u16 *uid;
+	const FLASH_INFO_T *info = flash_ops->info;
+	u8 header[READ_RANGE_HEADER_SIZE];
+	HITAGI_TX_SEGMENT_T tx_segments[READ_RANGE_SEGMENTS];
+	u8 *descriptor = response_buffer;
 
-	UNUSED(answer_str);
 	UNUSED(data_ptr);
 	UNUSED(buffer_next_byte);
 
-	erase_cmdlet += 1;
+	capabilities = CAP_SCATTER_LISTS | CAP_DIRECT_BIN | CAP_PERF_COUNTERS | CAP_BENCH | CAP_JOURNAL | CAP_FILL | CAP_COPY;
+	capabilities |= CAP_FIND | CAP_READ_MODE;
+	if (flash_ops->imei_pr_offset != 0) {
+		capabilities |= CAP_IMEI;
+	}
+	if (flash_ops->cfi_command_set == FLASH_CFI_COMMAND_SET_AMD) {
+		capabilities |= CAP_FLASH_AMD;
+	}
+	if (flash_status != RESULT_OK) {
+		capabilities |= CAP_FLASH_DEFAULT;
+	}
+#if defined(FTR_TRACE)
+	capabilities |= CAP_TRACE;
+#endif
 
-	/* Comment out for compatibility with Motorola Flash Protocol. */
-	util_u16_to_hexasc(erase_cmdlet, response);
+	size = DESCRIPTOR_HEADER_SIZE + info->region_count * DESCRIPTOR_REGION_SIZE;
 
-	hitagi_send_ack(response);
-}
+	ptr = util_put_be(&descriptor[0], DESCRIPTOR_VERSION, 2);
+	ptr = util_put_be(ptr, size, 2);
+	/* Bootloader version on 0x1000000E, as in RQHW. */
+	ptr = util_put_be(ptr, *((volatile u16 *) FLASH_START_ADDRESS + 0x07), 2);
+	ptr = util_put_be(ptr, *NEPTUNE_REV_REG_ADDR, 2);
 
-static void hitagi_command_READ(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
-	u8 csum;
-	u16 size;
-	u32 start_addr;
-	u8 response[MAX_READ_RESPONSE_SIZE];
+	/* UID goes from the most significant word, the same order as in RQSN answer. */
+	for (uid = (NEPTUNE_REV_REG_ADDR - 1); uid >= NEPTUNE_UID_REG_ADDR; --uid) {
+		ptr = util_put_be(ptr, *uid, 2);
+	}
 
-	u8 *data_start_ptr;
-	u8 *data_end_ptr;
+	ptr = util_put_be(ptr, flash_get_part_id(FLASH_START_ADDRESS), 4);
+	ptr = util_put_be(ptr, capabilities, 4);
+	ptr = util_put_be(ptr, USB_MAX_PACKET_SIZE, 2);
+	ptr = util_put_be(ptr, USB_MAX_RX_DATA_SIZE, 2);
+	ptr = util_put_be(ptr, USB_RX_RING_SIZE, 2);
+	ptr = util_put_be(ptr, USB_TX_RING_PACKETS * USB_MAX_PACKET_SIZE, 2);
+	ptr = util_put_be(ptr, MAX_BIN_PACKET_SIZE, 2);
+	ptr = util_put_be(ptr, MAX_SEGMENTS, 1);
+	ptr = util_put_be(ptr, MAX_READ_RANGES, 1);
+	ptr = util_put_be(ptr, info->write_buffer_size, 2);
+	ptr = util_put_be(ptr, sizeof(FLASH_DATA_WIDTH), 1);
+	ptr = util_put_be(ptr, info->region_count, 1);
+
+	for (i = 0; i < info->region_count; ++i) {
+		ptr = util_put_be(ptr, info->regions[i].start, 4);
+		ptr = util_put_be(ptr, info->regions[i].end, 4);
+		ptr = util_put_be(ptr, info->regions[i].block_size, 4);
+	}
+
+	/* Answer is framed as READ one: 16-bit size, descriptor and 8-bit checksum. */
+	hitagi_read_range((u32) descriptor, size, header, tx_segments);
+
+	hitagi_send_segments(answer_str, tx_segments, READ_RANGE_SEGMENTS);
+}
+
+static void hitagi_command_RQJN(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u16 i;
 	u8 *response_ptr;
+	u8 *response = response_buffer;
 
 	UNUSED(buffer_next_byte);
 
-	csum = 0;
 	response_ptr = &response[0];
+	util_u32_to_hexasc(journal.last_block, response_ptr);
+	response_ptr += CMD_32_SIZE;
+	*response_ptr++ = *com_str;
+	util_u32_to_hexasc(journal.completed, response_ptr);
+	response_ptr += CMD_32_SIZE;
+	*response_ptr++ = *com_str;
+	util_u32_to_hexasc(JOURNAL_GRANULE_SIZE, response_ptr);
+	response_ptr += CMD_32_SIZE;
+	*response_ptr++ = *com_str;
+
+	for (i = 0; i < sizeof(journal.bitmap); ++i) {
+		util_u8_to_hexasc(journal.bitmap[i], response_ptr);
+		response_ptr += CMD_8_SIZE;
+	}
 
-	start_addr = util_hexasc_to_u32(&data_ptr[0], CMD_32_SIZE);
-	size = util_hexasc_to_u32(&data_ptr[CMD_32_SIZE + 1], CMD_16_SIZE);
+	/* New session starts from the clean journal, the answer still shows the previous one. */
+	if ((data_ptr != NULL) && util_data_equal(data_ptr, rst_str)) {
+		for (i = 0; i < sizeof(journal.bitmap); ++i) {
+			journal.bitmap[i] = 0;
+		}
+		journal.completed = 0;
+		journal.last_block = JOURNAL_NONE;
+#if defined(FTR_PCRAM_JOURNAL)
+		RTC_PCRAM14 = 0;
+#endif
+	}
 
-	data_start_ptr = (u8 *) start_addr;
-	data_end_ptr = data_start_ptr + size;
+	hitagi_send_packet(answer_str, response);
+}
 
-	if ((size) < 0x10) {
-		hitagi_send_error(ERR_DATA_INVALID);
-		return;
+/*
+ * Journal survives a lost USB link while the loader keeps running. With FTR_PCRAM_JOURNAL the last completed block
+ * is also restored from RTC PC RAM after a watchdog reset and the new upload of the loader, but the bitmap is not.
+ */
+static void hitagi_journal_init(void) {
+	journal.last_block = JOURNAL_NONE;
+#if defined(FTR_PCRAM_JOURNAL)
+	if (RTC_PCRAM14 == JOURNAL_PCRAM_MAGIC) {
+		journal.last_block = RTC_PCRAM15;
 	}
+#endif
+}
 
-	*((u16 *) response_ptr) = size;
-	response_ptr += 2;
-	csum += (size >> 8) & 0xFF;
-	csum += (size >> 0) & 0xFF;
-
-	while (data_start_ptr < data_end_ptr) {
-		u8 byte_data = *(data_start_ptr++);
-		csum += byte_data;
-		*(response_ptr++) = byte_data;
+/*
+ * Size and start of the erase block holding the address, zero size if address is out of flash regions.
+ */
+static u32 hitagi_journal_block(u32 addr, u32 *block_start) {
+	u8 i;
+	const FLASH_INFO_T *info = flash_ops->info;
 
-		watchdog_service();
+	for (i = 0; i < info->region_count; ++i) {
+		if ((addr >= info->regions[i].start) && (addr < info->regions[i].end)) {
+			*block_start = addr & ~(info->regions[i].block_size - 1);
+			return info->regions[i].block_size;
+		}
 	}
 
-	*response_ptr = csum;
-
-	/*
-	 * 2: 16-bit size header.
-	 * 1: 8-bit checksum.
-	 */
-	hitagi_send_bin_packet(answer_str, response, size + 2 + 1);
+	return 0;
 }
 
-static void hitagi_command_RQHW(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
-	u8 i;
-	u8 *response_ptr;
-	u16 bootloader_version;
-	u8 response[MAX_READ_RESPONSE_SIZE];
-
-	UNUSED(data_ptr);
-	UNUSED(buffer_next_byte);
+static void hitagi_journal_erase(u32 addr) {
+	u32 granule;
+	u32 block_size;
+	u32 block_start;
 
-	for (i = 0; i < 8 * 2; ++i) {
-		response[i] = 0x30;
+	block_size = hitagi_journal_block(addr, &block_start);
+	if (block_size == 0) {
+		return;
 	}
 
-	response_ptr = &response[12];
-	bootloader_version = *(FLASH_START_ADDRESS + 0x07); /* 0x0E offset (0x0E / 2) bootloader version on 0x1000000E. */
+	granule = (block_start - (u32) FLASH_START_ADDRESS) / JOURNAL_GRANULE_SIZE;
+	if (journal.bitmap[granule / 8] & (0x80 >> (granule % 8))) {
+		journal.completed--;
+	}
 
-	util_u16_to_hexasc(bootloader_version, response_ptr);
+	for (; block_size > 0; block_size -= JOURNAL_GRANULE_SIZE, ++granule) {
+		journal.bitmap[granule / 8] &= ~(0x80 >> (granule % 8));
+	}
 
-	hitagi_send_packet(answer_str, response);
+	/* Erased block is not the point to resume from any more. */
+	if (journal.last_block == block_start) {
+		journal.last_block = JOURNAL_NONE;
+#if defined(FTR_PCRAM_JOURNAL)
+		RTC_PCRAM14 = 0;
+#endif
+	}
 }
 
-static void hitagi_command_RQVN(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
-	u8 i;
-	u8 *response_ptr;
-	u16 bootloader_version;
-	u8 response[MAX_READ_RESPONSE_SIZE];
-
-	UNUSED(data_ptr);
-	UNUSED(buffer_next_byte);
+/*
+ * Block is complete when a program ends right on its upper boundary.
+ */
+static void hitagi_journal_program(u32 end_addr) {
+	u32 granule;
+	u32 block_size;
+	u32 block_start;
 
-	for (i = 0; i < ((8 * 2) * 2) + 1; ++i) {
-		response[i] = 0x30;
+	block_size = hitagi_journal_block(end_addr - 1, &block_start);
+	if ((block_size == 0) || (end_addr != block_start + block_size)) {
+		return;
 	}
 
-	bootloader_version = *(FLASH_START_ADDRESS + 0x07); /* 0x0E offset (0x0E / 2) bootloader version on 0x1000000E. */
-
-	response_ptr = &response[12];
-	util_u16_to_hexasc(bootloader_version, response_ptr);
-	response[16] = *com_str;
+	granule = (block_start - (u32) FLASH_START_ADDRESS) / JOURNAL_GRANULE_SIZE;
+	if (!(journal.bitmap[granule / 8] & (0x80 >> (granule % 8)))) {
+		journal.completed++;
+	}
 
-	/* Repeat bootloader version again. */
-	response_ptr = &response[29];
-	util_u16_to_hexasc(bootloader_version, response_ptr);
+	for (; block_size > 0; block_size -= JOURNAL_GRANULE_SIZE, ++granule) {
+		journal.bitmap[granule / 8] |= (0x80 >> (granule % 8));
+	}
 
-	hitagi_send_packet(answer_str, response);
+	journal.last_block = block_start;
+#if defined(FTR_PCRAM_JOURNAL)
+	RTC_PCRAM15 = block_start;
+	RTC_PCRAM14 = JOURNAL_PCRAM_MAGIC;
+#endif
 }
 
-static void hitagi_command_RQRC(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
-	u16 csum;
-	u8 *data_start_ptr;
-	u8 *data_end_ptr;
-	u8 *response_ptr;
-	u8 response[MAX_RESP_DATA_SIZE];
-	u32 start_addr;
-	u32 end_addr;
+#if !defined(FTR_COMPACT)
+static void hitagi_command_READ_MODE(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u16 length;
+	u32 cs_reg;
+	u32 cs_fast;
 
+	UNUSED(answer_str);
 	UNUSED(buffer_next_byte);
 
-	csum = 0;
-	response_ptr = &response[0];
+	length = (data_ptr != NULL) ? util_data_length(data_ptr) : 0;
+	if ((length != 0) && (length != READ_MODE_ENTRY_SIZE) && (length != READ_MODE_ENTRY_SIZE_CS)) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
 
-	start_addr = util_hexasc_to_u32(&data_ptr[0], CMD_32_SIZE);
-	end_addr = util_hexasc_to_u32(&data_ptr[CMD_32_SIZE + 1], CMD_32_SIZE);
+	cs_reg = 0;
+	cs_fast = 0;
+	if (length == READ_MODE_ENTRY_SIZE_CS) {
+		cs_reg = util_hexasc_to_u32(&data_ptr[READ_MODE_ENTRY_SIZE + 1], CMD_32_SIZE);
+		cs_fast = util_hexasc_to_u32(&data_ptr[READ_MODE_ENTRY_SIZE + 1 + CMD_32_SIZE + 1], CMD_32_SIZE);
+		/* Only chip-select control registers of the WEIM may be written, the host gives no arbitrary stores. */
+		if ((cs_reg < WEIM_CSCR_START) || (cs_reg >= WEIM_CSCR_END) || (cs_reg % sizeof(u32))) {
+			hitagi_send_error(ERR_DATA_INVALID);
+			return;
+		}
+	}
 
-	data_start_ptr = (u8 *) start_addr;
-	data_end_ptr = (u8 *) end_addr;
+	/* Old mode is left with its own settings, no arguments keep the flash asynchronous. */
+	READ_MODE_ASYNC();
+	read_mode.enabled = 0;
+
+	if (length != 0) {
+		read_mode.config_fast = util_hexasc_to_u32(&data_ptr[0], CMD_16_SIZE);
+		read_mode.config_async = util_hexasc_to_u32(&data_ptr[CMD_16_SIZE + 1], CMD_16_SIZE);
+		read_mode.cs_reg = cs_reg;
+		read_mode.cs_fast = cs_fast;
+		read_mode.enabled = 1;
+		READ_MODE_FAST();
+	}
 
-	if ((end_addr - start_addr) < 1) {
-		hitagi_send_error(ERR_DATA_INVALID);
+	hitagi_send_ack(NULL);
+}
+
+/*
+ * Fast mode is entered with the flash configuration first and the chip-select timing after it and is left in the
+ * reverse order, so array reads never go with the timing which does not match the chip. Writes are always async.
+ */
+void read_mode_switch(u8 fast) {
+	if (!read_mode.enabled || (read_mode.fast == fast)) {
 		return;
 	}
 
-	while (data_start_ptr <= data_end_ptr) {
-		csum += *data_start_ptr;
-		data_start_ptr++;
-		watchdog_service();
+	if (fast) {
+		flash_read_config(FLASH_START_ADDRESS, read_mode.config_fast);
+		if (read_mode.cs_reg != 0) {
+			read_mode.cs_async = hal_chip_select(read_mode.cs_reg, read_mode.cs_fast);
+		}
+	} else {
+		if (read_mode.cs_reg != 0) {
+			hal_chip_select(read_mode.cs_reg, read_mode.cs_async);
+		}
+		flash_read_config(FLASH_START_ADDRESS, read_mode.config_async);
 	}
 
-	util_u16_to_hexasc(csum, response_ptr);
-
-	hitagi_send_packet(answer_str, response);
+	read_mode.fast = fast;
 }
+#endif
 
-static void hitagi_command_RQSW(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
-	u8 *response_ptr;
-	u8 response[MAX_READ_RESPONSE_SIZE];
+#if defined(FTR_TRACE)
+static void hitagi_command_RQTR(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 response[MAX_RESP_DATA_SIZE];
 
-	UNUSED(data_ptr);
 	UNUSED(buffer_next_byte);
 
-	response_ptr = &response[0];
-	util_string_copy(response_ptr, (const u8 *) "Hitagi SW v1.0");
-	response_ptr = &response[14];
-	util_string_copy(response_ptr, scm_str); /* ":" is separator there. */
-	response_ptr = &response[15];
-	util_string_copy(response_ptr, (const u8 *) "Hitagi FLEX v1.0");
+	util_u32_to_hexasc((u32) trace_ring, &response[0]);
+	response[8] = *com_str;
+	util_u32_to_hexasc(trace_head, &response[9]);
+	response[17] = *com_str;
+	util_u16_to_hexasc(TRACE_RING_RECORDS, &response[18]);
+	response[22] = *com_str;
+	util_u16_to_hexasc(sizeof(HITAGI_TRACE_RECORD_T), &response[23]);
+	response[27] = *com_str;
+	util_u32_to_hexasc(HAL_TIMER_HZ, &response[28]);
+
+	/* Plain RQTR freezes the ring so the following READ gets consistent data, RESET clears it and goes on. */
+	if ((data_ptr != NULL) && util_data_equal(data_ptr, rst_str)) {
+		trace_head = 0;
+		trace_paused = 0;
+	} else {
+		trace_paused = 1;
+	}
 
 	hitagi_send_packet(answer_str, response);
 }
+#endif
 
-static void hitagi_command_RQSN(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
-	u8 *response_ptr;
-	u8 response[MAX_READ_RESPONSE_SIZE];
+static void hitagi_command_REGISTER(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u8 i;
+	int idx;
+	u16 length;
+	u16 name_length;
+	u32 addr;
+	u8 name[MAX_COMMAND_STR_SIZE];
+	u8 response[MAX_RESP_DATA_SIZE];
 
-	volatile u16 *i;
-	volatile u16 *start = NEPTUNE_UID_REG_ADDR;
-	volatile u16 *end = (NEPTUNE_REV_REG_ADDR - 1);
+	UNUSED(answer_str);
+	UNUSED(buffer_next_byte);
 
-	response_ptr = &response[0];
+	/* "NAME,AAAAAAAA", zero address removes the command. */
+	length = (data_ptr != NULL) ? util_data_length(data_ptr) : 0;
+	name_length = length - (1 + CMD_32_SIZE);
+	if (
+		(length <= (1 + CMD_32_SIZE)) || (name_length >= MAX_COMMAND_STR_SIZE) ||
+		(data_ptr[name_length] != *com_str)
+	) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
 
-	UNUSED(data_ptr);
-	UNUSED(buffer_next_byte);
+	for (i = 0; i < name_length; ++i) {
+		name[i] = data_ptr[i];
+	}
+	name[i] = NUL;
 
-	for (i = end; i >= start; --i) {
-		util_u16_to_hexasc(*i, response_ptr);
-		response_ptr += 4;
+	addr = util_hexasc_to_u32(&data_ptr[name_length + 1], CMD_32_SIZE);
+
+	/* Built-in commands are dispatched first, so they cannot be replaced. */
+	if (util_map_cmd(&cmd_tbl[0], sizeof(cmd_tbl) / sizeof(cmd_tbl[0]), name) >= 0) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
 	}
 
-	hitagi_send_packet(answer_str, response);
-}
+	idx = util_map_module(name);
 
-static void hitagi_command_RQFI(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
-	u32 flash_part_id;
-	u8 response[MAX_READ_RESPONSE_SIZE];
+	if (addr == 0) {
+		if (idx >= 0) {
+			module_count--;
+			util_string_copy(modules[idx].cmd, modules[module_count].cmd);
+			modules[idx].handler = modules[module_count].handler;
+		}
+	} else {
+		if (!util_module_entry(addr) || ((idx < 0) && (module_count >= MAX_MODULES))) {
+			hitagi_send_error(ERR_DATA_INVALID);
+			return;
+		}
 
-	UNUSED(data_ptr);
-	UNUSED(buffer_next_byte);
+		if (idx < 0) {
+			idx = module_count++;
+		}
 
-	flash_part_id = flash_get_part_id(FLASH_START_ADDRESS);
-	util_u32_to_hexasc(flash_part_id, response);
+		util_string_copy(modules[idx].cmd, name);
+		modules[idx].handler = (HITAGI_MODULE_HANDLER_T) addr;
+	}
 
-	hitagi_send_packet(answer_str, response);
+	util_u16_to_hexasc(module_count, response);
+
+	hitagi_send_ack(response);
 }
 
-static void hitagi_command_READ_OTP(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
-	u16 i;
-	u16 size;
-	u8 otp_reg_buffer[FLASH_MAX_OTP_SIZE];
-	u8 *response_ptr;
-	u8 response[MAX_READ_RESPONSE_SIZE];
+static void hitagi_command_CALL(const u8 *answer_str, const u8 *data_ptr, const u8 *buffer_next_byte) {
+	u32 addr;
+	u32 arg;
+	u32 result;
+	u8 response[MAX_RESP_DATA_SIZE];
 
-	UNUSED(data_ptr);
 	UNUSED(buffer_next_byte);
 
-	response_ptr = &response[0];
+	/* "AAAAAAAA,XXXXXXXX" kernel address and argument. */
+	if ((data_ptr == NULL) || (util_data_length(data_ptr) != (CMD_32_SIZE + 1 + CMD_32_SIZE))) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
+	}
 
-	flash_get_otp_zone(FLASH_START_ADDRESS, otp_reg_buffer, &size);
+	addr = util_hexasc_to_u32(&data_ptr[0], CMD_32_SIZE);
+	arg = util_hexasc_to_u32(&data_ptr[CMD_32_SIZE + 1], CMD_32_SIZE);
 
-	for (i = 0; i < size; ++i) {
-		util_u8_to_hexasc(otp_reg_buffer[i], response_ptr);
-		response_ptr += 2;
+	if (!util_module_entry(addr)) {
+		hitagi_send_error(ERR_DATA_INVALID);
+		return;
 	}
 
+	result = ((HITAGI_MODULE_CALL_T) addr)(&module_api, arg);
+
+	util_u32_to_hexasc(result, response);
+
 	hitagi_send_packet(answer_str, response);
 }
 
@@ -722,6 +2292,10 @@ static void hitagi_command_RESTART(const u8 *answer_str, const u8 *data_ptr, con
 	UNUSED(buffer_next_byte);
 
 	hitagi_send_ack(NULL);
+	usb_flush();
+
+	/* Boot code of the phone expects asynchronous flash reads. */
+	READ_MODE_ASYNC();
 
 	/* Is 1M of NOPs enough? */
 	nop(1024 * 1024);
@@ -735,6 +2309,9 @@ static void hitagi_command_POWER_DOWN(const u8 *answer_str, const u8 *data_ptr,
 	UNUSED(buffer_next_byte);
 
 	hitagi_send_ack(NULL);
+	usb_flush();
+
+	READ_MODE_ASYNC();
 
 	/* Is 1M of NOPs enough? */
 	nop(1024 * 1024);
@@ -743,126 +2320,110 @@ static void hitagi_command_POWER_DOWN(const u8 *answer_str, const u8 *data_ptr,
 }
 
 static void hitagi_commands(const u8 *cmd, const u8 *data, const u8 *next) {
+	u32 ticks;
 	int idx = util_map_cmd(&cmd_tbl[0], sizeof(cmd_tbl) / sizeof(cmd_tbl[0]), cmd);
 	if (idx >= 0 && cmd_tbl[idx].cmd_func) {
+		TRACE(TRACE_COMMAND, TRACE_BEGIN, trace_name(cmd, 0), trace_name(cmd, 4));
+		ticks = PERF_TICKS();
 		cmd_tbl[idx].cmd_func(cmd_tbl[idx].answer_str, data, next);
+#if !defined(FTR_COMPACT)
+		perf_commands[idx].ticks += PERF_TICKS() - ticks;
+		perf_commands[idx].count++;
+#else
+		UNUSED(ticks);
+#endif
+		TRACE(TRACE_COMMAND, TRACE_END, trace_name(cmd, 0), trace_name(cmd, 4));
+	} else if ((idx = util_map_module(cmd)) >= 0) {
+		TRACE(TRACE_COMMAND, TRACE_BEGIN, trace_name(cmd, 0), trace_name(cmd, 4));
+		modules[idx].handler(&module_api, cmd, data, next);
+		TRACE(TRACE_COMMAND, TRACE_END, trace_name(cmd, 0), trace_name(cmd, 4));
 	} else {
 		hitagi_send_error(ERR_UNKNOWN_COMMAND);
 	}
 }
 
 static void hitagi_send_packet(const u8 *cmd, const u8 *data) {
-	hitagi_send_packet_aux(cmd, data, 0);
-}
-
-static void hitagi_send_bin_packet(const u8 *cmd, const u8 *data, u16 bin_size) {
-	hitagi_send_packet_aux(cmd, data, bin_size);
-}
-
-static void hitagi_send_packet_aux(const u8 *cmd, const u8 *data, u16 bin_size) {
-	u16 i;
-	u16 j;
-	u16 size;
-	u8 *cmd_ptr;
-	u8 *response;
-	u8 empty_packet[] = { 0x00, 0x00 };
+	HITAGI_TX_SEGMENT_T segment;
 
-	i = 0;
-	j = 0;
-	size = bin_size;
+	if (data == NULL) {
+		hitagi_send_segments(cmd, NULL, 0);
+		return;
+	}
 
-	/* Save the original command on argument and set tx_data buffer as a response buffer. */
-	cmd_ptr  = (u8 *) cmd;
-	response = tx_data;
+	segment.ptr = data;
+	segment.size = util_string_length(data);
 
-	/* Attach the starting control/transmition character first. */
-	response[i++] = STX;
+	hitagi_send_segments(cmd, &segment, 1);
+}
 
-	/* Place command to the first answer section. */
-	while ((*cmd_ptr != NUL) && (i < (USB_MAX_TX_DATA_SIZE - 16))) {
-		response[i++] = *(cmd_ptr++);
-	}
+static u8 hitagi_send_stream(const u8 *src, u16 size, u8 fill) {
+	u8 *packet;
 
-	/* Check if any data is present. */
-	if (bin_size > 0) {
-		/* Place separator character because data is present. */
-		response[i++] = RS;
+	packet = usb_tx_acquire();
 
-		/* Place data to the answer. */
-		while ((size > 0) && (i < (USB_MAX_TX_DATA_SIZE - 16))) {
-			response[i++] = *(data++);
-			size--;
-		}
-	} else {
-		if (data != NULL) {
-			/* Place separator character because data is present. */
-			response[i++] = RS;
+	while (size--) {
+		packet[fill++] = *(src++);
 
-			/* Place data to the answer. */
-			while ((*data != NUL) && (i < (USB_MAX_TX_DATA_SIZE - 16))) {
-				response[i++] = *(data++);
-			}
+		/* Packet is full, send it out and take the next slot. */
+		if (fill == USB_MAX_PACKET_SIZE) {
+			usb_tx_commit(fill);
+			packet = usb_tx_acquire();
+			fill = 0;
 		}
 	}
 
-	/* Place the ending control/transmition character and terminate string. */
-	response[i++] = ETX;
-	response[i] = NUL;
+	return fill;
+}
 
-	/* Send full-fledged answer! */
-	while (i > 0) {
-		/* Big portion of Tx data. */
-		if (i >= USB_MAX_PACKET_SIZE) {
-			/* Send out Tx data and wait for it. */
-			while (usb_tx(&(response[j]), USB_MAX_PACKET_SIZE) != RESULT_OK);
+/*
+ * Send answer assembled from the list of (pointer, size) segments directly into the USB packets.
+ * Packet is framed as STX, command, RS and segments if any, ETX.
+ */
+static void hitagi_send_segments(const u8 *cmd, const HITAGI_TX_SEGMENT_T *tx_segments, u8 count) {
+	u8 i;
+	u8 fill;
 
-			/* Increment to the next data portion and decrement the data size. */
-			j += USB_MAX_PACKET_SIZE;
-			i -= USB_MAX_PACKET_SIZE;
+	/* Attach the starting control/transmition character and the command first. */
+	fill = hitagi_send_stream(&ctl_str[0], 1, 0);
+	fill = hitagi_send_stream(cmd, util_string_length(cmd), fill);
 
-			/* If we're sending data that is % USB_MAX_PACKET_SIZE, we must send an empty USB data packet. */
-			if (i == 0) {
-				while (usb_tx(&empty_packet[0], 0) != RESULT_OK);
-			}
-		} else {
-			/* Small portion of Tx data. */
-			while (usb_tx(&(response[j]), i) != RESULT_OK);
+	/* Place separator character because data is present. */
+	if (count > 0) {
+		fill = hitagi_send_stream(&ctl_str[1], 1, fill);
+	}
 
-			i = 0;
-		}
+	for (i = 0; i < count; ++i) {
+		fill = hitagi_send_stream(tx_segments[i].ptr, tx_segments[i].size, fill);
 	}
+
+	/* Place the ending control/transmition character. */
+	fill = hitagi_send_stream(&ctl_str[2], 1, fill);
+
+	/* If we're sending data that is % USB_MAX_PACKET_SIZE, we must send an empty USB data packet. */
+	usb_tx_commit(fill);
+
+	TRACE(TRACE_ANSWER, TRACE_INSTANT, trace_name(cmd, 0), trace_name(cmd, 4));
 }
 
 static void hitagi_send_ack(const u8 *data) {
-	/* ACK responce data. */
-	u8 response[MAX_ACK_RESPONSE_SIZE];
-	u8 *response_ptr;
-	u8 *command_ptr;
-	u8 *end_ptr;
-
-	response_ptr = response;
-	command_ptr = rx_command;
-	end_ptr = &(response_ptr[MAX_ACK_RESPONSE_SIZE - 1]);
+	u8 count;
+	HITAGI_TX_SEGMENT_T tx_segments[3];
 
-	/* Copy last command to ACK response. */
-	while ((*command_ptr != NUL) && (response_ptr != end_ptr)) {
-		*(response_ptr++) = *(command_ptr++);
-	}
+	/* Last command goes to ACK response. */
+	tx_segments[0].ptr = rx_command;
+	tx_segments[0].size = util_string_length(rx_command);
+	count = 1;
 
 	/* If there is data, add a comma, then the data. */
 	if (data) {
-		*(response_ptr++) = com_str[0];
-
-		/* Copy data into response. */
-		while ((*data != NUL) && (response_ptr != end_ptr)) {
-			*(response_ptr++) = *(data++);
-		}
+		tx_segments[1].ptr = com_str;
+		tx_segments[1].size = 1;
+		tx_segments[2].ptr = data;
+		tx_segments[2].size = util_string_length(data);
+		count = 3;
 	}
 
-	/* Terminate data. */
-	*response_ptr = NUL;
-
-	hitagi_send_packet(ack_str, response);
+	hitagi_send_segments(ack_str, tx_segments, count);
 }
 
 static void hitagi_send_error(u8 error_code) {
@@ -1051,16 +2612,13 @@ static void hitagi_read_packets(void) {
 }
 
 void hitagi_start(void) {
-	usb_init();
-	flash_init();
+	hal_usb_init();
+	hal_timer_init();
+	flash_status = flash_init();
 	watchdog_init();
+#if !defined(FTR_COMPACT)
+	hitagi_journal_init();
+#endif
 
 	hitagi_read_packets();
 }
-
-void __attribute__((naked, section(".startup"))) _start(void) {
-	asm volatile (
-		"bl hitagi_start\n"
-		"b .\n"
-	);
-}
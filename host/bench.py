@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+#
+# About:
+#   Throughput benchmark of Hitagi over simulated sessions on the host build.
+#   Every session is a stream of protocol requests fed to `hitagi_host`, numbers come from its statistics.
+#
+# Author:
+#   EXL
+#
+# License:
+#   MIT
+#
+# Usage:
+#   bench.py [--host ./hitagi_host] [--flash intel] [--size 0x40000] [--bandwidth 1000000] [--latency 1000]
+#     [--json bench.json] [--baseline old.json] [--threshold 5] [--filter flash_]
+#
+
+import argparse
+import json
+import random
+import subprocess
+import sys
+
+STX = b'\x02'
+ETX = b'\x03'
+RS = b'\x1E'
+
+RAM_ADDRESS = 0x12000000
+FLASH_ADDRESS = 0x10100000
+FLASH_START = 0x10000000
+BIN_CHUNK = 0x2000
+
+def mfp_cmd(command, data=b''):
+	return STX + command.encode() + ((RS + data) if data else b'') + ETX
+
+def mfp_bin(payload):
+	size = len(payload).to_bytes(2, 'big')
+	return STX + b'BIN' + RS + size + payload + bytes([sum(size + payload) & 0xFF]) + ETX
+
+def mfp_upload(address, image):
+	requests = mfp_cmd('ADDR', f'{address:08X}'.encode())
+	for offset in range(0, len(image), BIN_CHUNK):
+		requests += mfp_bin(image[offset:offset + BIN_CHUNK])
+	return requests
+
+# Mostly erased image with sparse data islands, as a typical language pack or user data area.
+def image_ff(size, rng):
+	image = bytearray(b'\xFF' * size)
+	for offset in range(0, size, 0x1000):
+		if rng.random() < 0.1:
+			length = rng.randrange(0x10, 0x400)
+			image[offset:offset + length] = rng.randbytes(length)
+	return bytes(image)
+
+# ARM code-like image: 32-bit words from a small set of conditional opcodes, literal pools and zero padding.
+def image_code(size, rng):
+	opcodes = [0xE1A00000, 0xE3A00000, 0xE5900000, 0xE5800000, 0xE92D4000, 0xE8BD8000, 0xEB000000, 0xE12FFF1E]
+	pool = [rng.getrandbits(32) for _ in range(64)]
+	words = []
+	while len(words) * 4 < size:
+		kind = rng.random()
+		if kind < 0.75:
+			words.append(rng.choice(opcodes) | rng.getrandbits(12) | (rng.getrandbits(4) << 12))
+		elif kind < 0.9:
+			words.append(rng.choice(pool))
+		else:
+			words.extend([0] * rng.randrange(1, 8))
+	return b''.join(word.to_bytes(4, 'big') for word in words)[:size]
+
+def image_random(size, rng):
+	return rng.randbytes(size)
+
+IMAGES = {
+	'ff': image_ff,
+	'code': image_code,
+	'random': image_random,
+}
+
+FLASH_MODES = {
+	'flash_block': 1,
+	'flash_buffer': 2,
+	'flash_erase': 3,
+}
+
+def sessions(size):
+	result = []
+	rng = random.Random(0x48495441)
+
+	images = {name: build(size, rng) for name, build in IMAGES.items()}
+
+	for name, image in images.items():
+		result.append((f'ram_upload_{name}', len(image), mfp_upload(RAM_ADDRESS, image)))
+
+	for mode, erases in FLASH_MODES.items():
+		for name, image in images.items():
+			requests = mfp_cmd('ERASE') * erases + mfp_upload(FLASH_ADDRESS, image)
+			result.append((f'{mode}_{name}', len(image), requests))
+
+	for chunk in (0x40, 0x100, 0x400):
+		requests = b''.join(
+			mfp_cmd('READ', f'{FLASH_START + offset:08X},{chunk:04X}'.encode()) for offset in range(0, size, chunk)
+		)
+		result.append((f'read_{chunk:04x}', size, requests))
+
+	for span in (0x1000, 0x10000, 0x100000):
+		count = max(1, 0x100000 // span)
+		requests = b''.join(
+			mfp_cmd('RQRC', f'{FLASH_START + i * span:08X},{FLASH_START + (i + 1) * span - 1:08X}'.encode())
+			for i in range(count)
+		)
+		result.append((f'rqrc_{span:06x}', count * span, requests))
+
+	result.append(('read_otp', 0, mfp_cmd('READ_OTP') * 16))
+
+	return result
+
+def run(args, name, payload, requests):
+	command = [args.host, '-f', args.flash, '-t', args.timing, '-b', str(args.bandwidth), '-l', str(args.latency), '-s']
+	process = subprocess.run(command, input=requests, capture_output=True)
+	if process.returncode != 0:
+		raise RuntimeError(f'{name}: {args.host} failed with code {process.returncode}')
+
+	stats = {}
+	for line in process.stderr.decode().splitlines():
+		key, sep, value = line.partition(':')
+		if sep and key.strip().isidentifier():
+			value = value.strip()
+			try:
+				stats[key.strip()] = float(value) if '.' in value else int(value)
+			except ValueError:
+				stats[key.strip()] = value
+
+	seconds = stats['modeled_seconds']
+	answer = process.stdout
+
+	# Sessions without upload or dump payload are measured by the size of their answers.
+	if payload == 0:
+		payload = len(answer)
+
+	return {
+		'session': name,
+		'payload_bytes': payload,
+		'requests': stats['usb_requests'],
+		'errors': answer.count(STX + b'ERR' + RS),
+		'modeled_seconds': seconds,
+		'kbps': (payload / 1024 / seconds) if (payload and seconds) else 0.0,
+		'mmio_per_byte': (stats['mmio_operations'] / payload) if payload else float(stats['mmio_operations']),
+		'usb_seconds': stats['link_wait_seconds'],
+		'cpu_seconds': stats['cpu_seconds'],
+		'flash_seconds': stats['flash_wait_seconds'],
+		'flash_busy_seconds': stats['flash_busy_seconds'],
+		'flash_erased': stats['flash_erased'],
+		'flash_program_ops': stats['flash_program_ops'],
+		'usb_rx_bytes': stats['usb_rx_bytes'],
+		'usb_tx_bytes': stats['usb_tx_bytes'],
+	}
+
+def share(part, total):
+	return 100.0 * part / total if total else 0.0
+
+def report(results):
+	print(f'{"session":<22} {"payload":>9} {"seconds":>10} {"KB/s":>10} {"mmio/B":>8} {"usb%":>6} {"cpu%":>6} {"flash%":>6} {"err":>4}')
+	for r in results:
+		total = r['modeled_seconds']
+		print(
+			f'{r["session"]:<22} {r["payload_bytes"]:>9} {total:>10.4f} {r["kbps"]:>10.1f} {r["mmio_per_byte"]:>8.2f} '
+			f'{share(r["usb_seconds"], total):>6.1f} {share(r["cpu_seconds"], total):>6.1f} '
+			f'{share(r["flash_seconds"], total):>6.1f} {r["errors"]:>4}'
+		)
+
+# Sessions which got slower than the baseline by more than the threshold, in percents of modeled time.
+def compare(results, baseline_path, threshold):
+	with open(baseline_path, 'r') as f:
+		baseline = {r['session']: r for r in json.load(f)['sessions']}
+
+	regressions = 0
+	for r in results:
+		old = baseline.get(r['session'])
+		if old is None or old['modeled_seconds'] == 0:
+			continue
+		delta = 100.0 * (r['modeled_seconds'] - old['modeled_seconds']) / old['modeled_seconds']
+		if delta > threshold:
+			print(f'REGRESSION {r["session"]}: {old["modeled_seconds"]:.4f} -> {r["modeled_seconds"]:.4f} s ({delta:+.1f}%)')
+			regressions += 1
+		elif delta < -threshold:
+			print(f'IMPROVEMENT {r["session"]}: {old["modeled_seconds"]:.4f} -> {r["modeled_seconds"]:.4f} s ({delta:+.1f}%)')
+
+	return regressions
+
+def main():
+	parser = argparse.ArgumentParser(description='Hitagi throughput benchmark over simulated sessions.')
+	parser.add_argument('--host', default='./hitagi_host', help='host build runner')
+	parser.add_argument('--flash', default='intel', help='flash chip model, intel or amd')
+	parser.add_argument('--timing', default='typ', help='program and erase times, none, typ or max')
+	parser.add_argument('--size', default=0x40000, type=lambda x: int(x, 0), help='image and dump size in bytes')
+	parser.add_argument('--bandwidth', default=1000000, type=int, help='USB link bandwidth in bytes per second')
+	parser.add_argument('--latency', default=1000, type=int, help='USB link latency in microseconds')
+	parser.add_argument('--filter', default='', help='run only sessions with names containing this string')
+	parser.add_argument('--json', help='write results to JSON file')
+	parser.add_argument('--baseline', help='compare with results from an earlier JSON file')
+	parser.add_argument('--threshold', default=5.0, type=float, help='regression threshold in percents')
+	args = parser.parse_args()
+
+	results = []
+	for name, payload, requests in sessions(args.size):
+		if args.filter in name:
+			results.append(run(args, name, payload, requests))
+
+	report(results)
+
+	if args.json:
+		with open(args.json, 'w') as f:
+			json.dump({
+				'flash': args.flash,
+				'timing': args.timing,
+				'size': args.size,
+				'bandwidth': args.bandwidth,
+				'latency_us': args.latency,
+				'sessions': results,
+			}, f, indent='\t')
+
+	failed = sum(1 for r in results if r['errors'])
+	if args.baseline:
+		failed += compare(results, args.baseline, args.threshold)
+
+	return 1 if failed else 0
+
+if __name__ == '__main__':
+	sys.exit(main())
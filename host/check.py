@@ -0,0 +1,368 @@
+#!/usr/bin/env python3
+#
+# About:
+#   Request/answer check of Hitagi commands on the host build.
+#   Every flash chip model gets one session of requests, decoded answers are compared with the expected ones.
+#
+# Author:
+#   EXL
+#
+# License:
+#   MIT
+#
+# Usage:
+#   check.py [--host ./hitagi_host] [--flash intel,amd] [--modules modules]
+#
+# Notes:
+#   1. Modules are the host builds of modules/checksum.bin and modules/blank.bin, `make PLATFORM=HOST modules`.
+#   2. Answers of `READ`, `READ_LIST` and `RQDD` are binary, they are split by their 16-bit sizes, not by ETX.
+#   3. `ADDR` answer echoes the request buffer up to its end, ETX included, so only its address part is checked.
+#
+
+import argparse
+import os
+import random
+import struct
+import subprocess
+import sys
+
+import bench
+
+ERR_UNKNOWN_COMMAND = 0x85
+ERR_DATA_INVALID = 0x8B
+
+CAP_SCATTER_LISTS = 1 << 0
+CAP_BENCH = 1 << 3
+CAP_JOURNAL = 1 << 5
+CAP_FILL = 1 << 6
+CAP_COPY = 1 << 7
+CAP_FIND = 1 << 8
+CAP_IMEI = 1 << 9
+CAP_READ_MODE = 1 << 10
+CAP_FLASH_AMD = 1 << 11
+CAP_FLASH_DEFAULT = 1 << 12
+
+BENCH_RESULTS = 15
+JOURNAL_NONE = 0xFFFFFFFF
+
+RAM = 0x12000000
+CHECKSUM_MODULE = 0x12010000
+BLANK_MODULE = 0x12011000
+SCRATCH = 0x10100000
+SCRATCH_SIZE = 0x20000
+COPY_TARGET = 0x10140000
+
+BINARY_ANSWERS = (b'READ', b'READ_LIST', b'RSDD')
+
+def hex_fields(data):
+	return [int(field, 16) for field in data.decode().split(',')]
+
+def ack(data):
+	return (b'ACK', data)
+
+def err(code):
+	return (b'ERR', bytes([code]))
+
+def addr(address):
+	request = bench.mfp_cmd('ADDR', f'{address:08X}'.encode())
+	echo = f'ADDR,{address:08X}'.encode()
+	return request, lambda answer: None if answer[0] == b'ACK' and answer[1].startswith(echo) else 'no ADDR echo'
+
+# Every answer is (name, data), data of binary answers is a list of payloads with checked checksums.
+def answers(output):
+	result = []
+	position = 0
+	while position < len(output):
+		if output[position:position + 1] != bench.STX:
+			raise ValueError(f'no STX at {position}')
+
+		end = position + 1
+		while output[end:end + 1] not in (bench.RS, bench.ETX):
+			end += 1
+		name = output[position + 1:end]
+		if output[end:end + 1] == bench.ETX:
+			result.append((name, b''))
+			position = end + 1
+			continue
+
+		position = end + 1
+		if name in BINARY_ANSWERS:
+			# Size MSB may be ETX too, so the answer ends at ETX followed by the next answer only.
+			payloads = []
+			while True:
+				size = int.from_bytes(output[position:position + 2], 'big')
+				payload = output[position + 2:position + 2 + size]
+				if sum(output[position:position + 2 + size]) & 0xFF != output[position + 2 + size]:
+					raise ValueError(f'bad {name.decode()} checksum at {position}')
+				payloads.append(payload)
+				position += 2 + size + 1
+				if output[position:position + 1] == bench.ETX and output[position + 1:position + 2] in (bench.STX, b''):
+					break
+			result.append((name, payloads))
+			position += 1
+		else:
+			end = output.index(bench.ETX, position)
+			while output[end + 1:end + 2] not in (bench.STX, b''):
+				end = output.index(bench.ETX, end + 1)
+			result.append((name, output[position:end]))
+			position = end + 1
+
+	return result
+
+def read(address, size):
+	return bench.mfp_cmd('READ', f'{address:08X},{size:04X}'.encode())
+
+def module(path):
+	with open(path, 'rb') as f:
+		blob = f.read()
+	# BIN packets are whole words of the flash bus.
+	return blob + b'\x00' * (len(blob) % 2)
+
+class Session:
+	def __init__(self, flash):
+		self.flash = flash
+		self.steps = []
+
+	# Expected answer is a (name, data) tuple or a function of the answer returning the failure text or None.
+	def expect(self, label, request, expected):
+		self.steps.append((label, request, expected))
+
+	def run(self, host):
+		requests = b''.join(request for _, request, _ in self.steps)
+		process = subprocess.run([host, '-f', self.flash, '-t', 'none'], input=requests, capture_output=True, timeout=120)
+		if process.returncode != 0:
+			return [f'{host} failed with code {process.returncode}']
+
+		got = answers(process.stdout)
+		if len(got) != len(self.steps):
+			return [f'{len(got)} answers to {len(self.steps)} requests']
+
+		failures = []
+		for (label, _, expected), answer in zip(self.steps, got):
+			if callable(expected):
+				failure = expected(answer)
+			else:
+				failure = None if answer == expected else f'expected {expected!r}'
+			if failure:
+				failures.append(f'{label}: {failure}, got {answer!r}')
+
+		return failures
+
+def lists(session, rng):
+	data = rng.randbytes(0x30)
+
+	session.expect('ADDR_LIST without data', bench.mfp_cmd('ADDR_LIST'), err(ERR_DATA_INVALID))
+	session.expect('READ_LIST without data', bench.mfp_cmd('READ_LIST'), err(ERR_DATA_INVALID))
+
+	segments = b'12000000,00000010,12000100,00000008,12000208,00000018'
+	session.expect('ADDR_LIST', bench.mfp_cmd('ADDR_LIST', segments), ack(b'ADDR_LIST,0003'))
+	session.expect('BIN over ADDR_LIST', bench.mfp_bin(data[:0x20]), ack(b'BIN'))
+	session.expect('BIN past ADDR_LIST', bench.mfp_bin(data[0x20:] + bytes(2)), err(ERR_DATA_INVALID))
+	session.expect('BIN to the end of ADDR_LIST', bench.mfp_bin(data[0x20:0x30]), ack(b'BIN'))
+
+	ranges = b'12000000,0010,12000100,0008,12000208,0018'
+	expected = [data[0x00:0x10], data[0x10:0x18], data[0x18:0x30]]
+	session.expect('READ_LIST', bench.mfp_cmd('READ_LIST', ranges), (b'READ_LIST', expected))
+
+def ram(session, rng):
+	data = rng.randbytes(0x400)
+	pattern = b'HITAGI'
+
+	for offset in (0x10, 0x1FB, 0x300):
+		data = data[:offset] + pattern + data[offset + len(pattern):]
+
+	session.expect('FILL without data', bench.mfp_cmd('FILL'), err(ERR_DATA_INVALID))
+	session.expect('FILL 16-bit', bench.mfp_cmd('FILL', b'12000402,0000004A,A55A'), ack(b'FILL'))
+	session.expect('FILL 16-bit result', read(RAM + 0x400, 0x50),
+		(b'READ', [bytes(2) + bytes.fromhex('A55A') * 0x25 + bytes(4)]))
+	session.expect('FILL 32-bit', bench.mfp_cmd('FILL', b'12000500,00000020,11223344'), ack(b'FILL'))
+	session.expect('FILL 32-bit result', read(RAM + 0x500, 0x20), (b'READ', [bytes.fromhex('11223344') * 8]))
+
+	session.expect('BIN to RAM', *addr(RAM + 0x1000))
+	session.expect('BIN data', bench.mfp_bin(data), ack(b'BIN'))
+
+	session.expect('COPY without data', bench.mfp_cmd('COPY'), err(ERR_DATA_INVALID))
+	session.expect('COPY forward', bench.mfp_cmd('COPY', b'12001000,12001100,00000300'), ack(b'COPY'))
+	session.expect('COPY forward result', read(RAM + 0x1100, 0x300), (b'READ', [data[:0x300]]))
+	session.expect('COPY back', bench.mfp_cmd('COPY', b'12001100,12001000,00000300'), ack(b'COPY'))
+	session.expect('COPY back result', read(RAM + 0x1000, 0x400), (b'READ', [data[:0x300] + data[0x200:0x300]]))
+
+	session.expect('FIND without data', bench.mfp_cmd('FIND'), err(ERR_DATA_INVALID))
+	# Pattern at 0x300 was overwritten by the tail of the forward copy.
+	found = [RAM + 0x1000 + 0x10, RAM + 0x1000 + 0x1FB]
+	session.expect('FIND', bench.mfp_cmd('FIND', b'12001000,00000300,10,' + pattern.hex().upper().encode()),
+		(b'FIND', ','.join(['02'] + [f'{a:08X}' for a in found]).encode()))
+	session.expect('FIND limit', bench.mfp_cmd('FIND', b'12001000,00000300,01,' + pattern.hex().upper().encode()),
+		(b'FIND', f'01,{found[0]:08X}'.encode()))
+	# Mask drops the letter case bit.
+	masked = pattern.lower().hex().upper().encode() + b',' + b'DF' * len(pattern)
+	session.expect('FIND mask', bench.mfp_cmd('FIND', b'12001000,00000300,10,' + masked),
+		(b'FIND', ','.join(['02'] + [f'{a:08X}' for a in found]).encode()))
+
+def descriptor(session):
+	def check(answer):
+		name, payloads = answer
+		if name != b'RSDD' or len(payloads) != 1:
+			return 'no descriptor'
+		raw = payloads[0]
+		version, size = struct.unpack_from('>HH', raw, 0x00)
+		caps = struct.unpack_from('>I', raw, 0x1C)[0]
+		width, regions = struct.unpack_from('>BB', raw, 0x2E)
+		if version != 1 or size != len(raw) or size != 0x30 + regions * 12:
+			return f'version {version} size {size} regions {regions}'
+		wanted = CAP_SCATTER_LISTS | CAP_BENCH | CAP_JOURNAL | CAP_FILL | CAP_COPY | CAP_FIND | CAP_READ_MODE
+		if (caps & wanted) != wanted or caps & CAP_FLASH_DEFAULT:
+			return f'capabilities {caps:08X}'
+		if bool(caps & CAP_FLASH_AMD) != session.flash.startswith('amd'):
+			return f'CAP_FLASH_AMD of {session.flash} chip'
+		if bool(caps & CAP_IMEI) != session.flash.startswith('intel'):
+			return f'CAP_IMEI of {session.flash} chip'
+		session.width = width
+		return None
+
+	session.expect('RQDD', bench.mfp_cmd('RQDD'), check)
+
+def imei(session):
+	def check(answer):
+		name, data = answer
+		if not session.flash.startswith('intel'):
+			return None if answer == err(ERR_UNKNOWN_COMMAND) else 'AMD-like chip has no IMEI record'
+		if name != b'READ_IMEI':
+			return 'no IMEI'
+		digits, raw, uid = data.decode().split(',')
+		record = [int(raw[i:i + 4], 16) for i in range(0, 16, 4)]
+		words = [int(uid[i:i + 4], 16) for i in range(0, 32, 4)]
+		expected = ''
+		luhn = 0
+		for i in range(14):
+			digit = ((record[i // 4] ^ words[i // 4]) >> (((i % 4) ^ 2) * 4)) & 0x0F
+			expected += f'{digit:X}'
+			if i % 2:
+				digit = digit * 2 - 9 if digit * 2 > 9 else digit * 2
+			luhn += digit
+		expected += str((10 - luhn % 10) % 10)
+		return None if digits == expected else f'expected digits {expected}'
+
+	session.expect('READ_IMEI', bench.mfp_cmd('READ_IMEI'), check)
+
+def modules(session, path):
+	checksum = module(os.path.join(path, 'checksum.bin'))
+	blank = module(os.path.join(path, 'blank.bin'))
+
+	session.expect('checksum module', *addr(CHECKSUM_MODULE))
+	session.expect('checksum module data', bench.mfp_bin(checksum), ack(b'BIN'))
+	session.expect('blank module', *addr(BLANK_MODULE))
+	session.expect('blank module data', bench.mfp_bin(blank), ack(b'BIN'))
+
+	session.expect('REGISTER without data', bench.mfp_cmd('REGISTER'), err(ERR_DATA_INVALID))
+	session.expect('REGISTER built-in', bench.mfp_cmd('REGISTER', f'RQRC,{CHECKSUM_MODULE:08X}'.encode()),
+		err(ERR_DATA_INVALID))
+	session.expect('REGISTER outside RAM', bench.mfp_cmd('REGISTER', b'RQXX,10000000'), err(ERR_DATA_INVALID))
+	session.expect('REGISTER', bench.mfp_cmd('REGISTER', f'RQXX,{CHECKSUM_MODULE:08X}'.encode()), ack(b'REGISTER,0001'))
+
+	# Odd start and end of the range go through the head and tail bytes of the module.
+	summed = f'{BLANK_MODULE + 1:08X},{BLANK_MODULE + len(blank) - 2:08X}'.encode()
+	checksum = (b'RSRC', f'{sum(blank[1:-1]) & 0xFFFF:04X}'.encode())
+	session.expect('registered command', bench.mfp_cmd('RQXX', summed), checksum)
+	session.expect('RQRC of the same range', bench.mfp_cmd('RQRC', summed), checksum)
+	session.expect('REGISTER removal', bench.mfp_cmd('REGISTER', b'RQXX,00000000'), ack(b'REGISTER,0000'))
+	session.expect('removed command', bench.mfp_cmd('RQXX', summed), err(ERR_UNKNOWN_COMMAND))
+
+	session.expect('CALL without data', bench.mfp_cmd('CALL'), err(ERR_DATA_INVALID))
+	session.expect('CALL outside RAM', bench.mfp_cmd('CALL', b'10000000,00000000'), err(ERR_DATA_INVALID))
+
+def call_blank(session, label, address, programmed):
+	def check(answer):
+		expected = programmed(session.width) if callable(programmed) else programmed
+		return None if answer == (b'CALL', f'{expected:08X}'.encode()) else f'expected {expected:08X} words'
+
+	session.expect(label, bench.mfp_cmd('CALL', f'{BLANK_MODULE:08X},{address:08X}'.encode()), check)
+
+def journal(session, label, last, completed, granules):
+	def check(answer):
+		name, data = answer
+		if name != b'RSJN':
+			return 'no journal'
+		fields = data.decode().split(',')
+		granule = int(fields[2], 16)
+		bitmap = bytes.fromhex(fields[3])
+		bits = [i for i in range(len(bitmap) * 8) if bitmap[i // 8] & (0x80 >> (i % 8))]
+		expected = [(address - 0x10000000) // granule for address in granules(granule)]
+		if [int(fields[0], 16), int(fields[1], 16)] != [last, completed] or bits != expected:
+			return f'expected {last:08X},{completed:08X} and granules {expected}'
+		return None
+
+	session.expect(label, bench.mfp_cmd('RQJN'), check)
+
+def flash(session, rng):
+	data = rng.randbytes(0x100)
+
+	# Source of COPY to flash, BIN goes to RAM only with ERASE mode off.
+	session.expect('BIN to RAM', *addr(RAM + 0x2000))
+	session.expect('BIN data', bench.mfp_bin(data), ack(b'BIN'))
+
+	session.expect('BENCH without ERASE', bench.mfp_cmd('BENCH', f'{SCRATCH:08X},0400'.encode()),
+		err(ERR_DATA_INVALID))
+	session.expect('ERASE', bench.mfp_cmd('ERASE'), ack(b'ERASE,0001'))
+	session.expect('ERASE buffer mode', bench.mfp_cmd('ERASE'), ack(b'ERASE,0002'))
+	session.expect('RQJN reset', bench.mfp_cmd('RQJN', b'RESET'),
+		lambda answer: None if answer[0] == b'RSJN' else 'no journal')
+
+	call_blank(session, 'blank block', SCRATCH, 0)
+	session.expect('FILL block', bench.mfp_cmd('FILL', f'{SCRATCH:08X},{SCRATCH_SIZE:08X},1234'.encode()), ack(b'FILL'))
+	journal(session, 'RQJN after FILL', SCRATCH, 1, lambda granule: range(SCRATCH, SCRATCH + SCRATCH_SIZE, granule))
+	call_blank(session, 'filled block', SCRATCH, lambda width: SCRATCH_SIZE // width)
+	session.expect('FIND in flash', bench.mfp_cmd('FIND', f'{SCRATCH:08X},00000008,10,1234'.encode()),
+		(b'FIND', f'04,{SCRATCH:08X},{SCRATCH + 2:08X},{SCRATCH + 4:08X},{SCRATCH + 6:08X}'.encode()))
+
+	session.expect('COPY to flash', bench.mfp_cmd('COPY', f'12002000,{COPY_TARGET:08X},00000100'.encode()), ack(b'COPY'))
+	session.expect('COPY to flash result', read(COPY_TARGET, 0x100), (b'READ', [data]))
+	copied = f'{COPY_TARGET:08X},{COPY_TARGET + 0x20000:08X},00000100'.encode()
+	session.expect('COPY in flash', bench.mfp_cmd('COPY', copied), ack(b'COPY'))
+	session.expect('COPY in flash result', read(COPY_TARGET + 0x20000, 0x100), (b'READ', [data]))
+
+	def results(answer):
+		name, data = answer
+		if name != b'BENCH' or len(hex_fields(data)) != BENCH_RESULTS:
+			return f'expected {BENCH_RESULTS} results'
+		return None
+
+	session.expect('BENCH without data', bench.mfp_cmd('BENCH'), err(ERR_DATA_INVALID))
+	session.expect('BENCH', bench.mfp_cmd('BENCH', f'{SCRATCH:08X},0400'.encode()), results)
+	journal(session, 'RQJN after BENCH', JOURNAL_NONE, 0, lambda granule: [])
+	call_blank(session, 'block after BENCH', SCRATCH, 0)
+
+def sessions(flashes, path):
+	result = []
+	for chip in flashes:
+		rng = random.Random(0x48495441)
+		session = Session(chip)
+		session.width = 2
+		lists(session, rng)
+		ram(session, rng)
+		descriptor(session)
+		imei(session)
+		modules(session, path)
+		flash(session, rng)
+		result.append(session)
+	return result
+
+def main():
+	parser = argparse.ArgumentParser(description='Hitagi request/answer check on the host build.')
+	parser.add_argument('--host', default='./hitagi_host', help='host build runner')
+	parser.add_argument('--flash', default='intel,amd', help='comma-separated flash chip models, intel or amd')
+	parser.add_argument('--modules', default='modules', help='directory of the host module builds')
+	args = parser.parse_args()
+
+	failed = 0
+	for session in sessions(args.flash.split(','), args.modules):
+		failures = session.run(args.host)
+		for failure in failures:
+			print(f'FAIL {session.flash} {failure}')
+		print(f'{session.flash}: {len(session.steps) - len(failures)}/{len(session.steps)} ok')
+		failed += len(failures)
+
+	return 1 if failed else 0
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,259 @@
+/*
+ * About:
+ *   Hitagi emulator, serves the flash protocol of the host build over a pseudo-terminal or a Unix socket.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ *
+ * Usage:
+ *   hitagi_emu [-p pty_link | -u socket_path] [-f intel|amd] [-t none|typ|max] [-b bytes_per_second]
+ *     [-l latency_us] [-v] [-m flash.bin] [-i flash_in.bin] [-o flash_out.bin] [-s]
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "../hal.h"
+
+#include "hal_host.h"
+
+#ifndef HOST_FLASH_MODEL
+#define HOST_FLASH_MODEL               "intel"
+#endif
+
+/**
+ * Functions.
+ */
+
+static void usage(const char *name);
+static int emu_pty_open(const char *link_path);
+static int emu_socket_open(const char *path);
+static void emu_cleanup(void);
+static void emu_signal(int signal_number);
+
+/**
+ * Globals.
+ */
+
+static const char *emu_socket_path;
+static const char *emu_pty_link;
+static int emu_pty_slave = -1;
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-p pty_link | -u socket_path] [-f intel|amd] [-t none|typ|max] [-b bytes_per_second]\n", name);
+	fprintf(stderr, "         [-l latency_us] [-v] [-m flash.bin] [-i flash_in.bin] [-o flash_out.bin] [-s]\n");
+	fprintf(stderr, "  Protocol is served on a new pseudo-terminal, its name is printed to stdout.\n");
+	fprintf(stderr, "  -p  also create a symlink to the pseudo-terminal.\n");
+	fprintf(stderr, "  -u  listen on a Unix socket instead, one client at a time.\n");
+	fprintf(stderr, "  -f  flash chip model, default is '%s'.\n", HOST_FLASH_MODEL);
+	fprintf(stderr, "  -t  program and erase times, datasheet typical (default), maximum or none.\n");
+	fprintf(stderr, "  -b  USB link bandwidth in bytes per second, default is unlimited.\n");
+	fprintf(stderr, "  -l  USB link latency in microseconds, default is 0.\n");
+	fprintf(stderr, "  -v  run on the virtual clock only, do not keep it in step with the wall clock.\n");
+	fprintf(stderr, "  -m  map flash image file, all changes are written to it.\n");
+	fprintf(stderr, "  -i  load flash image before start.\n");
+	fprintf(stderr, "  -o  save flash image on exit.\n");
+	fprintf(stderr, "  -s  print statistics to stderr on exit.\n");
+}
+
+/* Slave side is kept open by the emulator, so the master does not see hangups between clients. */
+static int emu_pty_open(const char *link_path) {
+	int master;
+	const char *slave_name;
+	struct termios tio;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0)) {
+		perror("emu: cannot open pseudo-terminal");
+		return -1;
+	}
+
+	slave_name = ptsname(master);
+	emu_pty_slave = open(slave_name, O_RDWR | O_NOCTTY);
+	if (emu_pty_slave < 0) {
+		perror("emu: cannot open pseudo-terminal slave");
+		return -1;
+	}
+
+	tcgetattr(emu_pty_slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(emu_pty_slave, TCSANOW, &tio);
+
+	if (link_path != NULL) {
+		unlink(link_path);
+		if (symlink(slave_name, link_path) != 0) {
+			perror("emu: cannot create pseudo-terminal link");
+			return -1;
+		}
+		emu_pty_link = link_path;
+	}
+
+	printf("%s\n", slave_name);
+	fflush(stdout);
+
+	return master;
+}
+
+static int emu_socket_open(const char *path) {
+	int fd;
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "emu: socket path '%s' is too long\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("emu: cannot create socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+	if ((bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) || (listen(fd, 1) != 0)) {
+		perror("emu: cannot listen on socket");
+		close(fd);
+		return -1;
+	}
+
+	emu_socket_path = path;
+
+	printf("%s\n", path);
+	fflush(stdout);
+
+	return fd;
+}
+
+static void emu_cleanup(void) {
+	if (emu_socket_path != NULL) {
+		unlink(emu_socket_path);
+	}
+	if (emu_pty_link != NULL) {
+		unlink(emu_pty_link);
+	}
+}
+
+/* Interrupted emulator leaves the same way as on RESTART, so the flash image gets saved. */
+static void emu_signal(int signal_number) {
+	UNUSED(signal_number);
+
+	hal_host_exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	int fd;
+	const char *flash_model;
+	const char *pty_link;
+	const char *socket_path;
+	HAL_HOST_CONFIG_T config;
+
+	flash_model = HOST_FLASH_MODEL;
+	pty_link = NULL;
+	socket_path = NULL;
+
+	config.flash_timing = FLASHSIM_TIMING_TYP;
+	config.image_map = NULL;
+	config.image_in = NULL;
+	config.image_out = NULL;
+	config.stats = 0;
+	config.link.mode = LINK_STREAM;
+	config.link.rx_fd = -1;
+	config.link.tx_fd = -1;
+	config.link.listen_fd = -1;
+	config.link.bandwidth = 0;
+	config.link.latency_ns = 0;
+	config.link.realtime = 1;
+
+	while ((opt = getopt(argc, argv, "p:u:f:t:b:l:vm:i:o:sh")) != -1) {
+		switch (opt) {
+			case 'p':
+				pty_link = optarg;
+				break;
+			case 'u':
+				socket_path = optarg;
+				break;
+			case 'f':
+				flash_model = optarg;
+				break;
+			case 't':
+				if (flashsim_timing(optarg, &config.flash_timing) != RESULT_OK) {
+					fprintf(stderr, "Unknown timing '%s'.\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'b':
+				config.link.bandwidth = (u32) strtoul(optarg, NULL, 0);
+				break;
+			case 'l':
+				config.link.latency_ns = (u32) strtoul(optarg, NULL, 0) * 1000;
+				break;
+			case 'v':
+				config.link.realtime = 0;
+				break;
+			case 'm':
+				config.image_map = optarg;
+				break;
+			case 'i':
+				config.image_in = optarg;
+				break;
+			case 'o':
+				config.image_out = optarg;
+				break;
+			case 's':
+				config.stats = 1;
+				break;
+			default:
+				usage(argv[0]);
+				return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (flashsim_type(flash_model, &config.flash_type) != RESULT_OK) {
+		fprintf(stderr, "Unknown flash model '%s'.\n", flash_model);
+		return EXIT_FAILURE;
+	}
+
+	atexit(emu_cleanup);
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, emu_signal);
+	signal(SIGTERM, emu_signal);
+
+	if (socket_path != NULL) {
+		fd = emu_socket_open(socket_path);
+		config.link.listen_fd = fd;
+	} else {
+		fd = emu_pty_open(pty_link);
+		config.link.rx_fd = fd;
+		config.link.tx_fd = fd;
+	}
+
+	if (fd < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (hal_host_init(&config) != RESULT_OK) {
+		return EXIT_FAILURE;
+	}
+
+	/* Never returns, engine leaves through hal_host_exit() on RESTART, POWER_DOWN or a signal. */
+	hitagi_start();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,886 @@
+/*
+ * About:
+ *   Timing-accurate models of the NOR flash chips used with Neptune SoCs for the host build.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ *
+ * Documentation:
+ *  StrataFlash_Wireless_Memory_(L30).pdf
+ *  S71WS-NX0.PDF
+ *  JESD68.01 Common Flash Interface (CFI).
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flashsim.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE            (0x100000)
+#endif
+
+#define INTEL_SR_READY                 (0x80)
+#define INTEL_SR_ERASE_ERROR           (0x20)
+#define INTEL_SR_PROGRAM_ERROR         (0x10)
+#define INTEL_SR_LOCKED                (0x02)
+#define INTEL_SR_SEQUENCE_ERROR        (INTEL_SR_ERASE_ERROR | INTEL_SR_PROGRAM_ERROR)
+
+#define INTEL_PR_LOCK_REG0             (0x80)
+#define INTEL_PR_LOCK_REG1             (0x89)
+#define INTEL_PR_START                 (0x80)
+#define INTEL_PR_END                   (0x10A)
+
+#define AMD_CMD_REGW_1                 (0x555)
+#define AMD_CMD_REGW_2                 (0x2AA)
+#define AMD_CMD_CFI                    (0x55)
+#define AMD_SSR_WORDS                  (0x100)
+
+#define AMD_DQ7                        (0x80)
+#define AMD_DQ6                        (0x40)
+#define AMD_DQ3                        (0x08)
+
+#define LOCK_UNIT_SIZE                 (0x8000)
+#define MAX_BUFFER_WORDS               (32)
+#define MAX_BANKS                      (16)
+#define CFI_SIZE                       (0x80)
+
+#define BLOCK_UNLOCKED                 (0)
+#define BLOCK_LOCKED                   (1)
+#define BLOCK_LOCKED_DOWN              (3)
+
+typedef enum {
+	SIM_READ_ARRAY,
+	SIM_READ_STATUS,
+	SIM_READ_ID,
+	SIM_READ_CFI
+} FLASHSIM_MODE_T;
+
+typedef enum {
+	SIM_IDLE,
+	SIM_PROGRAM,
+	SIM_ERASE,
+	SIM_LOCK,
+	SIM_PR_PROGRAM,
+	SIM_BUF_COUNT,
+	SIM_BUF_DATA,
+	SIM_BUF_CONFIRM,
+	SIM_UNLOCK_1,
+	SIM_UNLOCK_2,
+	SIM_ERASE_SETUP,
+	SIM_ERASE_UNLOCK_1,
+	SIM_ERASE_UNLOCK_2,
+	SIM_CONFIG
+} FLASHSIM_STATE_T;
+
+typedef struct {
+	u32 count;
+	u32 size;
+} FLASHSIM_REGION_T;
+
+/*
+ * Chip description, times are datasheet typical and maximum values for 1.8 V parts without VPP acceleration.
+ * Buffer program time is for the full buffer, partial buffers take proportional time.
+ */
+typedef struct {
+	const char *name;
+	u16 id[4];
+	u16 cfi_algorithm;
+	u8 vcc_min;
+	u8 vcc_max;
+	u8 region_count;
+	FLASHSIM_REGION_T regions[3];
+	u8 bank_count;
+	u32 bank_end[MAX_BANKS];
+	u16 buffer_words;
+	u32 word_program_ns[2];
+	u32 buffer_program_ns[2];
+	u32 parameter_erase_us[2];
+	u32 main_erase_us[2];
+} FLASHSIM_CHIP_T;
+
+/**
+ * Functions.
+ */
+
+static u32 flashsim_block_start(u32 offset);
+static u32 flashsim_block_size(u32 offset);
+static u8 flashsim_bank(u32 offset);
+static u8 flashsim_log2(u64 value);
+static void flashsim_cfi_build(void);
+static int flashsim_busy(void);
+static void flashsim_start(FLASHSIM_STATE_T op, u32 offset, u16 data, u64 ns);
+static u64 flashsim_time(const u32 *times);
+static void flashsim_program(u32 offset, u16 data);
+static void flashsim_erase(u32 offset);
+static u16 flashsim_intel_read(u32 offset);
+static void flashsim_intel_lock(u32 offset, u8 command);
+static int flashsim_intel_pr_locked(u16 index);
+static void flashsim_intel_write(u32 offset, u16 data);
+static u16 flashsim_amd_read(u32 offset);
+static void flashsim_amd_write(u32 offset, u16 data);
+
+/**
+ * Chips.
+ */
+
+static const FLASHSIM_CHIP_T chips[] = {
+	{
+		"Intel 28F256L30B",
+		{ 0x0089, 0x8810, 0x0000, 0x0000 },
+		0x0001, 0x17, 0x20,
+		2, { { 4, 0x8000 }, { 255, 0x20000 }, { 0, 0 } },
+		16, {
+			0x0200000, 0x0400000, 0x0600000, 0x0800000, 0x0A00000, 0x0C00000, 0x0E00000, 0x1000000,
+			0x1200000, 0x1400000, 0x1600000, 0x1800000, 0x1A00000, 0x1C00000, 0x1E00000, 0x2000000
+		},
+		32,
+		{ 90000, 200000 },
+		{ 440000, 880000 },
+		{ 400000, 2500000 },
+		{ 1200000, 4000000 }
+	},
+	{
+		"Spansion S29WS256N",
+		{ 0x0001, 0x227E, 0x2230, 0x2200 },
+		0x0002, 0x17, 0x19,
+		3, { { 4, 0x8000 }, { 254, 0x20000 }, { 4, 0x8000 } },
+		4, { 0x0400000, 0x1000000, 0x1C00000, 0x2000000 },
+		32,
+		{ 40000, 400000 },
+		{ 300000, 1500000 },
+		{ 150000, 2000000 },
+		{ 600000, 3500000 }
+	}
+};
+
+/**
+ * Globals.
+ */
+
+static const FLASHSIM_CHIP_T *chip;
+static FLASHSIM_TYPE_T sim_type;
+static FLASHSIM_TIMING_T sim_timing;
+static FLASHSIM_STATE_T sim_state;
+static FLASHSIM_STATS_T sim_stats;
+static u16 *sim_array;
+
+static FLASHSIM_MODE_T sim_mode[MAX_BANKS];
+static u8 sim_status;
+static u8 sim_locked[FLASHSIM_SIZE / LOCK_UNIT_SIZE];
+static u8 sim_secure;
+
+static u64 sim_now;
+static u64 sim_busy_until;
+static u8 sim_busy_bank;
+static FLASHSIM_STATE_T sim_busy_op;
+static u16 sim_busy_data;
+static u8 sim_toggle;
+
+static u16 sim_cfi[CFI_SIZE];
+static u16 sim_pr[INTEL_PR_END - INTEL_PR_START];
+static u16 sim_ssr[AMD_SSR_WORDS];
+
+static u32 sim_buf_block;
+static u32 sim_buf_offset[MAX_BUFFER_WORDS];
+static u16 sim_buf_data[MAX_BUFFER_WORDS];
+static u16 sim_buf_count;
+static u16 sim_buf_index;
+
+/**
+ * Geometry section.
+ */
+
+static u32 flashsim_block_size(u32 offset) {
+	u8 i;
+	u32 start = 0;
+
+	for (i = 0; i < chip->region_count; ++i) {
+		start += chip->regions[i].count * chip->regions[i].size;
+		if (offset < start) {
+			return chip->regions[i].size;
+		}
+	}
+
+	return chip->regions[chip->region_count - 1].size;
+}
+
+static u32 flashsim_block_start(u32 offset) {
+	return offset & ~(flashsim_block_size(offset) - 1);
+}
+
+static u8 flashsim_bank(u32 offset) {
+	u8 i;
+
+	for (i = 0; i < chip->bank_count - 1; ++i) {
+		if (offset < chip->bank_end[i]) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+/**
+ * CFI section.
+ */
+
+static u8 flashsim_log2(u64 value) {
+	u8 n = 0;
+
+	/* Round up, CFI values are 2^N. */
+	while (((u64) 1 << n) < value) {
+		n++;
+	}
+
+	return n;
+}
+
+static void flashsim_cfi_build(void) {
+	u8 i;
+	u16 *region;
+
+	memset(sim_cfi, 0, sizeof(sim_cfi));
+
+	sim_cfi[0x10] = 'Q';
+	sim_cfi[0x11] = 'R';
+	sim_cfi[0x12] = 'Y';
+	sim_cfi[0x13] = chip->cfi_algorithm;
+	sim_cfi[0x15] = 0x40;
+	sim_cfi[0x1B] = chip->vcc_min;
+	sim_cfi[0x1C] = chip->vcc_max;
+
+	/* Typical times are 2^N us/ms, maximum times are 2^N multiples of typical ones. */
+	sim_cfi[0x1F] = flashsim_log2(chip->word_program_ns[0] / 1000);
+	sim_cfi[0x20] = flashsim_log2(chip->buffer_program_ns[0] / 1000);
+	sim_cfi[0x21] = flashsim_log2(chip->main_erase_us[0] / 1000);
+	sim_cfi[0x23] = flashsim_log2(chip->word_program_ns[1] / chip->word_program_ns[0]);
+	sim_cfi[0x24] = flashsim_log2(chip->buffer_program_ns[1] / chip->buffer_program_ns[0]);
+	sim_cfi[0x25] = flashsim_log2(chip->main_erase_us[1] / chip->main_erase_us[0]);
+
+	sim_cfi[0x27] = flashsim_log2(FLASHSIM_SIZE);
+	sim_cfi[0x28] = 0x01;
+	sim_cfi[0x2A] = flashsim_log2(chip->buffer_words * sizeof(u16));
+	sim_cfi[0x2C] = chip->region_count;
+
+	for (i = 0; i < chip->region_count; ++i) {
+		region = &sim_cfi[0x2D + i * 4];
+		region[0] = (chip->regions[i].count - 1) & 0xFF;
+		region[1] = (chip->regions[i].count - 1) >> 8;
+		region[2] = (chip->regions[i].size >> 8) & 0xFF;
+		region[3] = (chip->regions[i].size >> 16);
+	}
+
+	/* Primary extended table, only the signature and the number of banks/partitions. */
+	sim_cfi[0x40] = 'P';
+	sim_cfi[0x41] = 'R';
+	sim_cfi[0x42] = 'I';
+	sim_cfi[0x43] = '1';
+	sim_cfi[0x44] = '3';
+	sim_cfi[0x57] = chip->bank_count;
+}
+
+/**
+ * Timing section.
+ */
+
+static u64 flashsim_time(const u32 *times) {
+	switch (sim_timing) {
+		case FLASHSIM_TIMING_TYP:
+			return times[0];
+		case FLASHSIM_TIMING_MAX:
+			return times[1];
+		default:
+			return 0;
+	}
+}
+
+static int flashsim_busy(void) {
+	return sim_now < sim_busy_until;
+}
+
+static void flashsim_start(FLASHSIM_STATE_T op, u32 offset, u16 data, u64 ns) {
+	sim_busy_op = op;
+	sim_busy_bank = flashsim_bank(offset);
+	sim_busy_data = data;
+	sim_busy_until = sim_now + ns;
+
+	sim_stats.busy_ns += ns;
+
+	if (sim_type == FLASHSIM_INTEL) {
+		sim_mode[sim_busy_bank] = SIM_READ_STATUS;
+	}
+}
+
+/**
+ * Array section.
+ */
+
+static void flashsim_program(u32 offset, u16 data) {
+	/* NOR cells can only go from 1 to 0. */
+	sim_array[offset >> 1] &= data;
+	sim_stats.programmed_words++;
+}
+
+static void flashsim_erase(u32 offset) {
+	u32 start;
+	u32 size;
+
+	start = flashsim_block_start(offset);
+	size = flashsim_block_size(offset);
+
+	memset(&sim_array[start >> 1], 0xFF, size);
+	sim_stats.erased_blocks++;
+
+	flashsim_start(
+		SIM_ERASE, offset, 0xFFFF,
+		flashsim_time((size == LOCK_UNIT_SIZE) ? chip->parameter_erase_us : chip->main_erase_us) * 1000
+	);
+}
+
+/**
+ * Intel section.
+ */
+
+static u16 flashsim_intel_read(u32 offset) {
+	u32 id_offset;
+	u8 bank = flashsim_bank(offset);
+
+	switch (sim_mode[bank]) {
+		case SIM_READ_STATUS:
+			if (flashsim_busy() && (bank == sim_busy_bank)) {
+				return sim_status & ~INTEL_SR_READY;
+			}
+			return sim_status;
+		case SIM_READ_ID:
+			id_offset = (offset - flashsim_block_start(offset)) >> 1;
+			if (id_offset <= 1) {
+				return chip->id[id_offset];
+			} else if (id_offset == 2) {
+				return sim_locked[offset / LOCK_UNIT_SIZE];
+			} else if ((id_offset >= INTEL_PR_START) && (id_offset < INTEL_PR_END)) {
+				return sim_pr[id_offset - INTEL_PR_START];
+			}
+			return 0x0000;
+		case SIM_READ_CFI:
+			id_offset = (offset - flashsim_block_start(offset)) >> 1;
+			return (id_offset < CFI_SIZE) ? sim_cfi[id_offset] : 0x0000;
+		default:
+			return sim_array[offset >> 1];
+	}
+}
+
+static void flashsim_intel_lock(u32 offset, u8 command) {
+	u32 i;
+	u8 *locked;
+
+	locked = &sim_locked[flashsim_block_start(offset) / LOCK_UNIT_SIZE];
+
+	for (i = 0; i < flashsim_block_size(offset) / LOCK_UNIT_SIZE; ++i) {
+		if (command == 0x01) {
+			locked[i] |= BLOCK_LOCKED;
+		} else if (command == 0x2F) {
+			locked[i] = BLOCK_LOCKED_DOWN;
+		} else if (locked[i] != BLOCK_LOCKED_DOWN) {
+			/* Locked-down blocks stay locked while WP# is low, it is tied low on phones. */
+			locked[i] = BLOCK_UNLOCKED;
+		}
+	}
+}
+
+static int flashsim_intel_pr_locked(u16 index) {
+	u16 reg = index + INTEL_PR_START;
+
+	if ((reg == INTEL_PR_LOCK_REG0) || (reg == INTEL_PR_LOCK_REG1)) {
+		return 0;
+	} else if (reg < INTEL_PR_LOCK_REG0 + 1 + 4) {
+		return !(sim_pr[INTEL_PR_LOCK_REG0 - INTEL_PR_START] & 0x0001);
+	} else if (reg < INTEL_PR_LOCK_REG1) {
+		return !(sim_pr[INTEL_PR_LOCK_REG0 - INTEL_PR_START] & 0x0002);
+	}
+
+	return !(sim_pr[INTEL_PR_LOCK_REG1 - INTEL_PR_START] & (1 << ((reg - INTEL_PR_LOCK_REG1 - 1) / 8)));
+}
+
+static void flashsim_intel_write(u32 offset, u16 data) {
+	u16 i;
+	u8 bank = flashsim_bank(offset);
+	u8 command = (u8) data;
+
+	/* Only the read mode commands are accepted while the chip is busy. */
+	if (flashsim_busy() && (sim_state == SIM_IDLE)) {
+		if ((command != 0x70) && (command != 0x90) && (command != 0x98) && (command != 0xFF)) {
+			sim_stats.errors++;
+			return;
+		}
+	}
+
+	switch (sim_state) {
+		case SIM_PROGRAM:
+			sim_state = SIM_IDLE;
+			if (sim_locked[offset / LOCK_UNIT_SIZE]) {
+				sim_status |= INTEL_SR_LOCKED | INTEL_SR_PROGRAM_ERROR;
+				sim_mode[bank] = SIM_READ_STATUS;
+			} else {
+				flashsim_program(offset, data);
+				sim_stats.program_operations++;
+				flashsim_start(SIM_PROGRAM, offset, data, flashsim_time(chip->word_program_ns));
+			}
+			return;
+		case SIM_ERASE:
+			sim_state = SIM_IDLE;
+			sim_mode[bank] = SIM_READ_STATUS;
+			if (command != 0xD0) {
+				sim_status |= INTEL_SR_SEQUENCE_ERROR;
+			} else if (sim_locked[offset / LOCK_UNIT_SIZE]) {
+				sim_status |= INTEL_SR_LOCKED | INTEL_SR_ERASE_ERROR;
+			} else {
+				flashsim_erase(offset);
+			}
+			return;
+		case SIM_LOCK:
+			sim_state = SIM_IDLE;
+			sim_mode[bank] = SIM_READ_STATUS;
+			if ((command == 0xD0) || (command == 0x01) || (command == 0x2F)) {
+				flashsim_intel_lock(offset, command);
+			} else if ((command != 0x03) && (command != 0x04)) {
+				/* 0x03 and 0x04 set read and enhanced configuration registers, nothing to model there. */
+				sim_status |= INTEL_SR_SEQUENCE_ERROR;
+			}
+			return;
+		case SIM_PR_PROGRAM:
+			sim_state = SIM_IDLE;
+			sim_mode[bank] = SIM_READ_STATUS;
+			i = (u16) ((offset >> 1) - INTEL_PR_START);
+			if ((i >= INTEL_PR_END - INTEL_PR_START) || flashsim_intel_pr_locked(i)) {
+				sim_status |= INTEL_SR_LOCKED | INTEL_SR_PROGRAM_ERROR;
+			} else {
+				sim_pr[i] &= data;
+				flashsim_start(SIM_PROGRAM, offset, data, flashsim_time(chip->word_program_ns));
+			}
+			return;
+		case SIM_BUF_COUNT:
+			sim_buf_count = (u16) (data + 1);
+			sim_buf_index = 0;
+			if (sim_buf_count > chip->buffer_words) {
+				sim_status |= INTEL_SR_SEQUENCE_ERROR;
+				sim_state = SIM_IDLE;
+			} else {
+				sim_state = SIM_BUF_DATA;
+			}
+			return;
+		case SIM_BUF_DATA:
+			sim_buf_offset[sim_buf_index] = offset;
+			sim_buf_data[sim_buf_index] = data;
+			if (++sim_buf_index == sim_buf_count) {
+				sim_state = SIM_BUF_CONFIRM;
+			}
+			return;
+		case SIM_BUF_CONFIRM:
+			sim_state = SIM_IDLE;
+			if (command != 0xD0) {
+				sim_status |= INTEL_SR_SEQUENCE_ERROR;
+			} else if (sim_locked[sim_buf_block / LOCK_UNIT_SIZE]) {
+				sim_status |= INTEL_SR_LOCKED | INTEL_SR_PROGRAM_ERROR;
+			} else {
+				for (i = 0; i < sim_buf_count; ++i) {
+					flashsim_program(sim_buf_offset[i], sim_buf_data[i]);
+				}
+				sim_stats.program_operations++;
+				flashsim_start(
+					SIM_PROGRAM, sim_buf_block, sim_buf_data[sim_buf_count - 1],
+					flashsim_time(chip->buffer_program_ns) * sim_buf_count / chip->buffer_words
+				);
+			}
+			return;
+		default:
+			break;
+	}
+
+	switch (command) {
+		case 0x10:
+		case 0x40:
+			sim_state = SIM_PROGRAM;
+			break;
+		case 0x20:
+			sim_state = SIM_ERASE;
+			break;
+		case 0x50:
+			sim_status = INTEL_SR_READY;
+			break;
+		case 0x60:
+			sim_state = SIM_LOCK;
+			break;
+		case 0x70:
+			sim_mode[bank] = SIM_READ_STATUS;
+			break;
+		case 0x90:
+			sim_mode[bank] = SIM_READ_ID;
+			break;
+		case 0x98:
+			sim_mode[bank] = SIM_READ_CFI;
+			break;
+		case 0xC0:
+			sim_state = SIM_PR_PROGRAM;
+			break;
+		case 0xE8:
+			/* Buffer is not granted until error bits are cleared. */
+			sim_buf_block = offset;
+			sim_mode[bank] = SIM_READ_STATUS;
+			if (!(sim_status & INTEL_SR_SEQUENCE_ERROR)) {
+				sim_state = SIM_BUF_COUNT;
+			}
+			break;
+		case 0xFF:
+			sim_mode[bank] = SIM_READ_ARRAY;
+			break;
+		default:
+			sim_status |= INTEL_SR_SEQUENCE_ERROR;
+			sim_mode[bank] = SIM_READ_STATUS;
+			break;
+	}
+}
+
+/**
+ * AMD section.
+ */
+
+static u16 flashsim_amd_read(u32 offset) {
+	u16 status;
+	u32 word;
+
+	word = offset >> 1;
+
+	/* Data polling: DQ7 is complement of the programmed bit (0 on erase), DQ6 toggles on every read. */
+	if (flashsim_busy() && (flashsim_bank(offset) == sim_busy_bank)) {
+		sim_toggle ^= AMD_DQ6;
+		if (sim_busy_op == SIM_ERASE) {
+			status = AMD_DQ3;
+		} else {
+			status = ~sim_busy_data & AMD_DQ7;
+		}
+		return status | sim_toggle;
+	}
+
+	switch (sim_mode[0]) {
+		case SIM_READ_ID:
+			switch (word & 0xFF) {
+				case 0x00:
+					return chip->id[0];
+				case 0x01:
+					return chip->id[1];
+				case 0x03:
+					/* Secure silicon region is factory locked. */
+					return 0x0099;
+				case 0x0E:
+					return chip->id[2];
+				case 0x0F:
+					return chip->id[3];
+				default:
+					return 0x0000;
+			}
+		case SIM_READ_CFI:
+			return ((word & 0xFF) < CFI_SIZE) ? sim_cfi[word & 0xFF] : 0x0000;
+		default:
+			break;
+	}
+
+	if (sim_secure && (word < AMD_SSR_WORDS)) {
+		return sim_ssr[word];
+	}
+
+	return sim_array[word];
+}
+
+static void flashsim_amd_write(u32 offset, u16 data) {
+	u16 i;
+	u32 word = offset >> 1;
+	u8 command = (u8) data;
+
+	/* Reset works from any state but a loaded write buffer and also leaves the secure silicon region. */
+	if ((command == 0xF0) && (sim_state != SIM_PROGRAM) && (sim_state != SIM_BUF_DATA) && (sim_state != SIM_BUF_COUNT)) {
+		sim_state = SIM_IDLE;
+		sim_mode[0] = SIM_READ_ARRAY;
+		sim_secure = 0;
+		return;
+	}
+
+	/* Busy bank ignores everything, other banks can still take commands. */
+	if (flashsim_busy() && (flashsim_bank(offset) == sim_busy_bank)) {
+		sim_stats.errors++;
+		return;
+	}
+
+	switch (sim_state) {
+		case SIM_IDLE:
+			if (((word & 0xFFF) == AMD_CMD_REGW_1) && (command == 0xAA)) {
+				sim_state = SIM_UNLOCK_1;
+			} else if (((word & 0xFF) == AMD_CMD_CFI) && (command == 0x98)) {
+				sim_mode[0] = SIM_READ_CFI;
+			} else if ((sim_mode[0] == SIM_READ_ID) && (command == 0x00)) {
+				sim_mode[0] = SIM_READ_ARRAY;
+				sim_secure = 0;
+			} else {
+				sim_stats.errors++;
+			}
+			return;
+		case SIM_UNLOCK_1:
+			sim_state = (((word & 0xFFF) == AMD_CMD_REGW_2) && (command == 0x55)) ? SIM_UNLOCK_2 : SIM_IDLE;
+			return;
+		case SIM_UNLOCK_2:
+			sim_state = SIM_IDLE;
+			if (command == 0x25) {
+				sim_buf_block = flashsim_block_start(offset);
+				sim_state = SIM_BUF_COUNT;
+			} else if ((word & 0xFFF) != AMD_CMD_REGW_1) {
+				sim_stats.errors++;
+			} else if (command == 0xA0) {
+				sim_state = SIM_PROGRAM;
+			} else if (command == 0x80) {
+				sim_state = SIM_ERASE_SETUP;
+			} else if (command == 0x88) {
+				sim_secure = 1;
+			} else if (command == 0x90) {
+				sim_mode[0] = SIM_READ_ID;
+			} else if (command == 0xD0) {
+				sim_state = SIM_CONFIG;
+			} else {
+				sim_stats.errors++;
+			}
+			return;
+		case SIM_PROGRAM:
+			sim_state = SIM_IDLE;
+			if (sim_secure && (word < AMD_SSR_WORDS)) {
+				sim_ssr[word] &= data;
+			} else {
+				flashsim_program(offset, data);
+			}
+			sim_stats.program_operations++;
+			flashsim_start(SIM_PROGRAM, offset, data, flashsim_time(chip->word_program_ns));
+			return;
+		case SIM_CONFIG:
+			/* Configuration register sets burst read mode, nothing to model there. */
+			sim_state = SIM_IDLE;
+			return;
+		case SIM_ERASE_SETUP:
+			sim_state = (((word & 0xFFF) == AMD_CMD_REGW_1) && (command == 0xAA)) ? SIM_ERASE_UNLOCK_1 : SIM_IDLE;
+			return;
+		case SIM_ERASE_UNLOCK_1:
+			sim_state = (((word & 0xFFF) == AMD_CMD_REGW_2) && (command == 0x55)) ? SIM_ERASE_UNLOCK_2 : SIM_IDLE;
+			return;
+		case SIM_ERASE_UNLOCK_2:
+			sim_state = SIM_IDLE;
+			if (command == 0x30) {
+				flashsim_erase(offset);
+			} else if (command == 0x10) {
+				memset(sim_array, 0xFF, FLASHSIM_SIZE);
+				sim_stats.erased_blocks++;
+				flashsim_start(SIM_ERASE, 0, 0xFFFF, flashsim_time(chip->main_erase_us) * 1000 * (FLASHSIM_SIZE / 0x20000));
+			} else {
+				sim_stats.errors++;
+			}
+			return;
+		case SIM_BUF_COUNT:
+			sim_buf_count = (u16) (data + 1);
+			sim_buf_index = 0;
+			if ((sim_buf_count > chip->buffer_words) || (flashsim_block_start(offset) != sim_buf_block)) {
+				sim_stats.errors++;
+				sim_state = SIM_IDLE;
+			} else {
+				sim_state = SIM_BUF_DATA;
+			}
+			return;
+		case SIM_BUF_DATA:
+			sim_buf_offset[sim_buf_index] = offset;
+			sim_buf_data[sim_buf_index] = data;
+			if (++sim_buf_index == sim_buf_count) {
+				sim_state = SIM_BUF_CONFIRM;
+			}
+			return;
+		case SIM_BUF_CONFIRM:
+			sim_state = SIM_IDLE;
+			if ((command == 0x29) && (flashsim_block_start(offset) == sim_buf_block)) {
+				for (i = 0; i < sim_buf_count; ++i) {
+					flashsim_program(sim_buf_offset[i], sim_buf_data[i]);
+				}
+				sim_stats.program_operations++;
+				flashsim_start(
+					SIM_PROGRAM, sim_buf_offset[sim_buf_count - 1], sim_buf_data[sim_buf_count - 1],
+					flashsim_time(chip->buffer_program_ns) * sim_buf_count / chip->buffer_words
+				);
+			} else {
+				/* Write-buffer-abort, device waits for the reset sequence. */
+				sim_stats.errors++;
+			}
+			return;
+		default:
+			sim_state = SIM_IDLE;
+			return;
+	}
+}
+
+/**
+ * Interface section.
+ */
+
+u16 *flashsim_map(void *base, const char *path) {
+	int fd;
+	void *ptr;
+	struct stat st;
+	off_t old_size;
+
+	if (path == NULL) {
+		ptr = mmap(base, FLASHSIM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+		if (ptr != base) {
+			fprintf(stderr, "flashsim: cannot map flash at %p: %s\n", base, strerror(errno));
+			return NULL;
+		}
+		memset(ptr, 0xFF, FLASHSIM_SIZE);
+		return (u16 *) ptr;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if ((fd < 0) || (fstat(fd, &st) != 0)) {
+		fprintf(stderr, "flashsim: cannot open '%s': %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	old_size = st.st_size;
+	if ((old_size < FLASHSIM_SIZE) && (ftruncate(fd, FLASHSIM_SIZE) != 0)) {
+		fprintf(stderr, "flashsim: cannot resize '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	ptr = mmap(base, FLASHSIM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+	close(fd);
+	if (ptr != base) {
+		fprintf(stderr, "flashsim: cannot map '%s' at %p: %s\n", path, base, strerror(errno));
+		return NULL;
+	}
+
+	/* Short or new image, the rest of the chip is erased. */
+	if (old_size < FLASHSIM_SIZE) {
+		memset((u8 *) ptr + old_size, 0xFF, FLASHSIM_SIZE - old_size);
+	}
+
+	return (u16 *) ptr;
+}
+
+int flashsim_init(FLASHSIM_TYPE_T type, FLASHSIM_TIMING_T timing, u16 *array) {
+	u16 i;
+
+	chip = &chips[type];
+	sim_type = type;
+	sim_timing = timing;
+	sim_array = array;
+	sim_state = SIM_IDLE;
+	sim_status = INTEL_SR_READY;
+	sim_secure = 0;
+	sim_now = 0;
+	sim_busy_until = 0;
+
+	memset(sim_mode, SIM_READ_ARRAY, sizeof(sim_mode));
+	memset(&sim_stats, 0, sizeof(sim_stats));
+
+	/* Intel L30 powers up with all blocks locked. */
+	memset(sim_locked, (type == FLASHSIM_INTEL) ? BLOCK_LOCKED : BLOCK_UNLOCKED, sizeof(sim_locked));
+
+	/* Factory programmed unique ID in the first protection register, everything else is blank. */
+	for (i = 0; i < sizeof(sim_pr) / sizeof(sim_pr[0]); ++i) {
+		sim_pr[i] = 0xFFFF;
+	}
+	for (i = 0; i < sizeof(sim_ssr) / sizeof(sim_ssr[0]); ++i) {
+		sim_ssr[i] = 0xFFFF;
+	}
+	for (i = 0; i < 4; ++i) {
+		sim_pr[1 + i] = (u16) (0x4854 + i);
+		sim_ssr[i] = (u16) (0x4854 + i);
+	}
+	sim_pr[INTEL_PR_LOCK_REG0 - INTEL_PR_START] = 0xFFFE;
+
+	flashsim_cfi_build();
+
+	return RESULT_OK;
+}
+
+int flashsim_type(const char *name, FLASHSIM_TYPE_T *type) {
+	if (!strncmp(name, "intel", 5)) {
+		*type = FLASHSIM_INTEL;
+	} else if (!strncmp(name, "amd", 3)) {
+		*type = FLASHSIM_AMD;
+	} else {
+		return RESULT_FAIL;
+	}
+
+	return RESULT_OK;
+}
+
+int flashsim_timing(const char *name, FLASHSIM_TIMING_T *timing) {
+	if (!strcmp(name, "none")) {
+		*timing = FLASHSIM_TIMING_NONE;
+	} else if (!strcmp(name, "typ")) {
+		*timing = FLASHSIM_TIMING_TYP;
+	} else if (!strcmp(name, "max")) {
+		*timing = FLASHSIM_TIMING_MAX;
+	} else {
+		return RESULT_FAIL;
+	}
+
+	return RESULT_OK;
+}
+
+const char *flashsim_name(void) {
+	return chip->name;
+}
+
+u16 flashsim_read(u32 offset) {
+	u64 step;
+
+	sim_stats.reads++;
+	sim_now += FLASHSIM_BUS_CYCLE_NS;
+
+	if (flashsim_busy() && (flashsim_bank(offset) == sim_busy_bank)) {
+		sim_stats.busy_polls++;
+
+		step = sim_busy_until - sim_now;
+		step = (step < FLASHSIM_POLL_STEP_NS) ? step : FLASHSIM_POLL_STEP_NS;
+		sim_now += step;
+		sim_stats.wait_ns += step;
+	}
+
+	return (sim_type == FLASHSIM_INTEL) ? flashsim_intel_read(offset) : flashsim_amd_read(offset);
+}
+
+void flashsim_write(u32 offset, u16 data) {
+	sim_stats.writes++;
+	sim_now += FLASHSIM_BUS_CYCLE_NS;
+
+	if (sim_type == FLASHSIM_INTEL) {
+		flashsim_intel_write(offset, data);
+	} else {
+		flashsim_amd_write(offset, data);
+	}
+}
+
+void flashsim_advance(u64 ns) {
+	sim_now += ns;
+}
+
+u64 flashsim_now(void) {
+	return sim_now;
+}
+
+const FLASHSIM_STATS_T *flashsim_stats(void) {
+	return &sim_stats;
+}
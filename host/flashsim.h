@@ -0,0 +1,69 @@
+/*
+ * About:
+ *   Timing-accurate models of the NOR flash chips used with Neptune SoCs for the host build.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ *
+ * Models:
+ *   intel | Intel/Numonyx StrataFlash Wireless Memory (L30) 28F256L30B, bottom parameter blocks, 16 partitions.
+ *   amd   | Spansion S29WS256N (S71WS-N stack), parameter sectors at the bottom and the top, 4 banks.
+ *
+ * Notes:
+ *   1. Array is native-endian 16-bit words so the engine sees the same byte image as on the big-endian device.
+ *   2. Array may be backed by an image file mapped with mmap(), all changes go straight to the file.
+ *   3. Model keeps its own virtual clock in nanoseconds. Every bus cycle costs FLASHSIM_BUS_CYCLE_NS, the rest of
+ *      the system moves the clock with flashsim_advance(). Program and erase take datasheet typical or maximum
+ *      times, status reads show the chip busy until the clock passes the end of operation.
+ *   4. Status read of the busy chip moves the clock by FLASHSIM_POLL_STEP_NS, so long erases do not need
+ *      millions of polling iterations on the host.
+ */
+
+#ifndef FLASHSIM_H
+#define FLASHSIM_H
+
+#include "../platform.h"
+
+#define FLASHSIM_SIZE                  (0x02000000)
+
+#define FLASHSIM_BUS_CYCLE_NS          (70)
+#define FLASHSIM_POLL_STEP_NS          (10000)
+
+typedef enum {
+	FLASHSIM_INTEL,
+	FLASHSIM_AMD
+} FLASHSIM_TYPE_T;
+
+typedef enum {
+	FLASHSIM_TIMING_NONE,
+	FLASHSIM_TIMING_TYP,
+	FLASHSIM_TIMING_MAX
+} FLASHSIM_TIMING_T;
+
+typedef struct {
+	u32 reads;
+	u32 writes;
+	u32 busy_polls;
+	u32 programmed_words;
+	u32 program_operations;
+	u32 erased_blocks;
+	u32 errors;
+	u64 busy_ns;
+	u64 wait_ns;
+} FLASHSIM_STATS_T;
+
+extern u16 *flashsim_map(void *base, const char *path);
+extern int flashsim_init(FLASHSIM_TYPE_T type, FLASHSIM_TIMING_T timing, u16 *array);
+extern int flashsim_type(const char *name, FLASHSIM_TYPE_T *type);
+extern int flashsim_timing(const char *name, FLASHSIM_TIMING_T *timing);
+extern const char *flashsim_name(void);
+extern u16 flashsim_read(u32 offset);
+extern void flashsim_write(u32 offset, u16 data);
+extern void flashsim_advance(u64 ns);
+extern u64 flashsim_now(void);
+extern const FLASHSIM_STATS_T *flashsim_stats(void);
+
+#endif /* !FLASHSIM_H */
@@ -0,0 +1,359 @@
+/*
+ * About:
+ *   Hardware abstraction layer with simulated Neptune peripherals for the host build.
+ *   USB EP1/EP2 go through the link model, flash bus cycles go to the flash chip model.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ *
+ * Memory map:
+ *   0x03F00000...0x04000000 | IRAM, host build keeps the arena in its own image, the window is for uploads only.
+ *   0x10000000...0x12000000 | NOR flash, array is owned by the flash chip model and may be backed by an image file.
+ *   0x12000000...0x14000000 | External RAM, windows are executable for uploaded modules.
+ *   0x24840000...0x24860000 | Peripherals, only UID and REV registers are filled.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../platform.h"
+#include "../regs_neptune.h"
+#include "../flash.h"
+#include "../hal.h"
+
+#include "hal_host.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE            (0x100000)
+#endif
+
+#define HOST_FLASH_START               (0x10000000)
+#define HOST_IRAM_START                (0x03F00000)
+#define HOST_IRAM_END                  (0x04000000)
+#define HOST_PERIPHERALS_START         (0x24840000)
+#define HOST_PERIPHERALS_END           (0x24860000)
+
+/* One nop() loop iteration on the MCU, it is the only CPU time accounted in the model besides bus cycles. */
+#define HOST_NOP_NS                    (40)
+
+/* Watchdog service is two writes of the WSR register. */
+#define HOST_WATCHDOG_WRITES           (2)
+
+typedef struct {
+	u32 start;
+	u32 end;
+	const char *name;
+} HOST_WINDOW_T;
+
+/**
+ * Functions.
+ */
+
+static int hal_host_map(const HOST_WINDOW_T *window);
+static int hal_host_image_load(const char *path);
+static int hal_host_image_save(const char *path);
+static void hal_host_stats(void);
+
+/**
+ * Globals.
+ */
+
+static const HOST_WINDOW_T host_windows[] = {
+	{ HOST_IRAM_START,        HOST_IRAM_END,        "IRAM"        },
+	{ NEPTUNE_RAM_START,      NEPTUNE_RAM_END,      "RAM"         },
+	{ HOST_PERIPHERALS_START, HOST_PERIPHERALS_END, "Peripherals" },
+};
+
+static HAL_HOST_CONFIG_T host_config;
+
+static struct timespec host_start_time;
+
+static u64 host_nop_count;
+static u64 host_watchdog_count;
+
+/* Chip-select control register of READ_MODE, there is no bus timing to model, so one value is kept for any address. */
+static u32 host_chip_select;
+
+/**
+ * Host section.
+ */
+
+static int hal_host_map(const HOST_WINDOW_T *window) {
+	void *ptr;
+
+	ptr = mmap(
+		(void *) (unsigned long) window->start, window->end - window->start,
+		PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0
+	);
+
+	if (ptr != (void *) (unsigned long) window->start) {
+		fprintf(stderr, "hal: cannot map %s at 0x%08X: %s\n", window->name, window->start, strerror(errno));
+		return RESULT_FAIL;
+	}
+
+	return RESULT_OK;
+}
+
+static int hal_host_image_load(const char *path) {
+	FILE *file;
+	size_t size;
+
+	file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "hal: cannot open '%s': %s\n", path, strerror(errno));
+		return RESULT_FAIL;
+	}
+
+	size = fread((void *) (unsigned long) HOST_FLASH_START, 1, FLASHSIM_SIZE, file);
+	fclose(file);
+
+	fprintf(stderr, "hal: loaded %zu bytes of flash image from '%s'\n", size, path);
+
+	return RESULT_OK;
+}
+
+static int hal_host_image_save(const char *path) {
+	FILE *file;
+
+	file = fopen(path, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "hal: cannot create '%s': %s\n", path, strerror(errno));
+		return RESULT_FAIL;
+	}
+
+	fwrite((void *) (unsigned long) HOST_FLASH_START, 1, FLASHSIM_SIZE, file);
+	fclose(file);
+
+	return RESULT_OK;
+}
+
+static void hal_host_stats(void) {
+	u64 mmio;
+	double elapsed;
+	struct timespec now;
+	const FLASHSIM_STATS_T *flash_stats;
+	const LINK_STATS_T *link_stat;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (double) (now.tv_sec - host_start_time.tv_sec) + (now.tv_nsec - host_start_time.tv_nsec) / 1e9;
+
+	flash_stats = flashsim_stats();
+	link_stat = link_stats();
+	mmio = (u64) flash_stats->reads + flash_stats->writes + host_watchdog_count * HOST_WATCHDOG_WRITES;
+
+	fprintf(stderr, "flash_chip:         %s\n", flashsim_name());
+	fprintf(stderr, "usb_requests:       %llu\n", (unsigned long long) link_stat->requests);
+	fprintf(stderr, "usb_rx_bytes:       %llu\n", (unsigned long long) link_stat->rx_bytes);
+	fprintf(stderr, "usb_rx_packets:     %llu\n", (unsigned long long) link_stat->rx_packets);
+	fprintf(stderr, "usb_tx_bytes:       %llu\n", (unsigned long long) link_stat->tx_bytes);
+	fprintf(stderr, "usb_tx_packets:     %llu\n", (unsigned long long) link_stat->tx_packets);
+	fprintf(stderr, "flash_reads:        %u\n", flash_stats->reads);
+	fprintf(stderr, "flash_writes:       %u\n", flash_stats->writes);
+	fprintf(stderr, "flash_busy_polls:   %u\n", flash_stats->busy_polls);
+	fprintf(stderr, "flash_programmed:   %u\n", flash_stats->programmed_words);
+	fprintf(stderr, "flash_program_ops:  %u\n", flash_stats->program_operations);
+	fprintf(stderr, "flash_erased:       %u\n", flash_stats->erased_blocks);
+	fprintf(stderr, "flash_errors:       %u\n", flash_stats->errors);
+	fprintf(stderr, "nop_cycles:         %llu\n", (unsigned long long) host_nop_count);
+	fprintf(stderr, "watchdog_services:  %llu\n", (unsigned long long) host_watchdog_count);
+	fprintf(stderr, "mmio_operations:    %llu\n", (unsigned long long) mmio);
+	fprintf(stderr, "flash_busy_seconds: %.6f\n", flash_stats->busy_ns / 1e9);
+	fprintf(stderr, "link_wait_seconds:  %.6f\n", link_stat->wait_ns / 1e9);
+	fprintf(stderr, "cpu_seconds:        %.6f\n", (mmio * FLASHSIM_BUS_CYCLE_NS + host_nop_count * HOST_NOP_NS) / 1e9);
+	fprintf(stderr, "flash_wait_seconds: %.6f\n", flash_stats->wait_ns / 1e9);
+	fprintf(stderr, "modeled_seconds:    %.6f\n", flashsim_now() / 1e9);
+	fprintf(stderr, "elapsed_seconds:    %.6f\n", elapsed);
+}
+
+int hal_host_init(const HAL_HOST_CONFIG_T *config) {
+	u8 i;
+	u16 *flash;
+	volatile u16 *uid;
+
+	host_config = *config;
+
+	for (i = 0; i < sizeof(host_windows) / sizeof(host_windows[0]); ++i) {
+		if (hal_host_map(&host_windows[i]) != RESULT_OK) {
+			return RESULT_FAIL;
+		}
+	}
+
+	flash = flashsim_map((void *) (unsigned long) HOST_FLASH_START, host_config.image_map);
+	if (flash == NULL) {
+		return RESULT_FAIL;
+	}
+
+	if ((host_config.image_in != NULL) && (hal_host_image_load(host_config.image_in) != RESULT_OK)) {
+		return RESULT_FAIL;
+	}
+
+	flashsim_init(host_config.flash_type, host_config.flash_timing, flash);
+
+	/* Fake UID of the non-secure part and REV of Neptune LTE ROM, SPS Hip7, Pass 2. */
+	uid = NEPTUNE_UID_REG_ADDR;
+	for (i = 0; i < 8; ++i) {
+		uid[i] = (u16) (0x4854 + i);
+	}
+	uid[7] = 0x8000;
+	*NEPTUNE_REV_REG_ADDR = 0x9201;
+
+	clock_gettime(CLOCK_MONOTONIC, &host_start_time);
+
+	link_init(&host_config.link);
+
+	return RESULT_OK;
+}
+
+void hal_host_exit(int code) {
+	link_flush();
+
+	if (host_config.image_out != NULL) {
+		hal_host_image_save(host_config.image_out);
+	}
+
+	if (host_config.stats) {
+		hal_host_stats();
+	}
+
+	exit(code);
+}
+
+/**
+ * NOP function.
+ */
+
+void nop(u32 nop_count) {
+	host_nop_count += nop_count;
+	flashsim_advance((u64) nop_count * HOST_NOP_NS);
+}
+
+/**
+ * Flash bus section.
+ */
+
+FLASH_DATA_WIDTH hal_flash_read(volatile FLASH_DATA_WIDTH *addr) {
+	link_activity();
+
+	return flashsim_read((u32) (unsigned long) addr - HOST_FLASH_START);
+}
+
+void hal_flash_write(volatile FLASH_DATA_WIDTH *addr, FLASH_DATA_WIDTH data) {
+	link_activity();
+
+	flashsim_write((u32) (unsigned long) addr - HOST_FLASH_START, data);
+}
+
+/**
+ * USB section.
+ */
+
+int hal_usb_tx(const u8 *src, u8 len) {
+	return link_tx(src, len);
+}
+
+u16 hal_usb_rx(u8 *ring, u16 head) {
+	int i;
+	int rx_bytes;
+	u8 packet[USB_MAX_PACKET_SIZE];
+
+	rx_bytes = link_rx(packet, USB_MAX_PACKET_SIZE);
+	if (rx_bytes == LINK_EOF) {
+		hal_host_exit(EXIT_SUCCESS);
+	}
+
+	for (i = 0; i < rx_bytes; ++i) {
+		ring[head++ & (USB_RX_RING_SIZE - 1)] = packet[i];
+	}
+
+	return head;
+}
+
+int hal_usb_init(void) {
+	return RESULT_OK;
+}
+
+/**
+ * Timer section.
+ */
+
+int hal_timer_init(void) {
+	return RESULT_OK;
+}
+
+/* GPT counter follows the modeled time, so counters read by RQPC match the host statistics. */
+u32 hal_timer_ticks(void) {
+	return (u32) (flashsim_now() * HAL_TIMER_HZ / 1000000000ULL);
+}
+
+/**
+ * Memory section.
+ */
+
+void hal_read_burst(const u32 *src, u32 size) {
+	u32 i;
+	const volatile u32 *ptr = src;
+
+	for (i = 0; i < size / sizeof(u32); i += 8) {
+		(void) ptr[i + 0]; (void) ptr[i + 1]; (void) ptr[i + 2]; (void) ptr[i + 3];
+		(void) ptr[i + 4]; (void) ptr[i + 5]; (void) ptr[i + 6]; (void) ptr[i + 7];
+	}
+}
+
+void hal_fill_burst(u32 *dst, u32 pattern, u32 size) {
+	u32 i;
+	volatile u32 *ptr = dst;
+
+	for (i = 0; i < size / sizeof(u32); i += 8) {
+		ptr[i + 0] = pattern; ptr[i + 1] = pattern; ptr[i + 2] = pattern; ptr[i + 3] = pattern;
+		ptr[i + 4] = pattern; ptr[i + 5] = pattern; ptr[i + 6] = pattern; ptr[i + 7] = pattern;
+	}
+}
+
+u32 hal_chip_select(u32 reg, u32 value) {
+	u32 old = host_chip_select;
+
+	UNUSED(reg);
+
+	host_chip_select = value;
+
+	return old;
+}
+
+/**
+ * Watchdog section.
+ */
+
+int watchdog_reboot(void) {
+	fprintf(stderr, "hal: watchdog reboot\n");
+	hal_host_exit(EXIT_SUCCESS);
+
+	return RESULT_OK;
+}
+
+int watchdog_shutdown(void) {
+	fprintf(stderr, "hal: watchdog shutdown\n");
+	hal_host_exit(EXIT_SUCCESS);
+
+	return RESULT_OK;
+}
+
+int watchdog_service(void) {
+	host_watchdog_count++;
+	flashsim_advance(HOST_WATCHDOG_WRITES * FLASHSIM_BUS_CYCLE_NS);
+
+	return RESULT_OK;
+}
+
+int watchdog_init(void) {
+	return RESULT_OK;
+}
@@ -0,0 +1,32 @@
+/*
+ * About:
+ *   Host build of Hitagi, simulated Neptune peripherals interface.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ */
+
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+#include "../platform.h"
+#include "flashsim.h"
+#include "link.h"
+
+typedef struct {
+	FLASHSIM_TYPE_T flash_type;
+	FLASHSIM_TIMING_T flash_timing;
+	const char *image_map;
+	const char *image_in;
+	const char *image_out;
+	LINK_CONFIG_T link;
+	int stats;
+} HAL_HOST_CONFIG_T;
+
+extern int hal_host_init(const HAL_HOST_CONFIG_T *config);
+extern void hal_host_exit(int code);
+
+#endif /* !HAL_HOST_H */
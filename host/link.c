@@ -0,0 +1,475 @@
+/*
+ * About:
+ *   USB link model between the flasher and simulated EP1/EP2 endpoints for the host build.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../platform.h"
+#include "../regs_neptune.h"
+
+#include "flashsim.h"
+#include "link.h"
+
+/* Polls of the empty EP1 after EOF before the engine is considered idle. */
+#define LINK_IDLE_POLLS                (1000000)
+
+/* Delayed EP2 packets for the latency model in real-time mode. */
+#define LINK_TX_QUEUE_SIZE             (64)
+
+/* Real-time mode lets the virtual clock run ahead of the wall clock by this much before sleeping. */
+#define LINK_REALTIME_SLACK_NS         (1000000)
+
+typedef struct {
+	u64 due;
+	u8 len;
+	u8 data[USB_MAX_PACKET_SIZE];
+} LINK_PACKET_T;
+
+/**
+ * Functions.
+ */
+
+static u64 link_wall_clock(void);
+static void link_sync(void);
+static void link_wait(u64 until);
+static u64 link_transfer_ns(u32 len);
+static void link_write(const u8 *data, u8 len);
+static void link_tx_service(int force);
+static int link_accept(void);
+static void link_disconnect(void);
+static int link_fill(int wait);
+static u32 link_message_size(const u8 *data, u32 size);
+static int link_message_fetch(void);
+
+/**
+ * Globals.
+ */
+
+static LINK_CONFIG_T link_config;
+static LINK_STATS_T link_stat;
+
+static u8 link_in_buf[0x10000];
+static u32 link_in_len;
+static u32 link_in_pos;
+static u32 link_msg_size;
+static int link_wait_answer;
+static int link_rx_eof;
+static u32 link_idle_polls;
+
+static u64 link_rx_not_before;
+static u64 link_rx_ready;
+static int link_rx_scheduled;
+static u64 link_tx_busy_until;
+static u64 link_answer_time;
+
+static LINK_PACKET_T link_tx_queue[LINK_TX_QUEUE_SIZE];
+static u32 link_tx_head;
+static u32 link_tx_tail;
+
+static u64 link_wall_start;
+
+/**
+ * Clock section.
+ */
+
+static u64 link_wall_clock(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (u64) now.tv_sec * 1000000000ULL + now.tv_nsec - link_wall_start;
+}
+
+/* Real-time mode: virtual clock catches up with the wall clock, or the host sleeps when it is ahead. */
+static void link_sync(void) {
+	u64 wall;
+	u64 now;
+	struct timespec delay;
+
+	if (!link_config.realtime) {
+		return;
+	}
+
+	wall = link_wall_clock();
+	now = flashsim_now();
+
+	if (wall > now) {
+		flashsim_advance(wall - now);
+	} else if (now - wall > LINK_REALTIME_SLACK_NS) {
+		delay.tv_sec = (now - wall) / 1000000000ULL;
+		delay.tv_nsec = (now - wall) % 1000000000ULL;
+		nanosleep(&delay, NULL);
+	}
+}
+
+static void link_wait(u64 until) {
+	u64 step;
+	struct timespec delay;
+
+	if (flashsim_now() >= until) {
+		return;
+	}
+
+	step = until - flashsim_now();
+
+	if (link_config.realtime) {
+		if (step > LINK_WAIT_STEP_NS) {
+			delay.tv_sec = 0;
+			delay.tv_nsec = (step < LINK_REALTIME_SLACK_NS) ? step : LINK_REALTIME_SLACK_NS;
+			nanosleep(&delay, NULL);
+		}
+		link_sync();
+		return;
+	}
+
+	if (step > LINK_WAIT_STEP_NS) {
+		step = LINK_WAIT_STEP_NS;
+	}
+
+	flashsim_advance(step);
+	link_stat.wait_ns += step;
+}
+
+static u64 link_transfer_ns(u32 len) {
+	if (link_config.bandwidth == 0) {
+		return 0;
+	}
+
+	return (u64) len * 1000000000ULL / link_config.bandwidth;
+}
+
+/**
+ * Connection section.
+ */
+
+static int link_accept(void) {
+	int fd;
+
+	fd = accept(link_config.listen_fd, NULL, NULL);
+	if (fd < 0) {
+		return RESULT_FAIL;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	link_config.rx_fd = fd;
+	link_config.tx_fd = fd;
+	link_rx_eof = 0;
+	link_idle_polls = 0;
+
+	fprintf(stderr, "link: client connected\n");
+
+	return RESULT_OK;
+}
+
+/* Client went away, drop everything in flight and wait for the next one. */
+static void link_disconnect(void) {
+	if (link_config.listen_fd < 0) {
+		link_rx_eof = 1;
+		return;
+	}
+
+	fprintf(stderr, "link: client disconnected\n");
+
+	close(link_config.rx_fd);
+	link_config.rx_fd = -1;
+	link_config.tx_fd = -1;
+
+	link_in_len = 0;
+	link_in_pos = 0;
+	link_msg_size = 0;
+	link_rx_scheduled = 0;
+	link_tx_head = link_tx_tail;
+}
+
+int link_init(const LINK_CONFIG_T *config) {
+	struct timespec now;
+
+	link_config = *config;
+
+	if (link_config.rx_fd >= 0) {
+		fcntl(link_config.rx_fd, F_SETFL, fcntl(link_config.rx_fd, F_GETFL) | O_NONBLOCK);
+	}
+	if (link_config.listen_fd >= 0) {
+		fcntl(link_config.listen_fd, F_SETFL, fcntl(link_config.listen_fd, F_GETFL) | O_NONBLOCK);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	link_wall_start = (u64) now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+	return RESULT_OK;
+}
+
+void link_activity(void) {
+	link_idle_polls = 0;
+}
+
+const LINK_STATS_T *link_stats(void) {
+	return &link_stat;
+}
+
+/**
+ * EP2 section.
+ */
+
+static void link_write(const u8 *data, u8 len) {
+	ssize_t written;
+
+	while (len > 0) {
+		if (link_config.tx_fd < 0) {
+			return;
+		}
+		written = write(link_config.tx_fd, data, len);
+		if (written < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			link_disconnect();
+			return;
+		}
+		data += written;
+		len -= written;
+	}
+}
+
+/* Packets leave the link when their latency is over, all of them are forced out when the queue is full. */
+static void link_tx_service(int force) {
+	LINK_PACKET_T *packet;
+
+	while (link_tx_tail != link_tx_head) {
+		packet = &link_tx_queue[link_tx_tail % LINK_TX_QUEUE_SIZE];
+		if (!force && link_config.realtime && (flashsim_now() < packet->due)) {
+			break;
+		}
+		link_write(packet->data, packet->len);
+		link_tx_tail++;
+	}
+}
+
+void link_flush(void) {
+	link_tx_service(1);
+}
+
+int link_tx(const u8 *packet, u8 len) {
+	LINK_PACKET_T *slot;
+
+	link_sync();
+	link_tx_service(0);
+
+	/* EP2 FIFO is still busy with the previous packet, engine will retry. */
+	if (flashsim_now() < link_tx_busy_until) {
+		link_wait(link_tx_busy_until);
+		if (flashsim_now() < link_tx_busy_until) {
+			return RESULT_FAIL;
+		}
+	}
+
+	if (link_tx_head - link_tx_tail >= LINK_TX_QUEUE_SIZE) {
+		link_tx_service(1);
+	}
+
+	link_tx_busy_until = flashsim_now() + link_transfer_ns(len);
+
+	slot = &link_tx_queue[link_tx_head % LINK_TX_QUEUE_SIZE];
+	slot->due = link_tx_busy_until + link_config.latency_ns;
+	slot->len = len;
+	memcpy(slot->data, packet, len);
+	link_tx_head++;
+
+	link_stat.tx_bytes += len;
+	link_stat.tx_packets++;
+	link_idle_polls = 0;
+
+	/* Short or zero-length packet ends the answer transfer. */
+	if (len < USB_MAX_PACKET_SIZE) {
+		link_answer_time = slot->due;
+		link_wait_answer = 0;
+	}
+
+	if (!link_config.realtime) {
+		link_tx_service(1);
+	}
+
+	return RESULT_OK;
+}
+
+/**
+ * EP1 section.
+ */
+
+/* Reads everything the flasher has sent so far, returns RESULT_FAIL when nothing came. */
+static int link_fill(int wait) {
+	ssize_t rx_bytes;
+	struct pollfd fds;
+
+	if (link_config.rx_fd < 0) {
+		if ((link_config.listen_fd < 0) || (link_accept() != RESULT_OK)) {
+			if (wait) {
+				fds.fd = link_config.listen_fd;
+				fds.events = POLLIN;
+				poll(&fds, 1, 1);
+			}
+			return RESULT_FAIL;
+		}
+	}
+
+	if (link_rx_eof) {
+		return RESULT_FAIL;
+	}
+
+	if (link_in_pos != 0) {
+		memmove(link_in_buf, &link_in_buf[link_in_pos], link_in_len - link_in_pos);
+		link_in_len -= link_in_pos;
+		link_in_pos = 0;
+	}
+
+	if (link_in_len == sizeof(link_in_buf)) {
+		return RESULT_FAIL;
+	}
+
+	/* Sleep a bit on the idle link instead of spinning the host CPU. */
+	fds.fd = link_config.rx_fd;
+	fds.events = POLLIN;
+	if (poll(&fds, 1, wait ? 1 : 0) <= 0) {
+		return RESULT_FAIL;
+	}
+
+	rx_bytes = read(link_config.rx_fd, &link_in_buf[link_in_len], sizeof(link_in_buf) - link_in_len);
+	if (rx_bytes > 0) {
+		if (link_in_len == 0) {
+			link_rx_not_before = flashsim_now() + link_config.latency_ns;
+		}
+		link_in_len += rx_bytes;
+		link_stat.rx_bytes += rx_bytes;
+		link_idle_polls = 0;
+		return RESULT_OK;
+	}
+
+	if ((rx_bytes == 0) || ((errno != EAGAIN) && (errno != EINTR))) {
+		link_disconnect();
+		link_idle_polls = 0;
+	}
+
+	return RESULT_FAIL;
+}
+
+/*
+ * Lockstep flasher: every request is sent as its own USB transfer and the next one goes only after the answer
+ * transfer is over (short or zero-length packet on EP2).
+ */
+static u32 link_message_size(const u8 *data, u32 size) {
+	u32 i;
+	u32 bin_size;
+
+	if ((size >= 7) && !memcmp(data, "\x02" "BIN\x1E", 5)) {
+		bin_size = (data[5] << 8) | data[6];
+		return (size >= 5 + 2 + bin_size + 1 + 1) ? (5 + 2 + bin_size + 1 + 1) : 0;
+	}
+
+	for (i = 0; i < size; ++i) {
+		if (data[i] == ETX) {
+			return i + 1;
+		}
+	}
+
+	return 0;
+}
+
+static int link_message_fetch(void) {
+	for (;;) {
+		/* Drop garbage before STX, engine would skip it anyway. */
+		while ((link_in_pos < link_in_len) && (link_in_buf[link_in_pos] != STX)) {
+			link_in_pos++;
+		}
+
+		link_msg_size = link_message_size(&link_in_buf[link_in_pos], link_in_len - link_in_pos);
+		if (link_msg_size != 0) {
+			link_rx_not_before = link_answer_time + link_config.latency_ns;
+			link_stat.requests++;
+			return RESULT_OK;
+		}
+
+		if (link_fill(++link_idle_polls >= LINK_IDLE_POLLS) != RESULT_OK) {
+			return RESULT_FAIL;
+		}
+	}
+}
+
+int link_rx(u8 *packet, u8 size) {
+	u32 pending;
+
+	link_sync();
+	link_tx_service(0);
+
+	if (link_config.mode == LINK_LOCKSTEP) {
+		if (link_msg_size == 0) {
+			/* Wait for the answer, but do not hang forever on requests without one. */
+			if (link_wait_answer && (++link_idle_polls < LINK_IDLE_POLLS)) {
+				return 0;
+			}
+			link_wait_answer = 0;
+
+			if (link_message_fetch() != RESULT_OK) {
+				return (link_rx_eof && (++link_idle_polls >= LINK_IDLE_POLLS)) ? LINK_EOF : 0;
+			}
+
+			link_wait_answer = 1;
+			link_idle_polls = 0;
+		}
+		pending = link_msg_size;
+	} else {
+		if (link_in_pos == link_in_len) {
+			link_in_pos = 0;
+			link_in_len = 0;
+			if (link_fill(++link_idle_polls >= LINK_IDLE_POLLS) != RESULT_OK) {
+				return (link_rx_eof && (link_idle_polls >= LINK_IDLE_POLLS)) ? LINK_EOF : 0;
+			}
+		}
+		pending = link_in_len - link_in_pos;
+	}
+
+	if (pending > size) {
+		pending = size;
+	}
+
+	/* Packet lands in the EP1 FIFO after link latency and its own serialization time. */
+	if (!link_rx_scheduled) {
+		link_rx_ready = (flashsim_now() > link_rx_not_before) ? flashsim_now() : link_rx_not_before;
+		link_rx_ready += link_transfer_ns(pending);
+		link_rx_scheduled = 1;
+	}
+
+	if (flashsim_now() < link_rx_ready) {
+		link_wait(link_rx_ready);
+		if (flashsim_now() < link_rx_ready) {
+			return 0;
+		}
+	}
+
+	memcpy(packet, &link_in_buf[link_in_pos], pending);
+	link_in_pos += pending;
+	if (link_config.mode == LINK_LOCKSTEP) {
+		link_msg_size -= pending;
+	}
+
+	link_rx_scheduled = 0;
+	link_stat.rx_packets++;
+
+	return (int) pending;
+}
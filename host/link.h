@@ -0,0 +1,62 @@
+/*
+ * About:
+ *   USB link model between the flasher and simulated EP1/EP2 endpoints for the host build.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ *
+ * Modes:
+ *   LINK_LOCKSTEP | Requests are parsed from the stream and sent one by one, the next one goes after the answer.
+ *   LINK_STREAM   | Raw byte stream from a pty or socket, bytes are sent to EP1 as soon as they arrive.
+ *
+ * Notes:
+ *   1. Endpoint FIFOs hold one packet of USB_MAX_PACKET_SIZE bytes. EP1 packet is complete after latency and
+ *      serialization time at the link bandwidth, EP2 stays busy while its packet is serialized.
+ *   2. Time is the virtual clock of the flash model. In real-time mode the clock is kept in step with the wall clock.
+ */
+
+#ifndef LINK_H
+#define LINK_H
+
+#include "../platform.h"
+
+/* Clock step while waiting for the link, same idea as the flash polling step. */
+#define LINK_WAIT_STEP_NS              (10000)
+
+#define LINK_EOF                       (-1)
+
+typedef enum {
+	LINK_LOCKSTEP,
+	LINK_STREAM
+} LINK_MODE_T;
+
+typedef struct {
+	LINK_MODE_T mode;
+	int rx_fd;
+	int tx_fd;
+	int listen_fd;
+	u32 bandwidth;
+	u32 latency_ns;
+	int realtime;
+} LINK_CONFIG_T;
+
+typedef struct {
+	u64 rx_bytes;
+	u64 rx_packets;
+	u64 tx_bytes;
+	u64 tx_packets;
+	u64 requests;
+	u64 wait_ns;
+} LINK_STATS_T;
+
+extern int link_init(const LINK_CONFIG_T *config);
+extern int link_rx(u8 *packet, u8 size);
+extern int link_tx(const u8 *packet, u8 len);
+extern void link_flush(void);
+extern void link_activity(void);
+extern const LINK_STATS_T *link_stats(void);
+
+#endif /* !LINK_H */
@@ -0,0 +1,110 @@
+/*
+ * About:
+ *   Host build of Hitagi, runs the real protocol engine against simulated Neptune peripherals.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ *
+ * Usage:
+ *   hitagi_host [-f intel|amd] [-t none|typ|max] [-b bytes_per_second] [-l latency_us]
+ *     [-m flash.bin] [-i flash_in.bin] [-o flash_out.bin] [-s] < requests.bin > answers.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../hal.h"
+
+#include "hal_host.h"
+
+#ifndef HOST_FLASH_MODEL
+#define HOST_FLASH_MODEL               "intel"
+#endif
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-f intel|amd] [-t none|typ|max] [-b bytes_per_second] [-l latency_us]\n", name);
+	fprintf(stderr, "         [-m flash.bin] [-i flash_in.bin] [-o flash_out.bin] [-s]\n");
+	fprintf(stderr, "  Protocol requests are read from stdin, answers are written to stdout.\n");
+	fprintf(stderr, "  -f  flash chip model, default is '%s'.\n", HOST_FLASH_MODEL);
+	fprintf(stderr, "  -t  program and erase times, datasheet typical (default), maximum or none.\n");
+	fprintf(stderr, "  -b  USB link bandwidth in bytes per second, default is unlimited.\n");
+	fprintf(stderr, "  -l  USB link latency in microseconds, default is 0.\n");
+	fprintf(stderr, "  -m  map flash image file, all changes are written to it.\n");
+	fprintf(stderr, "  -i  load flash image before start.\n");
+	fprintf(stderr, "  -o  save flash image on exit.\n");
+	fprintf(stderr, "  -s  print statistics to stderr on exit.\n");
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	const char *flash_model;
+	HAL_HOST_CONFIG_T config;
+
+	flash_model = HOST_FLASH_MODEL;
+
+	config.flash_timing = FLASHSIM_TIMING_TYP;
+	config.image_map = NULL;
+	config.image_in = NULL;
+	config.image_out = NULL;
+	config.link.mode = LINK_LOCKSTEP;
+	config.link.rx_fd = STDIN_FILENO;
+	config.link.tx_fd = STDOUT_FILENO;
+	config.link.listen_fd = -1;
+	config.link.bandwidth = 0;
+	config.link.latency_ns = 0;
+	config.link.realtime = 0;
+	config.stats = 0;
+
+	while ((opt = getopt(argc, argv, "f:t:b:l:m:i:o:sh")) != -1) {
+		switch (opt) {
+			case 'f':
+				flash_model = optarg;
+				break;
+			case 't':
+				if (flashsim_timing(optarg, &config.flash_timing) != RESULT_OK) {
+					fprintf(stderr, "Unknown timing '%s'.\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'b':
+				config.link.bandwidth = (u32) strtoul(optarg, NULL, 0);
+				break;
+			case 'l':
+				config.link.latency_ns = (u32) strtoul(optarg, NULL, 0) * 1000;
+				break;
+			case 'm':
+				config.image_map = optarg;
+				break;
+			case 'i':
+				config.image_in = optarg;
+				break;
+			case 'o':
+				config.image_out = optarg;
+				break;
+			case 's':
+				config.stats = 1;
+				break;
+			default:
+				usage(argv[0]);
+				return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (flashsim_type(flash_model, &config.flash_type) != RESULT_OK) {
+		fprintf(stderr, "Unknown flash model '%s'.\n", flash_model);
+		return EXIT_FAILURE;
+	}
+
+	if (hal_host_init(&config) != RESULT_OK) {
+		return EXIT_FAILURE;
+	}
+
+	/* Never returns, engine leaves through hal_host_exit(). */
+	hitagi_start();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+/*
+ * About:
+ *   TCG plugin of the qemu-armeb harness, counts executed guest instructions per translation block.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ *
+ * Usage:
+ *   qemu-armeb -plugin ./libinsncount.so,out=blocks.txt hitagi_qemu.elf
+ *
+ * Notes:
+ *   1. Output is one "pc instructions executions" line per block, blocks translated more than once are merged.
+ *      Script host/qemu/run.py maps them to the symbols of hitagi.elf.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <qemu-plugin.h>
+
+#define INSNCOUNT_BLOCKS               (65536)
+
+typedef struct {
+	uint64_t pc;
+	uint64_t executions;
+	uint32_t instructions;
+	int used;
+} INSNCOUNT_BLOCK_T;
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+/**
+ * Globals.
+ */
+
+static INSNCOUNT_BLOCK_T insncount_blocks[INSNCOUNT_BLOCKS];
+static const char *insncount_out = "insncount.txt";
+
+/* Open addressing on the block start address, user-mode guest runs one vCPU so there is no locking. */
+static INSNCOUNT_BLOCK_T *insncount_block(uint64_t pc, uint32_t instructions) {
+	uint32_t i;
+	uint32_t slot;
+
+	slot = (uint32_t) (pc >> 2) & (INSNCOUNT_BLOCKS - 1);
+
+	for (i = 0; i < INSNCOUNT_BLOCKS; ++i) {
+		INSNCOUNT_BLOCK_T *block = &insncount_blocks[(slot + i) & (INSNCOUNT_BLOCKS - 1)];
+		if (!block->used) {
+			block->used = 1;
+			block->pc = pc;
+			block->instructions = instructions;
+			return block;
+		}
+		if ((block->pc == pc) && (block->instructions == instructions)) {
+			return block;
+		}
+	}
+
+	fprintf(stderr, "insncount: block table is full\n");
+	exit(EXIT_FAILURE);
+}
+
+static void insncount_exec(unsigned int vcpu_index, void *userdata) {
+	(void) vcpu_index;
+
+	((INSNCOUNT_BLOCK_T *) userdata)->executions++;
+}
+
+static void insncount_translate(qemu_plugin_id_t id, struct qemu_plugin_tb *tb) {
+	INSNCOUNT_BLOCK_T *block;
+
+	(void) id;
+
+	block = insncount_block(qemu_plugin_tb_vaddr(tb), (uint32_t) qemu_plugin_tb_n_insns(tb));
+
+	qemu_plugin_register_vcpu_tb_exec_cb(tb, insncount_exec, QEMU_PLUGIN_CB_NO_REGS, block);
+}
+
+static void insncount_exit(qemu_plugin_id_t id, void *userdata) {
+	uint32_t i;
+	FILE *file;
+
+	(void) id;
+	(void) userdata;
+
+	file = fopen(insncount_out, "w");
+	if (file == NULL) {
+		return;
+	}
+
+	for (i = 0; i < INSNCOUNT_BLOCKS; ++i) {
+		if (insncount_blocks[i].used && insncount_blocks[i].executions) {
+			fprintf(file, "0x%08" PRIx64 " %" PRIu32 " %" PRIu64 "\n",
+				insncount_blocks[i].pc, insncount_blocks[i].instructions, insncount_blocks[i].executions);
+		}
+	}
+
+	fclose(file);
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info, int argc, char **argv) {
+	int i;
+
+	(void) info;
+
+	for (i = 0; i < argc; ++i) {
+		if (!strncmp(argv[i], "out=", 4)) {
+			insncount_out = argv[i] + 4;
+		}
+	}
+
+	qemu_plugin_register_vcpu_tb_trans_cb(id, insncount_translate);
+	qemu_plugin_register_atexit_cb(id, insncount_exit, NULL);
+
+	return 0;
+}
@@ -0,0 +1,547 @@
+/*
+ * About:
+ *   Host side of the qemu-armeb harness. Simulated Neptune peripherals serving MMIO accesses of the stub:
+ *   USB EP1/EP2 registers on top of the link model, watchdog, RTC, UID/REV registers and the flash chip model.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ *
+ * Usage:
+ *   hitagi_periph [-f intel|amd] [-t none|typ|max] [-b bytes_per_second] [-l latency_us]
+ *     [-i flash_in.bin] [-o flash_out.bin] [-s] -- qemu-armeb [qemu options] hitagi_qemu.elf < requests.bin > answers.bin
+ *
+ * Notes:
+ *   1. Command is started with the MMIO socket on PERIPH_GUEST_FD, which is inherited by the guest.
+ *   2. Registers keep guest byte order, flash array keeps 16-bit values as the guest reads them. Flash images
+ *      are converted to the device byte order on load and save.
+ *   3. Answer is two big-endian words: status and data. Non-zero status tells the guest to exit with data as the
+ *      exit code, so qemu and its plugins finish properly. It is sent on watchdog reboot or shutdown, after the
+ *      link is idle on EOF or on bad access.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../platform.h"
+#include "../../regs_neptune.h"
+#include "../../hal.h"
+
+#include "../flashsim.h"
+#include "../link.h"
+
+#ifndef HOST_FLASH_MODEL
+#define HOST_FLASH_MODEL               "intel"
+#endif
+
+#define PERIPH_GUEST_FD                (3)
+
+#define PERIPH_OP_READ                 (0)
+#define PERIPH_OP_WRITE                (1)
+
+#define PERIPH_FLASH_START             (0x10000000)
+#define PERIPH_WINDOW_START            (0x24840000)
+#define PERIPH_WINDOW_END              (0x24860000)
+
+#define PERIPH_REG(addr)               ((u32) (addr) - PERIPH_WINDOW_START)
+#define PERIPH_USB_START               (0x24852000)
+#define PERIPH_USB_END                 (0x24852100)
+
+#define USB_INT_EP1                    (1 << 5)
+#define USB_INT_EP2                    (1 << 6)
+#define USB_CR_XFREN                   (1 << 10)
+#define USB_CR_IEOFC                   (1 << 13)
+
+#define WCR_NOT_SW_RESET               (0x0010)
+#define WCR_WD_NOT_ASSERTED            (0x0020)
+
+/**
+ * Functions.
+ */
+
+static void usage(const char *name);
+static u32 periph_reg_read(u32 offset, u32 size);
+static void periph_reg_write(u32 offset, u32 size, u32 data);
+static void periph_usb_service(void);
+static u32 periph_flash_read(u32 offset, u32 size);
+static void periph_flash_write(u32 offset, u32 size, u32 data);
+static u32 periph_access(u32 op, u32 size, u32 addr, u32 data);
+static int periph_image_load(const char *path);
+static int periph_image_save(const char *path);
+static void periph_stop(int code);
+static void periph_exit(int code);
+static int periph_spawn(char *argv[]);
+
+/**
+ * Globals.
+ */
+
+static u8 periph_regs[PERIPH_WINDOW_END - PERIPH_WINDOW_START];
+static u16 *periph_flash;
+
+static int periph_fd = -1;
+static pid_t periph_child = -1;
+static const char *periph_image_out;
+static int periph_stats_enabled;
+static int periph_finish = -1;
+
+static int periph_ep2_pending;
+static u8 periph_ep2_len;
+
+static u64 periph_mmio_count;
+static u64 periph_watchdog_count;
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-f intel|amd] [-t none|typ|max] [-b bytes_per_second] [-l latency_us]\n", name);
+	fprintf(stderr, "         [-i flash_in.bin] [-o flash_out.bin] [-s] -- qemu-armeb [options] hitagi_qemu.elf\n");
+	fprintf(stderr, "  Protocol requests are read from stdin, answers are written to stdout.\n");
+	fprintf(stderr, "  -f  flash chip model, default is '%s'.\n", HOST_FLASH_MODEL);
+	fprintf(stderr, "  -t  program and erase times, datasheet typical (default), maximum or none.\n");
+	fprintf(stderr, "  -b  USB link bandwidth in bytes per second, default is unlimited.\n");
+	fprintf(stderr, "  -l  USB link latency in microseconds, default is 0.\n");
+	fprintf(stderr, "  -i  load flash image before start.\n");
+	fprintf(stderr, "  -o  save flash image on exit.\n");
+	fprintf(stderr, "  -s  print statistics to stderr on exit.\n");
+}
+
+/**
+ * Register section.
+ */
+
+static u32 periph_reg_read(u32 offset, u32 size) {
+	u32 i;
+	u32 data;
+
+	data = 0;
+	for (i = 0; i < size; ++i) {
+		data = (data << 8) | periph_regs[offset + i];
+	}
+
+	return data;
+}
+
+static void periph_reg_write(u32 offset, u32 size, u32 data) {
+	u32 i;
+
+	for (i = size; i > 0; --i) {
+		periph_regs[offset + i - 1] = (u8) data;
+		data >>= 8;
+	}
+}
+
+/*
+ * EP1: next packet from the link is placed into the RX buffer and raises EP1_int, IEOFC write releases it.
+ * EP2: XFREN write starts the transfer of the TX buffer, EP2_int is raised and XFREN dropped when it is sent.
+ */
+static void periph_usb_service(void) {
+	int rx_bytes;
+	u16 usb_int;
+	u8 packet[USB_MAX_PACKET_SIZE];
+
+	usb_int = (u16) periph_reg_read(PERIPH_REG(&USB_INT), 2);
+
+	if (!(usb_int & USB_INT_EP1)) {
+		rx_bytes = link_rx(packet, USB_MAX_PACKET_SIZE);
+		if (rx_bytes == LINK_EOF) {
+			periph_stop(EXIT_SUCCESS);
+			return;
+		}
+		if (rx_bytes > 0) {
+			memcpy(&periph_regs[PERIPH_REG(USB_E1_RX_HW_BUFFER)], packet, rx_bytes);
+			periph_reg_write(PERIPH_REG(&USB_E1_CR), 2, (periph_reg_read(PERIPH_REG(&USB_E1_CR), 2) & ~0x3F) | rx_bytes);
+			usb_int |= USB_INT_EP1;
+		}
+	}
+
+	if (periph_ep2_pending) {
+		if (link_tx(&periph_regs[PERIPH_REG(USB_E2_TX_HW_BUFFER)], periph_ep2_len) == RESULT_OK) {
+			periph_ep2_pending = 0;
+			periph_reg_write(PERIPH_REG(&USB_E2_CR), 2, periph_reg_read(PERIPH_REG(&USB_E2_CR), 2) & ~USB_CR_XFREN);
+			usb_int |= USB_INT_EP2;
+		}
+	}
+
+	periph_reg_write(PERIPH_REG(&USB_INT), 2, usb_int);
+}
+
+/**
+ * Flash section.
+ */
+
+static u32 periph_flash_read(u32 offset, u32 size) {
+	u16 word;
+
+	link_activity();
+
+	if (size == 4) {
+		return ((u32) flashsim_read(offset) << 16) | flashsim_read(offset + 2);
+	}
+
+	word = flashsim_read(offset & ~1);
+	if (size == 1) {
+		return (offset & 1) ? (word & 0xFF) : (word >> 8);
+	}
+
+	return word;
+}
+
+static void periph_flash_write(u32 offset, u32 size, u32 data) {
+	link_activity();
+
+	if (size == 4) {
+		flashsim_write(offset, (u16) (data >> 16));
+		flashsim_write(offset + 2, (u16) data);
+	} else if (size == 2) {
+		flashsim_write(offset, (u16) data);
+	} else {
+		fprintf(stderr, "periph: byte write 0x%02X to flash at 0x%08X ignored\n", data, PERIPH_FLASH_START + offset);
+	}
+}
+
+static u32 periph_access(u32 op, u32 size, u32 addr, u32 data) {
+	u32 offset;
+	u16 old;
+
+	periph_mmio_count++;
+
+	if ((addr >= PERIPH_FLASH_START) && (addr + size <= PERIPH_FLASH_START + FLASHSIM_SIZE)) {
+		offset = addr - PERIPH_FLASH_START;
+		if (op == PERIPH_OP_READ) {
+			return periph_flash_read(offset, size);
+		}
+		periph_flash_write(offset, size, data);
+		return 0;
+	}
+
+	if ((addr < PERIPH_WINDOW_START) || (addr + size > PERIPH_WINDOW_END)) {
+		fprintf(stderr, "periph: access out of windows at 0x%08X\n", addr);
+		periph_stop(EXIT_FAILURE);
+		return 0;
+	}
+
+	flashsim_advance(FLASHSIM_BUS_CYCLE_NS);
+
+	offset = PERIPH_REG(addr);
+
+	if ((addr >= PERIPH_USB_START) && (addr < PERIPH_USB_END)) {
+		periph_usb_service();
+	}
+
+	if (op == PERIPH_OP_READ) {
+		/* GPT counter follows the modeled time. */
+		if (offset == PERIPH_REG(&GPT_TCN)) {
+			return (u32) (flashsim_now() * HAL_TIMER_HZ / 1000000000ULL);
+		}
+		return periph_reg_read(offset, size);
+	}
+
+	old = (u16) periph_reg_read(offset, 2);
+
+	if (offset == PERIPH_REG(&USB_E1_CR)) {
+		if (data & USB_CR_IEOFC) {
+			periph_reg_write(PERIPH_REG(&USB_INT), 2, periph_reg_read(PERIPH_REG(&USB_INT), 2) & ~USB_INT_EP1);
+		}
+		data &= ~USB_CR_IEOFC;
+	} else if (offset == PERIPH_REG(&USB_E2_CR)) {
+		if (data & USB_CR_IEOFC) {
+			periph_reg_write(PERIPH_REG(&USB_INT), 2, periph_reg_read(PERIPH_REG(&USB_INT), 2) & ~USB_INT_EP2);
+		}
+		data &= ~USB_CR_IEOFC;
+		if ((data & USB_CR_XFREN) && !(old & USB_CR_XFREN) && !periph_ep2_pending) {
+			periph_ep2_pending = 1;
+			periph_ep2_len = data & 0x3F;
+		}
+	} else if (offset == PERIPH_REG(&WATCHDOG_WSR)) {
+		if (data == 0xAAAA) {
+			periph_watchdog_count++;
+		}
+	} else if (offset == PERIPH_REG(&WATCHDOG_WCR)) {
+		if ((old & WCR_NOT_SW_RESET) && !(data & WCR_NOT_SW_RESET)) {
+			fprintf(stderr, "periph: watchdog reboot\n");
+			periph_stop(EXIT_SUCCESS);
+		}
+		if ((old & WCR_WD_NOT_ASSERTED) && !(data & WCR_WD_NOT_ASSERTED)) {
+			fprintf(stderr, "periph: watchdog shutdown\n");
+			periph_stop(EXIT_SUCCESS);
+		}
+	}
+
+	periph_reg_write(offset, size, data);
+
+	if ((addr >= PERIPH_USB_START) && (addr < PERIPH_USB_END)) {
+		periph_usb_service();
+	}
+
+	return 0;
+}
+
+/**
+ * Session section.
+ */
+
+static int periph_image_load(const char *path) {
+	u32 i;
+	FILE *file;
+	size_t size;
+	u8 *bytes;
+
+	file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "periph: cannot open '%s': %s\n", path, strerror(errno));
+		return RESULT_FAIL;
+	}
+
+	bytes = (u8 *) periph_flash;
+	size = fread(bytes, 1, FLASHSIM_SIZE, file);
+	fclose(file);
+
+	for (i = 0; i < size / 2; ++i) {
+		periph_flash[i] = (u16) ((bytes[i * 2] << 8) | bytes[i * 2 + 1]);
+	}
+
+	fprintf(stderr, "periph: loaded %zu bytes of flash image from '%s'\n", size, path);
+
+	return RESULT_OK;
+}
+
+static int periph_image_save(const char *path) {
+	u32 i;
+	FILE *file;
+	u8 word[2];
+
+	file = fopen(path, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "periph: cannot create '%s': %s\n", path, strerror(errno));
+		return RESULT_FAIL;
+	}
+
+	for (i = 0; i < FLASHSIM_SIZE / 2; ++i) {
+		word[0] = (u8) (periph_flash[i] >> 8);
+		word[1] = (u8) periph_flash[i];
+		fwrite(word, 1, sizeof(word), file);
+	}
+	fclose(file);
+
+	return RESULT_OK;
+}
+
+static void periph_stop(int code) {
+	if (periph_finish < 0) {
+		periph_finish = code;
+	}
+}
+
+static void periph_exit(int code) {
+	const FLASHSIM_STATS_T *flash_stats;
+	const LINK_STATS_T *link_stat;
+
+	/* Transfer started by the guest is finished by the controller even when the CPU goes to reset. */
+	while (periph_ep2_pending && (periph_fd >= 0)) {
+		periph_usb_service();
+	}
+
+	link_flush();
+
+	if (periph_child > 0) {
+		waitpid(periph_child, NULL, 0);
+	}
+
+	if (periph_image_out != NULL) {
+		periph_image_save(periph_image_out);
+	}
+
+	if (periph_stats_enabled) {
+		flash_stats = flashsim_stats();
+		link_stat = link_stats();
+		fprintf(stderr, "flash_chip:         %s\n", flashsim_name());
+		fprintf(stderr, "usb_requests:       %llu\n", (unsigned long long) link_stat->requests);
+		fprintf(stderr, "usb_rx_bytes:       %llu\n", (unsigned long long) link_stat->rx_bytes);
+		fprintf(stderr, "usb_tx_bytes:       %llu\n", (unsigned long long) link_stat->tx_bytes);
+		fprintf(stderr, "flash_reads:        %u\n", flash_stats->reads);
+		fprintf(stderr, "flash_writes:       %u\n", flash_stats->writes);
+		fprintf(stderr, "flash_busy_polls:   %u\n", flash_stats->busy_polls);
+		fprintf(stderr, "flash_program_ops:  %u\n", flash_stats->program_operations);
+		fprintf(stderr, "flash_erased:       %u\n", flash_stats->erased_blocks);
+		fprintf(stderr, "flash_errors:       %u\n", flash_stats->errors);
+		fprintf(stderr, "mmio_operations:    %llu\n", (unsigned long long) periph_mmio_count);
+		fprintf(stderr, "watchdog_services:  %llu\n", (unsigned long long) periph_watchdog_count);
+		fprintf(stderr, "modeled_seconds:    %.6f\n", flashsim_now() / 1e9);
+	}
+
+	exit(code);
+}
+
+static int periph_spawn(char *argv[]) {
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		perror("periph: cannot create socket pair");
+		return RESULT_FAIL;
+	}
+
+	periph_child = fork();
+	if (periph_child < 0) {
+		perror("periph: cannot fork");
+		return RESULT_FAIL;
+	}
+
+	if (periph_child == 0) {
+		close(sv[0]);
+		if (sv[1] != PERIPH_GUEST_FD) {
+			dup2(sv[1], PERIPH_GUEST_FD);
+			close(sv[1]);
+		}
+		/* Guest must not touch the link, its own output goes to stderr. */
+		close(STDIN_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+		execvp(argv[0], argv);
+		perror("periph: cannot run command");
+		_exit(EXIT_FAILURE);
+	}
+
+	close(sv[1]);
+	periph_fd = sv[0];
+
+	return RESULT_OK;
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	u32 i;
+	u32 message[3];
+	u8 answer[8];
+	u8 *bytes;
+	ssize_t res;
+	const char *flash_model;
+	const char *image_in;
+	FLASHSIM_TYPE_T flash_type;
+	FLASHSIM_TIMING_T flash_timing;
+	LINK_CONFIG_T link;
+	volatile u16 *uid;
+
+	flash_model = HOST_FLASH_MODEL;
+	flash_timing = FLASHSIM_TIMING_TYP;
+	image_in = NULL;
+
+	link.mode = LINK_LOCKSTEP;
+	link.rx_fd = STDIN_FILENO;
+	link.tx_fd = STDOUT_FILENO;
+	link.listen_fd = -1;
+	link.bandwidth = 0;
+	link.latency_ns = 0;
+	link.realtime = 0;
+
+	while ((opt = getopt(argc, argv, "+f:t:b:l:i:o:sh")) != -1) {
+		switch (opt) {
+			case 'f':
+				flash_model = optarg;
+				break;
+			case 't':
+				if (flashsim_timing(optarg, &flash_timing) != RESULT_OK) {
+					fprintf(stderr, "Unknown timing '%s'.\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'b':
+				link.bandwidth = (u32) strtoul(optarg, NULL, 0);
+				break;
+			case 'l':
+				link.latency_ns = (u32) strtoul(optarg, NULL, 0) * 1000;
+				break;
+			case 'i':
+				image_in = optarg;
+				break;
+			case 'o':
+				periph_image_out = optarg;
+				break;
+			case 's':
+				periph_stats_enabled = 1;
+				break;
+			default:
+				usage(argv[0]);
+				return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (flashsim_type(flash_model, &flash_type) != RESULT_OK) {
+		fprintf(stderr, "Unknown flash model '%s'.\n", flash_model);
+		return EXIT_FAILURE;
+	}
+
+	periph_flash = flashsim_map((void *) (unsigned long) PERIPH_FLASH_START, NULL);
+	if (periph_flash == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	if ((image_in != NULL) && (periph_image_load(image_in) != RESULT_OK)) {
+		return EXIT_FAILURE;
+	}
+
+	flashsim_init(flash_type, flash_timing, periph_flash);
+
+	/* Fake UID of the non-secure part and REV of Neptune LTE ROM, SPS Hip7, Pass 2. */
+	uid = NEPTUNE_UID_REG_ADDR;
+	for (i = 0; i < 8; ++i) {
+		periph_reg_write(PERIPH_REG(&uid[i]), 2, (i == 7) ? 0x8000 : (0x4854 + i));
+	}
+	periph_reg_write(PERIPH_REG(NEPTUNE_REV_REG_ADDR), 2, 0x9201);
+
+	link_init(&link);
+
+	if (periph_spawn(&argv[optind]) != RESULT_OK) {
+		return EXIT_FAILURE;
+	}
+
+	for (;;) {
+		bytes = (u8 *) message;
+		for (i = 0; i < sizeof(message); i += res) {
+			res = read(periph_fd, bytes + i, sizeof(message) - i);
+			if (res <= 0) {
+				if ((res < 0) && (errno == EINTR)) {
+					res = 0;
+					continue;
+				}
+				fprintf(stderr, "periph: guest has exited\n");
+				periph_exit(EXIT_FAILURE);
+			}
+		}
+
+		/* Words of the request are big-endian, as the guest stored them. */
+		for (i = 0; i < 3; ++i) {
+			message[i] = ((u32) bytes[i * 4] << 24) | (bytes[i * 4 + 1] << 16) | (bytes[i * 4 + 2] << 8) | bytes[i * 4 + 3];
+		}
+
+		message[2] = periph_access(message[0] >> 8, message[0] & 0xFF, message[1], message[2]);
+
+		if (periph_finish >= 0) {
+			message[2] = (u32) periph_finish;
+		}
+
+		memset(answer, 0, sizeof(answer));
+		answer[3] = (periph_finish >= 0) ? 1 : 0;
+		answer[4] = (u8) (message[2] >> 24);
+		answer[5] = (u8) (message[2] >> 16);
+		answer[6] = (u8) (message[2] >> 8);
+		answer[7] = (u8) message[2];
+
+		if ((write(periph_fd, answer, sizeof(answer)) != sizeof(answer)) || (periph_finish >= 0)) {
+			periph_exit((periph_finish >= 0) ? periph_finish : EXIT_FAILURE);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+#
+# About:
+#   Runs the shipped Hitagi binary under qemu-armeb on simulated peripherals and counts guest instructions
+#   of the benchmark sessions per function of hitagi.elf.
+#
+# Author:
+#   EXL
+#
+# License:
+#   MIT
+#
+# Usage:
+#   run.py [--qemu qemu-armeb] [--flash intel] [--size 0x10000] [--filter rqrc] [--top 10] [--json qemu.json]
+#
+
+import argparse
+import bisect
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+
+import bench
+
+def symbols(nm, elf):
+	result = []
+	output = subprocess.run([nm, '-n', elf], capture_output=True, check=True).stdout.decode()
+	for line in output.splitlines():
+		fields = line.split()
+		if len(fields) == 3 and fields[1] in 'tTwW':
+			result.append((int(fields[0], 16), fields[2]))
+	return result
+
+def symbolize(table, pc):
+	index = bisect.bisect_right([address for address, _ in table], pc) - 1
+	return table[index][1] if index >= 0 else f'0x{pc:08X}'
+
+def run(args, table, name, payload, requests):
+	with tempfile.NamedTemporaryFile(suffix='.txt') as blocks:
+		command = [
+			args.periph, '-f', args.flash, '-t', args.timing, '-s', '--',
+			args.qemu, '-plugin', f'{args.plugin},out={blocks.name}', args.stub
+		]
+		process = subprocess.run(command, input=requests, capture_output=True)
+		if process.returncode != 0:
+			raise RuntimeError(f'{name}: {" ".join(command)} failed:\n{process.stderr.decode()}')
+
+		functions = {}
+		total = 0
+		with open(blocks.name, 'r') as f:
+			for line in f:
+				pc, instructions, executions = line.split()
+				count = int(instructions) * int(executions)
+				function = symbolize(table, int(pc, 16))
+				functions[function] = functions.get(function, 0) + count
+				total += count
+
+	answer = process.stdout
+	if payload == 0:
+		payload = len(answer)
+
+	return {
+		'session': name,
+		'payload_bytes': payload,
+		'errors': answer.count(bench.STX + b'ERR' + bench.RS),
+		'instructions': total,
+		'instructions_per_byte': total / payload if payload else 0.0,
+		'functions': dict(sorted(functions.items(), key=lambda item: item[1], reverse=True)),
+	}
+
+def report(results, top):
+	for r in results:
+		print(f'{r["session"]}: {r["instructions"]} instructions, {r["instructions_per_byte"]:.2f} per byte, {r["errors"]} errors')
+		for function, count in list(r['functions'].items())[:top]:
+			print(f'  {function:<32} {count:>12} {100.0 * count / r["instructions"]:>6.1f}%')
+
+def main():
+	parser = argparse.ArgumentParser(description='Hitagi instruction counts under qemu-armeb.')
+	parser.add_argument('--qemu', default='qemu-armeb', help='qemu user-mode emulator for big-endian ARM')
+	parser.add_argument('--elf', default='hitagi.elf', help='shipped ELF for symbols')
+	parser.add_argument('--stub', default='hitagi_qemu.elf', help='harness stub with the shipped binary')
+	parser.add_argument('--periph', default='./hitagi_periph', help='simulated peripherals process')
+	parser.add_argument('--plugin', default='host/qemu/libinsncount.so', help='instruction counting TCG plugin')
+	parser.add_argument('--nm', default='arm-none-eabi-nm', help='nm of the cross toolchain')
+	parser.add_argument('--flash', default='intel', help='flash chip model, intel or amd')
+	parser.add_argument('--timing', default='none', help='program and erase times, none, typ or max')
+	parser.add_argument('--size', default=0x10000, type=lambda x: int(x, 0), help='image and dump size in bytes')
+	parser.add_argument('--filter', default='', help='run only sessions with names containing this string')
+	parser.add_argument('--top', default=10, type=int, help='functions to show per session')
+	parser.add_argument('--json', help='write results to JSON file')
+	args = parser.parse_args()
+
+	table = symbols(args.nm, args.elf)
+
+	results = []
+	for name, payload, requests in bench.sessions(args.size):
+		if args.filter in name:
+			results.append(run(args, table, name, payload, requests))
+
+	report(results, args.top)
+
+	if args.json:
+		with open(args.json, 'w') as f:
+			json.dump({'flash': args.flash, 'size': args.size, 'sessions': results}, f, indent='\t')
+
+	return 1 if any(r['errors'] for r in results) else 0
+
+if __name__ == '__main__':
+	sys.exit(main())
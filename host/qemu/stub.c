@@ -0,0 +1,451 @@
+/*
+ * About:
+ *   Guest side of the qemu-armeb harness. Runs the shipped Hitagi binary at its fixed origin in user-mode qemu
+ *   and forwards accesses of the flash and peripheral windows to the simulated peripheral process.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ *
+ * Notes:
+ *   1. Image is the exact `hitagi.bin` included at STUB_IMAGE_ORIGIN inside of the IRAM section, see stub.lds.
+ *   2. RAM is mapped by the stub, flash and peripheral windows are left unmapped. Every access to them faults,
+ *      the SIGSEGV handler decodes the ARM or Thumb load/store instruction, asks the peripheral process over
+ *      STUB_PERIPH_FD, writes back the result and steps over the instruction.
+ *   3. Request is three big-endian words: (operation << 8) | size, address, data. Answer is status and data words,
+ *      non-zero status ends the session with data as the exit code.
+ */
+
+#include "../../platform.h"
+
+#define STUB_PERIPH_FD                 (3)
+
+#define STUB_RAM_START                 (0x12000000)
+#define STUB_RAM_SIZE                  (0x02000000)
+
+#define STUB_OP_READ                   (0)
+#define STUB_OP_WRITE                  (1)
+
+#define SYS_EXIT                       (1)
+#define SYS_READ                       (3)
+#define SYS_WRITE                      (4)
+#define SYS_RT_SIGRETURN               (173)
+#define SYS_RT_SIGACTION               (174)
+#define SYS_MMAP2                      (192)
+#define SYS_EXIT_GROUP                 (248)
+
+#define SIGSEGV                        (11)
+#define SIGBUS                         (7)
+#define SA_SIGINFO                     (0x00000004)
+#define SA_RESTORER                    (0x04000000)
+
+#define PROT_ALL                       (0x7)
+#define MAP_PRIVATE_ANONYMOUS_FIXED    (0x02 | 0x20 | 0x10)
+
+#define CPSR_THUMB                     (1 << 5)
+
+#define STUB_STRING(x)                 STUB_STRING_(x)
+#define STUB_STRING_(x)                #x
+
+typedef struct {
+	void (*handler)(int, void *, void *);
+	u32 flags;
+	void (*restorer)(void);
+	u32 mask[2];
+} STUB_SIGACTION_T;
+
+/* Linux ARM ucontext up to the end of sigcontext. */
+typedef struct {
+	u32 uc_flags;
+	u32 uc_link;
+	u32 ss_sp;
+	u32 ss_flags;
+	u32 ss_size;
+	u32 trap_no;
+	u32 error_code;
+	u32 oldmask;
+	u32 regs[16];
+	u32 cpsr;
+	u32 fault_address;
+} STUB_UCONTEXT_T;
+
+/**
+ * Functions.
+ */
+
+static long stub_syscall(long nr, long a0, long a1, long a2, long a3, long a4, long a5);
+static void stub_print(const char *str);
+static void stub_die(const char *str);
+static u32 stub_periph(u32 op, u32 size, u32 addr, u32 data);
+static u32 stub_shift(u32 value, u32 type, u32 amount, u32 cpsr);
+static void stub_block(STUB_UCONTEXT_T *uc, u32 insn);
+static void stub_thumb(STUB_UCONTEXT_T *uc);
+static void stub_fault(int sig, void *info, void *context);
+static void __attribute__((naked)) stub_restorer(void);
+void __attribute__((naked)) _start(void);
+void stub_main(void);
+
+/* Shipped binary, exactly as it is sent to the phone. */
+asm (
+	".section .image, \"awx\"\n"
+	".incbin \"" STUB_IMAGE "\"\n"
+	".previous\n"
+);
+
+/**
+ * System section.
+ */
+
+static long stub_syscall(long nr, long a0, long a1, long a2, long a3, long a4, long a5) {
+	register long r0 asm("r0") = a0;
+	register long r1 asm("r1") = a1;
+	register long r2 asm("r2") = a2;
+	register long r3 asm("r3") = a3;
+	register long r4 asm("r4") = a4;
+	register long r5 asm("r5") = a5;
+	register long r7 asm("r7") = nr;
+
+	asm volatile (
+		"svc #0\n"
+		: "+r" (r0)
+		: "r" (r1), "r" (r2), "r" (r3), "r" (r4), "r" (r5), "r" (r7)
+		: "memory"
+	);
+
+	return r0;
+}
+
+static void stub_print(const char *str) {
+	u32 len;
+
+	for (len = 0; str[len] != '\0'; ++len) {
+		;
+	}
+
+	stub_syscall(SYS_WRITE, 2, (long) str, len, 0, 0, 0);
+}
+
+static void stub_die(const char *str) {
+	stub_print(str);
+	stub_syscall(SYS_EXIT, 1, 0, 0, 0, 0, 0);
+}
+
+/**
+ * Peripheral section.
+ */
+
+static u32 stub_periph(u32 op, u32 size, u32 addr, u32 data) {
+	u32 i;
+	long res;
+	u32 message[3];
+	u32 answer[2];
+
+	message[0] = (op << 8) | size;
+	message[1] = addr;
+	message[2] = data;
+
+	if (stub_syscall(SYS_WRITE, STUB_PERIPH_FD, (long) message, sizeof(message), 0, 0, 0) != sizeof(message)) {
+		stub_die("stub: peripheral process is gone\n");
+	}
+
+	for (i = 0; i < sizeof(answer); i += res) {
+		res = stub_syscall(SYS_READ, STUB_PERIPH_FD, (long) ((u8 *) answer + i), sizeof(answer) - i, 0, 0, 0);
+		if (res <= 0) {
+			stub_die("stub: peripheral process is gone\n");
+		}
+	}
+
+	if (answer[0] != 0) {
+		stub_syscall(SYS_EXIT_GROUP, answer[1], 0, 0, 0, 0, 0);
+	}
+
+	return answer[1];
+}
+
+/**
+ * Fault section.
+ */
+
+/* Immediate shift of the register offset, ARM ARM A5.2.4. */
+static u32 stub_shift(u32 value, u32 type, u32 amount, u32 cpsr) {
+	switch (type) {
+		case 0:
+			return value << amount;
+		case 1:
+			return (amount == 0) ? 0 : (value >> amount);
+		case 2:
+			if (amount == 0) {
+				return (value & 0x80000000) ? 0xFFFFFFFF : 0;
+			}
+			return (u32) ((s32) value >> amount);
+		default:
+			if (amount == 0) {
+				return ((cpsr & (1 << 29)) << 2) | (value >> 1);
+			}
+			return (value >> amount) | (value << (32 - amount));
+	}
+}
+
+/*
+ * Block transfer of words, ARM ARM A5.4: LDM/STM | cond 100 P U S W L Rn register_list
+ */
+static void stub_block(STUB_UCONTEXT_T *uc, u32 insn) {
+	u32 i;
+	u32 rn;
+	u32 addr;
+	u32 count;
+	u32 list;
+
+	rn = (insn >> 16) & 0xF;
+	list = insn & 0xFFFF;
+
+	if ((list & (1 << 15)) || (insn & (1 << 22))) {
+		stub_die("stub: LDM/STM with PC or user registers is not supported\n");
+	}
+
+	for (i = 0, count = 0; i < 16; ++i) {
+		count += (list >> i) & 1;
+	}
+
+	/* Lowest register always goes to the lowest address. */
+	if (insn & (1 << 23)) {
+		addr = uc->regs[rn] + ((insn & (1 << 24)) ? 4 : 0);
+	} else {
+		addr = uc->regs[rn] - (count * 4) + ((insn & (1 << 24)) ? 0 : 4);
+	}
+
+	if (insn & (1 << 21)) {
+		uc->regs[rn] += (insn & (1 << 23)) ? (count * 4) : -(count * 4);
+	}
+
+	for (i = 0; i < 16; ++i, list >>= 1) {
+		if (list & 1) {
+			if (insn & (1 << 20)) {
+				uc->regs[i] = stub_periph(STUB_OP_READ, 4, addr, 0);
+			} else {
+				stub_periph(STUB_OP_WRITE, 4, addr, uc->regs[i]);
+			}
+			addr += 4;
+		}
+	}
+}
+
+/*
+ * Emulates the faulted Thumb load or store of the cold code, ARM ARM A7.1:
+ *   LDR/STR/LDRB/STRB         | 0101 L B 0 Ro Rb Rd
+ *   LDRH/STRH/LDSB/LDSH       | 0101 H S 1 Ro Rb Rd
+ *   LDR/STR/LDRB/STRB         | 011 B L offset5 Rb Rd
+ *   LDRH/STRH                 | 1000 L offset5 Rb Rd
+ *   LDMIA/STMIA               | 1100 L Rb register_list
+ */
+static void stub_thumb(STUB_UCONTEXT_T *uc) {
+	u32 i;
+	u32 insn;
+	u32 addr;
+	u32 size;
+	u32 data;
+	u32 rb;
+	u32 rd;
+	u32 sign;
+	u32 load;
+
+	insn = *(u16 *) uc->regs[15];
+	rb = (insn >> 3) & 7;
+	rd = insn & 7;
+	sign = 0;
+
+	if ((insn & 0xF200) == 0x5000) {
+		addr = uc->regs[rb] + uc->regs[(insn >> 6) & 7];
+		size = (insn & (1 << 10)) ? 1 : 4;
+		load = (insn >> 11) & 1;
+	} else if ((insn & 0xF200) == 0x5200) {
+		addr = uc->regs[rb] + uc->regs[(insn >> 6) & 7];
+		sign = (insn >> 10) & 1;
+		size = (sign && !(insn & (1 << 11))) ? 1 : 2;
+		load = sign || (insn & (1 << 11));
+	} else if ((insn & 0xE000) == 0x6000) {
+		size = (insn & (1 << 12)) ? 1 : 4;
+		addr = uc->regs[rb] + ((insn >> 6) & 0x1F) * size;
+		load = (insn >> 11) & 1;
+	} else if ((insn & 0xF000) == 0x8000) {
+		size = 2;
+		addr = uc->regs[rb] + ((insn >> 6) & 0x1F) * size;
+		load = (insn >> 11) & 1;
+	} else if ((insn & 0xF000) == 0xC000) {
+		rb = (insn >> 8) & 7;
+		addr = uc->regs[rb];
+		load = (insn >> 11) & 1;
+		for (i = 0; i < 8; ++i) {
+			if (!(insn & (1 << i))) {
+				continue;
+			}
+			if (load) {
+				uc->regs[i] = stub_periph(STUB_OP_READ, 4, addr, 0);
+			} else {
+				stub_periph(STUB_OP_WRITE, 4, addr, uc->regs[i]);
+			}
+			addr += 4;
+		}
+		/* Loaded base register keeps the loaded value. */
+		if (!load || !(insn & (1 << rb))) {
+			uc->regs[rb] = addr;
+		}
+		uc->regs[15] += 2;
+		return;
+	} else {
+		stub_die("stub: unsupported Thumb MMIO instruction\n");
+		return;
+	}
+
+	if (load) {
+		data = stub_periph(STUB_OP_READ, size, addr, 0);
+		if (sign && (size == 1)) {
+			data = (u32) (s32) (s8) data;
+		} else if (sign && (size == 2)) {
+			data = (u32) (s32) (s16) data;
+		}
+		uc->regs[rd] = data;
+	} else {
+		data = uc->regs[rd];
+		if (size == 1) {
+			data &= 0xFF;
+		} else if (size == 2) {
+			data &= 0xFFFF;
+		}
+		stub_periph(STUB_OP_WRITE, size, addr, data);
+	}
+
+	uc->regs[15] += 2;
+}
+
+/*
+ * Emulates the faulted ARM load or store:
+ *   LDR/STR/LDRB/STRB         | cond 01 I P U B W L Rn Rd offset
+ *   LDRH/STRH/LDRSB/LDRSH     | cond 000 P U I W L Rn Rd offset_hi 1 S H 1 offset_lo
+ *   LDM/STM                   | cond 100 P U S W L Rn register_list
+ */
+static void stub_fault(int sig, void *info, void *context) {
+	u32 insn;
+	u32 base;
+	u32 offset;
+	u32 addr;
+	u32 size;
+	u32 data;
+	u32 rn;
+	u32 rd;
+	u32 sign;
+	u32 load;
+	STUB_UCONTEXT_T *uc;
+
+	UNUSED(sig);
+	UNUSED(info);
+
+	uc = (STUB_UCONTEXT_T *) context;
+
+	if (uc->cpsr & CPSR_THUMB) {
+		stub_thumb(uc);
+		return;
+	}
+
+	insn = *(u32 *) uc->regs[15];
+	rn = (insn >> 16) & 0xF;
+	rd = (insn >> 12) & 0xF;
+	load = (insn >> 20) & 1;
+	sign = 0;
+
+	if ((insn & 0x0E000000) == 0x08000000) {
+		stub_block(uc, insn);
+		uc->regs[15] += 4;
+		return;
+	} else if ((insn & 0x0C000000) == 0x04000000) {
+		size = (insn & (1 << 22)) ? 1 : 4;
+		if (insn & (1 << 25)) {
+			offset = stub_shift(uc->regs[insn & 0xF], (insn >> 5) & 3, (insn >> 7) & 0x1F, uc->cpsr);
+		} else {
+			offset = insn & 0xFFF;
+		}
+	} else if (((insn & 0x0E000090) == 0x00000090) && ((insn & 0x60) != 0)) {
+		size = (((insn >> 5) & 3) == 2) ? 1 : 2;
+		sign = (insn >> 6) & 1;
+		if (insn & (1 << 22)) {
+			offset = ((insn >> 4) & 0xF0) | (insn & 0xF);
+		} else {
+			offset = uc->regs[insn & 0xF];
+		}
+	} else {
+		stub_die("stub: unsupported MMIO instruction\n");
+		return;
+	}
+
+	base = (rn == 15) ? (uc->regs[15] + 8) : uc->regs[rn];
+	if (!(insn & (1 << 23))) {
+		offset = -offset;
+	}
+
+	addr = (insn & (1 << 24)) ? (base + offset) : base;
+
+	/* Post-indexed always writes the base back, pre-indexed only with W bit. */
+	if (!(insn & (1 << 24)) || (insn & (1 << 21))) {
+		uc->regs[rn] = base + offset;
+	}
+
+	if (load) {
+		data = stub_periph(STUB_OP_READ, size, addr, 0);
+		if (sign && (size == 1)) {
+			data = (u32) (s32) (s8) data;
+		} else if (sign && (size == 2)) {
+			data = (u32) (s32) (s16) data;
+		}
+		uc->regs[rd] = data;
+	} else {
+		data = (rd == 15) ? (uc->regs[15] + 12) : uc->regs[rd];
+		if (size == 1) {
+			data &= 0xFF;
+		} else if (size == 2) {
+			data &= 0xFFFF;
+		}
+		stub_periph(STUB_OP_WRITE, size, addr, data);
+	}
+
+	uc->regs[15] += 4;
+}
+
+static void __attribute__((naked)) stub_restorer(void) {
+	asm volatile (
+		"mov r7, #" STUB_STRING(SYS_RT_SIGRETURN) "\n"
+		"svc #0\n"
+	);
+}
+
+/**
+ * Startup section.
+ */
+
+void stub_main(void) {
+	STUB_SIGACTION_T action;
+
+	if (stub_syscall(SYS_MMAP2, STUB_RAM_START, STUB_RAM_SIZE, PROT_ALL, MAP_PRIVATE_ANONYMOUS_FIXED, -1, 0) !=
+			STUB_RAM_START) {
+		stub_die("stub: cannot map RAM\n");
+	}
+
+	action.handler = stub_fault;
+	action.flags = SA_SIGINFO | SA_RESTORER;
+	action.restorer = stub_restorer;
+	action.mask[0] = 0;
+	action.mask[1] = 0;
+
+	stub_syscall(SYS_RT_SIGACTION, SIGSEGV, (long) &action, 0, sizeof(action.mask), 0, 0);
+	stub_syscall(SYS_RT_SIGACTION, SIGBUS, (long) &action, 0, sizeof(action.mask), 0, 0);
+}
+
+/* Image entry point is at its origin, same as when the phone jumps to the loaded RAMDLD. */
+void __attribute__((naked)) _start(void) {
+	asm volatile (
+		"bl stub_main\n"
+		"ldr pc, =" STUB_STRING(STUB_IMAGE_ORIGIN) "\n"
+		".ltorg\n"
+	);
+}
@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+#
+# About:
+#   Converts the Hitagi event trace ring (FTR_TRACE builds) to a Chrome trace / Perfetto JSON timeline.
+#   Ring is taken from a raw READ dump of a phone or fetched from the host build over a session of requests.
+#
+# Author:
+#   EXL
+#
+# License:
+#   MIT
+#
+# Usage:
+#   trace.py convert dump.bin --head 0x1F4 [--hz 32768] [--endian big] [--out trace.json]
+#   trace.py run [--host ./hitagi_host] [--flash intel] [--session flash_buffer_code] [--out trace.json]
+#
+# Notes:
+#   1. Head, capacity and timer frequency are in the RQTR answer: `AAAAAAAA,HHHHHHHH,RRRR,SSSS,FFFFFFFF`.
+#      Send plain RQTR to freeze the ring and READ it from the address AAAAAAAA, the size is RRRR * SSSS.
+#   2. Phones write records big-endian, the host build writes them in the byte order of the PC.
+#   3. Open the JSON in https://ui.perfetto.dev or chrome://tracing.
+#
+
+import argparse
+import json
+import os
+import struct
+import subprocess
+import sys
+
+import bench
+
+RECORD_SIZE = 16
+
+EVENTS = ['command', 'bin_data', 'answer', 'tx_stall', 'erase', 'program']
+PHASES = ['B', 'E', 'i']
+
+# Timeline rows: protocol parser and handlers, flash chip, USB engine.
+THREADS = {'command': 1, 'bin_data': 1, 'answer': 1, 'tx_stall': 3, 'erase': 2, 'program': 2}
+THREAD_NAMES = {1: 'protocol', 2: 'flash', 3: 'usb'}
+
+def name(arg0, arg1):
+	return (struct.pack('>II', arg0, arg1).rstrip(b'\x00')).decode('ascii', 'replace')
+
+def records(dump, head, endian):
+	capacity = len(dump) // RECORD_SIZE
+	order = '>' if endian == 'big' else '<'
+	first = head - capacity if head > capacity else 0
+	for index in range(first, head):
+		offset = (index % capacity) * RECORD_SIZE
+		yield struct.unpack_from(order + 'IHHII', dump, offset)
+
+def timeline(dump, head, hz, endian):
+	events = []
+	base = None
+	last = 0
+	wraps = 0
+	for ticks, event, phase, arg0, arg1 in records(dump, head, endian):
+		# Timer is 32-bit free-running, unwrap it to keep the timeline monotonic.
+		if base is not None and ticks < last:
+			wraps += 1
+		last = ticks
+		ticks += wraps << 32
+		if base is None:
+			base = ticks
+
+		kind = EVENTS[event] if event < len(EVENTS) else f'event_{event}'
+		entry = {
+			'ph': PHASES[phase] if phase < len(PHASES) else 'i',
+			'ts': (ticks - base) * 1e6 / hz,
+			'pid': 1,
+			'tid': THREADS.get(kind, 1),
+		}
+		if kind in ('command', 'answer'):
+			entry['name'] = name(arg0, arg1)
+		elif kind in ('erase', 'program'):
+			entry['name'] = kind
+			entry['args'] = {'address': f'0x{arg0:08X}', 'size': arg1}
+		elif kind == 'bin_data':
+			entry['name'] = 'BIN data'
+			entry['args'] = {'address': f'0x{arg0:08X}', 'size': arg1}
+		else:
+			entry['name'] = kind
+		if entry['ph'] == 'i':
+			entry['s'] = 't'
+		events.append(entry)
+
+	for tid, thread in THREAD_NAMES.items():
+		events.append({'ph': 'M', 'name': 'thread_name', 'pid': 1, 'tid': tid, 'args': {'name': thread}})
+
+	return {'traceEvents': events, 'displayTimeUnit': 'ms'}
+
+def answer(output, command, count):
+	marker = bench.STX + command + bench.RS
+	start = 0
+	for _ in range(count):
+		start = output.find(marker, start) + len(marker)
+	return output[start:output.find(bench.ETX, start)]
+
+def fetch(args):
+	if args.requests:
+		with open(args.requests, 'rb') as f:
+			requests = f.read()
+	else:
+		requests = dict((name, requests) for name, _, requests in bench.sessions(args.size))[args.session]
+
+	process = subprocess.Popen(
+		[args.host, '-f', args.flash, '-t', args.timing], stdin=subprocess.PIPE, stdout=subprocess.PIPE
+	)
+
+	# Ring is cleared before the session and frozen right after it.
+	process.stdin.write(bench.mfp_cmd('RQTR', b'RESET') + requests + bench.mfp_cmd('RQTR'))
+	process.stdin.flush()
+
+	output = b''
+	marker = bench.STX + b'RSTR' + bench.RS
+	while output.count(marker) < 2 or not output.endswith(bench.ETX):
+		chunk = os.read(process.stdout.fileno(), 65536)
+		if not chunk:
+			raise RuntimeError('host runner exited before the RQTR answer, is it built with TRACE=1?')
+		output += chunk
+
+	fields = answer(output, b'RSTR', 2).decode().split(',')
+	address, head, capacity, size, hz = [int(field, 16) for field in fields]
+
+	process.stdin.write(bench.mfp_cmd('READ', f'{address:08X},{capacity * size:04X}'.encode()))
+	process.stdin.close()
+	output = process.stdout.read()
+	process.wait()
+
+	start = output.find(bench.STX + b'READ' + bench.RS) + 6
+	length = int.from_bytes(output[start:start + 2], 'big')
+	return output[start + 2:start + 2 + length], head, hz
+
+def main():
+	parser = argparse.ArgumentParser(description='Hitagi trace ring to Chrome trace / Perfetto JSON.')
+	commands = parser.add_subparsers(dest='mode', required=True)
+
+	convert = commands.add_parser('convert', help='convert raw ring dump fetched by READ')
+	convert.add_argument('dump', help='raw ring dump')
+	convert.add_argument('--head', required=True, type=lambda x: int(x, 0), help='head from the RQTR answer')
+	convert.add_argument('--hz', default=32768, type=lambda x: int(x, 0), help='timer frequency from the RQTR answer')
+	convert.add_argument('--endian', default='big', choices=['big', 'little'], help='byte order of records')
+
+	run = commands.add_parser('run', help='trace a session on the host build')
+	run.add_argument('--host', default='./hitagi_host', help='host runner built with TRACE=1')
+	run.add_argument('--flash', default='intel', help='flash chip model, intel or amd')
+	run.add_argument('--timing', default='typ', help='program and erase times, none, typ or max')
+	run.add_argument('--size', default=0x10000, type=lambda x: int(x, 0), help='image size of benchmark sessions')
+	run.add_argument('--session', default='flash_buffer_code', help='benchmark session name, see bench.py')
+	run.add_argument('--requests', help='file with raw protocol requests instead of a benchmark session')
+
+	for command in (convert, run):
+		command.add_argument('--out', default='trace.json', help='output JSON file')
+
+	args = parser.parse_args()
+
+	if args.mode == 'convert':
+		with open(args.dump, 'rb') as f:
+			dump, head, hz, endian = f.read(), args.head, args.hz, args.endian
+	else:
+		dump, head, hz = fetch(args)
+		endian = sys.byteorder
+
+	result = timeline(dump, head, hz, endian)
+	with open(args.out, 'w') as f:
+		json.dump(result, f, indent='\t')
+
+	print(f'{len(result["traceEvents"]) - len(THREAD_NAMES)} events of {head} written to {args.out}')
+
+	return 0
+
+if __name__ == '__main__':
+	sys.exit(main())
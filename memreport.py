@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+#
+# About:
+#   Memory report script for Hitagi RAMDLD project.
+#   It shows ARM and Thumb code size, room left up to the sign, buffer arena and free IRAM of the linked loader.
+#
+# Author:
+#   EXL
+#
+# License:
+#   MIT
+#
+# Notes:
+#   1. Compare the reports of `THUMB_COLD=1` and `THUMB_COLD=0` builds to see the bytes reclaimed by Thumb cold code.
+#      Free IRAM is the room for larger arena buffers, free bytes up to the sign limit the code of compact builds.
+#
+
+import struct
+import sys
+
+SHT_SYMTAB = 2
+STT_OBJECT = 1
+STT_FUNC = 2
+
+def sections(elf):
+	order = '<' if elf[5] == 1 else '>'
+	shoff, = struct.unpack_from(order + 'I', elf, 0x20)
+	shentsize, shnum, shstrndx = struct.unpack_from(order + 'HHH', elf, 0x2E)
+
+	headers = [struct.unpack_from(order + '10I', elf, shoff + i * shentsize) for i in range(shnum)]
+	names = headers[shstrndx][4]
+
+	result = []
+	for header in headers:
+		end = elf.index(b'\x00', names + header[0])
+		result.append((elf[names + header[0]:end].decode(), header))
+	return order, result
+
+def symbols(elf, order, table):
+	for _, header in table:
+		if header[1] != SHT_SYMTAB:
+			continue
+		strtab = table[header[6]][1][4]
+		for offset in range(header[4], header[4] + header[5], 16):
+			name, value, size, info, _, shndx = struct.unpack_from(order + 'IIIBBH', elf, offset)
+			end = elf.index(b'\x00', strtab + name)
+			yield elf[strtab + name:end].decode(), value, size, info & 0x0F, shndx
+
+def main(elf_path, head_path, loader_path, sign_offset):
+	with open(elf_path, 'rb') as f:
+		elf = f.read()
+	with open(head_path, 'rb') as f:
+		head_size = len(f.read())
+	with open(loader_path, 'rb') as f:
+		loader_size = len(f.read())
+
+	order, table = sections(elf)
+	index = dict((name, i) for i, (name, _) in enumerate(table))
+
+	arm = thumb = 0
+	buffers = []
+	for name, value, size, kind, shndx in symbols(elf, order, table):
+		if kind == STT_FUNC:
+			# Thumb functions have the lowest bit of address set.
+			if value & 1:
+				thumb += size
+			else:
+				arm += size
+		elif (kind == STT_OBJECT) and (shndx == index.get('.arena')):
+			buffers.append((name, size))
+
+	arena = table[index['.arena']][1]
+	stack = table[index['.stack']][1]
+	used = head_size + loader_size
+
+	print(f'Memory report of {elf_path}:')
+	print(f'  Code:   0x{arm + thumb:05X} bytes, ARM 0x{arm:05X}, Thumb 0x{thumb:05X}')
+	if used <= sign_offset:
+		print(f'  Loader: 0x{used:05X} of 0x{sign_offset:05X} bytes up to the sign, 0x{sign_offset - used:05X} free')
+	else:
+		print(f'  Loader: 0x{used:05X} of 0x{sign_offset:05X} bytes up to the sign, 0x{used - sign_offset:05X} over')
+	print(f'  Arena:  0x{arena[5]:05X} bytes at 0x{arena[3]:08X}')
+	for name, size in sorted(buffers, key=lambda buffer: buffer[1], reverse=True):
+		print(f'          {name:<24} 0x{size:05X}')
+	print(f'  IRAM:   0x{stack[3] - (arena[3] + arena[5]):05X} bytes free up to the stack reserve of 0x{stack[5]:05X}')
+
+if __name__ == '__main__':
+	if len(sys.argv) != 5:
+		print('Usage: python memreport.py <loader.elf> <head.bin> <loader.bin> <SIGN_OFFSET>')
+		sys.exit(1)
+	main(sys.argv[1], sys.argv[2], sys.argv[3], int(sys.argv[4], 16))
@@ -0,0 +1,59 @@
+/*
+ * About:
+ *   Interface of loadable modules: position-independent blobs uploaded to RAM with BIN and attached to the loader
+ *   with REGISTER (new command handler) or run once with CALL (kernel).
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ *
+ * Notes:
+ *   1. Module is linked at zero by modules/module.ld with its entry first, so the upload address is the entry.
+ *   2. Module has no access to the loader symbols, everything goes through HITAGI_MODULE_API_T passed on every call.
+ *      Module code must not use global data through GOT, only its own static functions and stack.
+ *   3. Thumb entries (odd addresses) need the interworking build of the loader, THUMB_COLD=1, the THUMB_COLD=0
+ *      loader answers ERR to REGISTER and CALL with them.
+ *   4. Entry is only checked to be in RAM, the loader does not track which addresses were uploaded with BIN.
+ */
+
+#ifndef MODULE_H
+#define MODULE_H
+
+#include "flash.h"
+
+#define MODULE_API_VERSION             (1)
+#define MAX_MODULES                    (8)
+
+#define MODULE_ENTRY                   __attribute__((section(".module_entry")))
+
+typedef struct {
+	u32 version;
+	u8 *response;                      /* Scratch for answers, MAX_READ_RESPONSE_SIZE bytes. */
+	const HITAGI_CMDLET_ERASE_T *erase_cmdlet;
+	void (*send_packet)(const u8 *cmd, const u8 *data);
+	void (*send_segments)(const u8 *cmd, const HITAGI_TX_SEGMENT_T *segments, u8 count);
+	void (*send_ack)(const u8 *data);
+	void (*send_error)(u8 error_code);
+	int (*watchdog_service)(void);
+	u32 (*timer_ticks)(void);
+	int (*flash_unlock)(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+	int (*flash_erase)(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+	int (*flash_write_block)(volatile FLASH_DATA_WIDTH *reg_addr_ctl, volatile FLASH_DATA_WIDTH *buffer, u32 size);
+	int (*flash_write_buffer)(volatile FLASH_DATA_WIDTH *reg_addr_ctl, const FLASH_DATA_WIDTH *buffer, u32 size);
+	int (*flash_geometry)(volatile FLASH_DATA_WIDTH *reg_addr_ctl);
+} HITAGI_MODULE_API_T;
+
+/* Registered command handler, answers itself through the API. */
+typedef void (*HITAGI_MODULE_HANDLER_T) (const HITAGI_MODULE_API_T *api, const u8 *cmd, const u8 *data, const u8 *next);
+
+/* Kernel run by CALL, the result goes back in the answer. */
+typedef u32 (*HITAGI_MODULE_CALL_T) (const HITAGI_MODULE_API_T *api, u32 arg);
+
+typedef struct {
+	u8 cmd[MAX_COMMAND_STR_SIZE];
+	HITAGI_MODULE_HANDLER_T handler;
+} HITAGI_MODULE_T;
+
+#endif /* !MODULE_H */
@@ -0,0 +1,51 @@
+/*
+ * About:
+ *   Blank check kernel, counts programmed words from a flash address to the end of its block.
+ *   Flasher can skip the erase of a block which is blank already.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ *
+ * Usage:
+ *   make PLATFORM=LTE1C modules
+ *
+ *   mfp_cmd(er, ew, 'ADDR', b'12000000')
+ *   mfp_upload_binary(er, ew, 'modules/blank.bin')
+ *   mfp_cmd(er, ew, 'CALL', b'12000000,10100000')
+ */
+
+#include "../module.h"
+
+#define BLANK_WATCHDOG_WORDS           (1024)
+
+/**
+ * Functions.
+ */
+
+u32 MODULE_ENTRY module_entry(const HITAGI_MODULE_API_T *api, u32 arg);
+
+/**
+ * Blank section.
+ */
+
+/* Block end is where the driver geometry offset wraps to zero, zero result means the rest of the block is blank. */
+u32 MODULE_ENTRY module_entry(const HITAGI_MODULE_API_T *api, u32 arg) {
+	u32 count = 0;
+	u32 words = 0;
+	volatile FLASH_DATA_WIDTH *addr = (volatile FLASH_DATA_WIDTH *) (arg & ~(sizeof(FLASH_DATA_WIDTH) - 1));
+
+	do {
+		if (*addr++ != FLASH_ERASED_WORD) {
+			count++;
+		}
+
+		if ((++words % BLANK_WATCHDOG_WORDS) == 0) {
+			api->watchdog_service();
+		}
+	} while (api->flash_geometry(addr) != 0);
+
+	return count;
+}
@@ -0,0 +1,108 @@
+/*
+ * About:
+ *   Checksum module, RQRC command for compact builds which have no built-in one.
+ *   Bytes are summed from whole words and the watchdog is serviced every 1 KiB instead of every byte.
+ *
+ * Author:
+ *   EXL
+ *
+ * License:
+ *   MIT
+ *
+ * Usage:
+ *   make PLATFORM=LTE1C modules
+ *
+ *   mfp_cmd(er, ew, 'ADDR', b'12000000')
+ *   mfp_upload_binary(er, ew, 'modules/checksum.bin')
+ *   mfp_cmd(er, ew, 'REGISTER', b'RQRC,12000000')
+ *   mfp_cmd(er, ew, 'RQRC', b'10000000,10000600')
+ */
+
+#include "../module.h"
+
+#define CHECKSUM_WATCHDOG_BYTES        (1024)
+
+/**
+ * Functions.
+ */
+
+static u32 checksum_hexasc_to_u32(const u8 *str, u8 size);
+
+void MODULE_ENTRY module_entry(const HITAGI_MODULE_API_T *api, const u8 *cmd, const u8 *data, const u8 *next);
+
+/**
+ * Checksum section.
+ */
+
+static u32 checksum_hexasc_to_u32(const u8 *str, u8 size) {
+	u8 digit;
+	u32 val = 0;
+
+	while (size--) {
+		digit = *str++;
+		val <<= 4;
+		val += (digit >= 'A') ? (digit - '7') : (digit - '0');
+	}
+
+	return val;
+}
+
+/* Same answer as the RQRC of hitagi.c: 16-bit sum of bytes from start to end address inclusive. */
+void MODULE_ENTRY module_entry(const HITAGI_MODULE_API_T *api, const u8 *cmd, const u8 *data, const u8 *next) {
+	static const u8 answer[] = "RSRC";
+
+	u8 i;
+	u8 digit;
+	u16 csum;
+	u32 word;
+	u32 start_addr;
+	u32 end_addr;
+	const u8 *data_ptr;
+
+	UNUSED(cmd);
+	UNUSED(next);
+
+	if (data == NULL) {
+		api->send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	start_addr = checksum_hexasc_to_u32(&data[0], CMD_32_SIZE);
+	end_addr = checksum_hexasc_to_u32(&data[CMD_32_SIZE + 1], CMD_32_SIZE);
+
+	if ((end_addr - start_addr) < 1) {
+		api->send_error(ERR_DATA_INVALID);
+		return;
+	}
+
+	csum = 0;
+	data_ptr = (const u8 *) start_addr;
+
+	/* Head bytes up to the word boundary, whole words, then the tail bytes. */
+	while (((u32) data_ptr % sizeof(u32)) && ((u32) data_ptr <= end_addr)) {
+		csum += *data_ptr++;
+	}
+
+	while ((end_addr - (u32) data_ptr) >= (sizeof(u32) - 1) && ((u32) data_ptr <= end_addr)) {
+		word = *(const u32 *) data_ptr;
+		csum += (word & 0xFF) + ((word >> 8) & 0xFF) + ((word >> 16) & 0xFF) + (word >> 24);
+		data_ptr += sizeof(u32);
+
+		if (((u32) data_ptr % CHECKSUM_WATCHDOG_BYTES) == 0) {
+			api->watchdog_service();
+		}
+	}
+
+	while ((u32) data_ptr <= end_addr) {
+		csum += *data_ptr++;
+	}
+
+	for (i = 0; i < CMD_16_SIZE; ++i) {
+		digit = (csum >> 12) & 0x0F;
+		csum <<= 4;
+		api->response[i] = (digit > 9) ? (digit + '7') : (digit + '0');
+	}
+	api->response[i] = NUL;
+
+	api->send_packet(answer, api->response);
+}
@@ -44,6 +44,16 @@ typedef unsigned long long             u64;
 #define BIT_CLEAR                      (0)
 #define BIT_SET                        (1)
 
+/* Uninitialized buffer placed after the image by the linker script, see hitagi.lds. */
+#define ARENA                          __attribute__((section(".arena")))
+
+/* Rarely called code, built as Thumb in the interworking builds to leave more IRAM for buffers. */
+#if defined(FTR_THUMB_COLD)
+	#define COLD                       __attribute__((target("thumb")))
+#else
+	#define COLD
+#endif
+
 #define UNUSED(x)                      ((void) x)
 
 /**
@@ -57,7 +67,6 @@ typedef unsigned long long             u64;
 
 #define MAX_DATA_FIELD_SIZE            (2)
 #define MAX_COMMAND_STR_SIZE           (12)
-#define MAX_ACK_RESPONSE_SIZE          (32)
 #define MAX_RESP_DATA_SIZE             (64)
 
 #define SHIFT_MSB                      (8)
@@ -78,6 +87,80 @@ typedef unsigned long long             u64;
 #define CMD_16_SIZE                    (4)
 #define CMD_8_SIZE                     (2)
 
+#define MAX_SEGMENTS                   (32)
+#define SEGMENT_ENTRY_SIZE             (CMD_32_SIZE + 1 + CMD_32_SIZE + 1)
+
+#define MAX_READ_RANGES                (16)
+#define READ_RANGE_ENTRY_SIZE          (CMD_32_SIZE + 1 + CMD_16_SIZE + 1)
+#define READ_RANGE_HEADER_SIZE         (2 + 1)
+#define READ_RANGE_SEGMENTS            (3)
+
+#define BENCH_ENTRY_SIZE               (CMD_32_SIZE + 1 + CMD_16_SIZE)
+#define BENCH_READ_SIZE                (0x2000)
+#define BENCH_READ_PASSES              (32)
+#define BENCH_READ_REGIONS             (3)
+#define BENCH_READ_WIDTHS              (3)
+#define BENCH_PROGRAM_ALIGN            (0x20)
+#define BENCH_PROGRAM_MAX_SIZE         (0x1000)
+
+/* BENCH answer layout, read ticks go for every region with all widths, erase and program ticks follow them. */
+#define BENCH_RESULT_TIMER_HZ          (0)
+#define BENCH_RESULT_READ_BYTES        (1)
+#define BENCH_RESULT_READ              (2)
+#define BENCH_RESULT_ERASE             (BENCH_RESULT_READ + BENCH_READ_REGIONS * BENCH_READ_WIDTHS)
+#define BENCH_RESULT_WRITE_WORD        (BENCH_RESULT_ERASE + 1)
+#define BENCH_RESULT_WRITE_BUFFER      (BENCH_RESULT_WRITE_WORD + 1)
+#define BENCH_RESULT_ERASE_PROGRAMMED  (BENCH_RESULT_WRITE_BUFFER + 1)
+#define BENCH_RESULTS                  (BENCH_RESULT_ERASE_PROGRAMMED + 1)
+
+#define FILL_ENTRY_SIZE_16             (CMD_32_SIZE + 1 + CMD_32_SIZE + 1 + CMD_16_SIZE)
+#define FILL_ENTRY_SIZE_32             (CMD_32_SIZE + 1 + CMD_32_SIZE + 1 + CMD_32_SIZE)
+#define FILL_BURST_SIZE                (8 * 4)    /* One STM of 8 words. */
+#define FILL_RAM_CHUNK_SIZE            (0x8000)   /* Watchdog is serviced after every chunk. */
+#define FILL_FLASH_CHUNK_SIZE          (0x400)    /* Pattern source in the response buffer, divides all block sizes. */
+#define FILL_ERASED_PATTERN            (0xFFFFFFFF)
+
+#define COPY_ENTRY_SIZE                (CMD_32_SIZE + 1 + CMD_32_SIZE + 1 + CMD_32_SIZE)
+/* Staging of flash source in the response buffer, divides all block sizes. */
+#define COPY_CHUNK_SIZE                (0x400)
+
+#define FIND_HEADER_SIZE               (CMD_32_SIZE + 1 + CMD_32_SIZE + 1 + CMD_8_SIZE + 1)
+#define FIND_MAX_PATTERN_SIZE          (64)
+#define FIND_MAX_MATCHES               (16)
+/* Text copied to IRAM and scanned at once, watchdog is serviced after it. */
+#define FIND_WINDOW_SIZE               (0x400)
+
+/*
+ * IMEI record is 64 bits of OTP encrypted with the SoC UID, the flash driver knows where it lives (imei_pr_offset).
+ */
+#define IMEI_PR_WORDS                  (4)
+#define IMEI_DIGITS                    (15)
+
+#define READ_MODE_ENTRY_SIZE           (CMD_16_SIZE + 1 + CMD_16_SIZE)
+#define READ_MODE_ENTRY_SIZE_CS        (READ_MODE_ENTRY_SIZE + 1 + CMD_32_SIZE + 1 + CMD_32_SIZE)
+
+/*
+ * RQDD device descriptor, big-endian binary structure, see the RQDD note in hitagi.c for the layout.
+ */
+#define DESCRIPTOR_VERSION             (1)
+#define DESCRIPTOR_HEADER_SIZE         (48)
+#define DESCRIPTOR_REGION_SIZE         (3 * 4)
+#define DESCRIPTOR_MAX_SIZE            (DESCRIPTOR_HEADER_SIZE + FLASH_MAX_REGIONS * DESCRIPTOR_REGION_SIZE)
+
+#define CAP_SCATTER_LISTS              (1 << 0)  /* ADDR_LIST and READ_LIST. */
+#define CAP_DIRECT_BIN                 (1 << 1)  /* BIN payload to RAM is placed right from the USB RX ring. */
+#define CAP_PERF_COUNTERS              (1 << 2)  /* RQPC. */
+#define CAP_BENCH                      (1 << 3)  /* BENCH. */
+#define CAP_TRACE                      (1 << 4)  /* RQTR, FTR_TRACE builds. */
+#define CAP_JOURNAL                    (1 << 5)  /* RQJN. */
+#define CAP_FILL                       (1 << 6)  /* FILL. */
+#define CAP_COPY                       (1 << 7)  /* COPY. */
+#define CAP_FIND                       (1 << 8)  /* FIND. */
+#define CAP_IMEI                       (1 << 9)  /* READ_IMEI. */
+#define CAP_READ_MODE                  (1 << 10) /* READ_MODE. */
+#define CAP_FLASH_AMD                  (1 << 11) /* AMD-like flash driver is in use, Intel-like otherwise. */
+#define CAP_FLASH_DEFAULT              (1 << 12) /* CFI query matched no FLASH_TYPE=auto driver, default taken. */
+
 typedef void (*HITAGI_CMD_HANDLER_T) (const u8 *answer_str, const u8 *data, const u8 *next);
 
 typedef struct {
@@ -86,6 +169,16 @@ typedef struct {
 	HITAGI_CMD_HANDLER_T cmd_func;
 } HITAGI_CMD_TABLE_T;
 
+typedef struct {
+	const u8 *ptr;
+	u16 size;
+} HITAGI_TX_SEGMENT_T;
+
+typedef struct {
+	u32 start;
+	u32 end;
+} HITAGI_MEM_WINDOW_T;
+
 typedef enum {
 	ERASE_NO,
 	ERASE_WRITE_BLOCK,
@@ -95,12 +188,133 @@ typedef enum {
 
 extern HITAGI_CMDLET_ERASE_T erase_cmdlet;
 
+/*
+ * Performance counters of the hot paths, read and reset by the RQPC command.
+ * Times are in ticks of the hardware timer, see HAL_TIMER_HZ.
+ */
+typedef struct {
+	u32 rx_bytes;
+	u32 tx_bytes;
+	u32 rx_empty_polls;
+	u32 tx_full_spins;
+	u32 flash_busy_polls;
+	u32 erase_count;
+	u32 erase_ticks;
+	u32 program_count;
+	u32 program_bytes;
+	u32 program_ticks;
+} HITAGI_PERF_T;
+
+typedef struct {
+	u32 count;
+	u32 ticks;
+} HITAGI_PERF_CMD_T;
+
+extern HITAGI_PERF_T perf;
+
+/* Compact builds have no RQPC command, so counters and timer reads are compiled out there. */
+#if !defined(FTR_COMPACT)
+	#define PERF_ADD(counter, value)   (perf.counter += (value))
+	#define PERF_TICKS()               hal_timer_ticks()
+#else
+	#define PERF_ADD(counter, value)   ((void) (value))
+	#define PERF_TICKS()               (0)
+#endif
+
+/*
+ * Read mode manager, page or burst array reads of the flash set up by the READ_MODE command.
+ * Flash drivers switch back to asynchronous reads before every command sequence, array reads of the loader
+ * switch to the fast mode again lazily, so flashing and dumping do not toggle the mode on every packet.
+ */
+typedef struct {
+	u8 enabled;
+	u8 fast;                           /* Chip and chip-select are in the fast mode now. */
+	u16 config_fast;                   /* Read configuration register values of the chip. */
+	u16 config_async;
+	u32 cs_reg;                        /* Chip-select control register of the flash, zero if timing is kept. */
+	u32 cs_fast;
+	u32 cs_async;                      /* Saved on every switch to the fast mode. */
+} HITAGI_READ_MODE_T;
+
+/* Compact builds have no READ_MODE command, flash always stays in asynchronous mode there. */
+#if !defined(FTR_COMPACT)
+	#define READ_MODE_ASYNC()          read_mode_switch(0)
+	#define READ_MODE_FAST()           read_mode_switch(1)
+#else
+	#define READ_MODE_ASYNC()
+	#define READ_MODE_FAST()
+#endif
+
+/* Number of x16 flash chips on the data bus, two of them are interleaved on 32-bit bus, see flash.h. */
+#if defined(FTR_FLASH_DATA_WIDTH_32BIT)
+	#define FLASH_CHIPS                (2)
+#else
+	#define FLASH_CHIPS                (1)
+#endif
+
+/*
+ * Flashing progress journal, read and reset by the RQJN command.
+ * Every bit of the bitmap is a granule of the smallest erase block, a block is complete when all its granules are set.
+ */
+#define JOURNAL_GRANULE_SIZE           (0x8000 * FLASH_CHIPS)
+#define JOURNAL_FLASH_SIZE             (0x2000000 * FLASH_CHIPS)
+#define JOURNAL_GRANULES               (JOURNAL_FLASH_SIZE / JOURNAL_GRANULE_SIZE)
+#define JOURNAL_NONE                   (0xFFFFFFFF)
+#define JOURNAL_PCRAM_MAGIC            (0x484A4E4C) /* "HJNL" */
+
+typedef struct {
+	u32 last_block;
+	u32 completed;
+	u8 bitmap[JOURNAL_GRANULES / 8];
+} HITAGI_JOURNAL_T;
+
+/*
+ * Event trace ring buffer, compiled in with FTR_TRACE and fetched by the host with RQTR and READ.
+ * Records are written in the CPU byte order, so the Neptune builds give big-endian dumps.
+ */
+#define TRACE_RING_RECORDS             (512)
+
+typedef enum {
+	TRACE_COMMAND,
+	TRACE_BIN_DATA,
+	TRACE_ANSWER,
+	TRACE_TX_STALL,
+	TRACE_ERASE,
+	TRACE_PROGRAM
+} HITAGI_TRACE_EVENT_T;
+
+typedef enum {
+	TRACE_BEGIN,
+	TRACE_END,
+	TRACE_INSTANT
+} HITAGI_TRACE_PHASE_T;
+
+typedef struct {
+	u32 ticks;
+	u16 event;
+	u16 phase;
+	u32 arg0;
+	u32 arg1;
+} HITAGI_TRACE_RECORD_T;
+
+#if defined(FTR_TRACE)
+	extern void trace_event(u16 event, u16 phase, u32 arg0, u32 arg1);
+
+	#define TRACE(event, phase, arg0, arg1)  trace_event((event), (phase), (u32) (arg0), (u32) (arg1))
+#else
+	#define TRACE(event, phase, arg0, arg1)
+#endif
+
 /**
  * Functions.
  */
 
 extern int watchdog_service(void);
 
+extern void usb_poll(void);
+
+extern void read_mode_switch(u8 fast);
+
 extern void nop(u32 nop_count);
 
 #endif /* !PLATFORM_H */
@@ -14,25 +14,27 @@
 import sys
 
 def main():
-	if len(sys.argv) != 5:
-		print('Usage: python prelink.py <template.lds> <output.ld> <ORIGIN> <LENGTH>')
+	if len(sys.argv) != 6:
+		print('Usage: python prelink.py <template.lds> <output.ld> <ORIGIN> <LENGTH> <STACK>')
 		sys.exit(1)
 
 	in_file  = sys.argv[1]
 	out_file = sys.argv[2]
 	origin   = sys.argv[3]
 	length   = sys.argv[4]
+	stack    = sys.argv[5]
 
 	with open(in_file, 'r', encoding='utf-8') as f:
 		content = f.read()
 
 	content = content.replace('%ORIGIN%', origin)
 	content = content.replace('%LENGTH%', length)
+	content = content.replace('%STACK%', stack)
 
 	with open(out_file, 'w', encoding='utf-8') as f:
 		f.write(content)
 
-	print(f'Patched {in_file} -> {out_file} with ORIGIN={origin}, LENGTH={length}')
+	print(f'Patched {in_file} -> {out_file} with ORIGIN={origin}, LENGTH={length}, STACK={stack}')
 
 if __name__ == '__main__':
 	main()
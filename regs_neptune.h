@@ -103,6 +103,52 @@
  */
 
 #define RTC_PCRAM0 (*(volatile u32 *) 0x2484300C)
+#define RTC_PCRAM14 (*(volatile u32 *) 0x24843044)
+#define RTC_PCRAM15 (*(volatile u32 *) 0x24843048)
+
+/**
+ * GPT (General purpose timer) section.
+ */
+
+/*
+ * GPT_TCTL: GPT Timer Control Register, $2484_7000, 32-bit.
+ *
+ * Bits:
+ * ; 00: TEN, Timer Enable.
+ *           0 = Timer is disabled and its counter is reset.
+ *           1 = Timer is enabled.
+ * ; 03-01: CLKSOURCE, Clock Source.
+ *           000 = Stop count.
+ *           001 = Peripheral clock.
+ *           010 = Peripheral clock divided by 16.
+ *           011 = TIN pin.
+ *           1xx = 32 kHz reference clock.
+ * ; 08: FRR, Free-Run/Restart.
+ *           0 = Restart mode, counter is reset on compare event.
+ *           1 = Free-run mode, counter keeps running after compare event.
+ */
+
+#define GPT_TCTL (*(volatile u32 *) 0x24847000)
+
+#define GPT_TCTL_TEN         (1 << 0)
+#define GPT_TCTL_CLK_32K     (4 << 1)
+#define GPT_TCTL_FRR         (1 << 8)
+
+/*
+ * GPT_TPRER: GPT Timer Prescaler Register, $2484_7004, 32-bit.
+ *
+ *   PRESCALER[10:0], Bits 10-0. Clock source is divided by (PRESCALER + 1).
+ */
+
+#define GPT_TPRER (*(volatile u32 *) 0x24847004)
+
+/*
+ * GPT_TCN: GPT Timer Counter Register, $2484_7010, 32-bit.
+ *
+ *   COUNT[31:0], current counter value, read-only.
+ */
+
+#define GPT_TCN (*(volatile u32 *) 0x24847010)
 
 /**
  * USB section.
@@ -198,12 +244,6 @@
 
 #define USB_MAX_RX_DATA_SIZE (8192 + 128)
 
-/*
- * USB_MAX_TX_DATA_SIZE: Max TX size.
- */
-
-#define USB_MAX_TX_DATA_SIZE (2048)
-
 /*
  * USB_MAX_PACKET_SIZE: Max USB packet size.
  *
@@ -224,6 +264,49 @@
 
 #define USB_DATA_ARRAY_SIZE (32)
 
+/*
+ * USB_RX_RING_SIZE: Size of EP1 receive ring buffer, must be power of two.
+ */
+
+#define USB_RX_RING_SIZE (2048)
+
+/*
+ * USB_TX_RING_PACKETS: Number of EP2 packet slots in transmit ring buffer, must be power of two.
+ */
+
+#define USB_TX_RING_PACKETS (8)
+
+/**
+ * WEIM (Wireless External Interface Module) section.
+ */
+
+/*
+ * WEIM_CSCR: Chip Select Control Registers, $2484_1000...$2484_1030, 6 chip selects, 32-bit.
+ *
+ * Every chip select has the upper (wait states, burst and page modes) and the lower (strobe timing) control
+ * register, CS0 is the NOR flash and CS1 is the external RAM. READ_MODE accepts only these registers.
+ *
+ *   WEIM_CSCRU(cs) = $2484_1000 + cs * 8
+ *   WEIM_CSCRL(cs) = $2484_1004 + cs * 8
+ */
+
+#define WEIM_CS_COUNT      (6)
+#define WEIM_CSCR_START    (0x24841000)
+#define WEIM_CSCR_END      (WEIM_CSCR_START + WEIM_CS_COUNT * 8)
+
+/**
+ * Memory map section.
+ */
+
+/*
+ * NEPTUNE_RAM: External RAM on the chip select following the NOR flash, $1200_0000...$1400_0000.
+ *
+ * Loader code and buffers live in IRAM, so uploads to this window may bypass the RX staging buffer.
+ */
+
+#define NEPTUNE_RAM_START (0x12000000)
+#define NEPTUNE_RAM_END   (0x14000000)
+
 /**
  * UID Section.
  */